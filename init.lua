@@ -11,8 +11,66 @@
     ed:paste_text()
     ed:new_line()
     ed:tab()
+    ed:begin_edit(bytes : number?)
+    ed:commit_edit()
+    ed:edit(function : function)
+    ed:undo()
+    ed:redo()
+    ed:reload()
+    ed:replace_all("query" : string, "text" : string)
+    ed:toggle_profiler()
+    ed:line_count()
+    ed:line(n : number)
+    ed:range(a : number, b : number)
+    ed:cursor()
+    ed:chunks(a : number?, b : number?)
+    ed:open("path" : string)
+    ed:next_buffer()
+    ed:prev_buffer()
+    ed:switch_buffer(n : number)
+    ed:buffer_count()
+    ed:current_buffer()
+    ed:add_cursor(at : number)
+    ed:select_next()
+    ed:select_all()
+    ed:clear_cursors()
+    ed:cursor_count()
 
   ed:insert_text() inserts text at the current cursor point
+  ed:edit() runs a function inside one edit transaction, every insert and
+  delete it makes lands in the document right away so the function reads
+  its own edits, the layout cache and highlighting catch up once when it
+  returns, the view follows the cursor once, and it is undone as one step
+  ed:reload() loads the file from disk again and drops the edits since the
+  last save, Ctrl+R does the same, a file another program changes is never
+  reloaded on its own
+  ed:replace_all() replaces every occurrence of query with text in one pass
+  and returns how many there were, the whole replace is a single undo step
+  ed:toggle_profiler() shows frame times, keystroke to draw latency and the
+  slowest scopes, F3 does the same and F4 writes phosphor-trace.json
+
+  Reading the document never copies more than you ask for, lines and byte
+  offsets start at 1 like they do for Lua strings
+  ed:line(n) is line n without its newline, nil past the last line
+  ed:range(a, b) is bytes a to b inclusive, like string.sub
+  ed:cursor() returns the cursor's byte offset, line and column
+  ed:chunks() walks the document (or bytes a to b) a piece at a time:
+    local words = 0
+    for chunk in ed:chunks() do
+      for _ in chunk:gmatch("%S+") do words = words + 1 end
+    end
+  a word split across two chunks is counted twice here, so scripts that care
+  should carry the tail of one chunk over to the next
+
+  Several files can be open at once, every ed: function works on the one on
+  screen, buffers are numbered from 1 in the order they were opened
+  ed:open(path) switches to a file, opening it first if it is not open yet
+
+  ed:add_cursor(at) adds a cursor at byte offset at, after that typing,
+  backspace and the arrow keys work at every cursor and each keystroke is a
+  single undo step, ed:clear_cursors() goes back to one cursor
+  ed:select_next() selects the word under the cursor, then adds a cursor on
+  the next occurrence of it, ed:select_all() selects every occurrence
 ]]
 
 register_command(keys.KEY_H, Mod.CTRL, function(ed)
@@ -37,4 +95,34 @@ end)
   Currently supported functions are the following:
     register_command()
     pick_pallete()
+    set_undo_budget(bytes : number)
+    set_buffer_budget(bytes : number)
+    dump_trace("path" : string)
+    on_change(function : function)
+    on_insert(function : function)
+    on_delete(function : function)
+    on_save(function : function)
+    on_cursor_move(function : function)
+    on_idle(function : function)
+    set_hook_budget(ms : number)
+
+  Hooks are called at most once a frame with everything that happened in it,
+  a burst of typing is a single call and not one per key:
+    on_change(function(ed, changes) end)   -- changes[i].at, .length, .text
+    on_insert(function(ed, inserts) end)   -- inserts[i].at, .text, .change
+    on_delete(function(ed, deletes) end)   -- deletes[i].at, .length, .change
+    on_save(function(ed, path, ok) end)
+    on_cursor_move(function(ed, offset, line, col) end)
+    on_idle(function(ed) end)              -- half a second after input stops
+  Each change replaced length bytes at at with text, changes are in the order
+  they were made and at is where the change happened after every change
+  before it, so applying them one after the other replays the frame
+  on_insert and on_delete get the inserting and deleting halves of the same
+  changes, change is the index of the change an entry belongs to, the halves
+  only line up with the document when they are applied in change order
+  Offsets are 1-based, edits a hook makes itself are not reported back to
+  the hooks, undo and redo report the edits they put back and replace_all
+  reports one change per match
+  Every handler gets 4 ms by default, a handler that runs longer is stopped
+  and reported so it cannot freeze the editor
 ]]
\ No newline at end of file
@@ -0,0 +1,424 @@
+// Headless micro benchmarks for the gap buffer
+// This builds without raylib or a window, run it with `make bench`
+// An optional argument caps the largest str() and index scenarios, in bytes
+
+#include "../include/file_loader.hpp"
+#include "../include/gap_buffer.hpp"
+#include "../include/highlighter.hpp"
+#include "../include/newline_scan.hpp"
+#include "../include/search.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static constexpr std::size_t KiB = 1024;
+static constexpr std::size_t MiB = 1024 * KiB;
+static constexpr std::size_t GiB = 1024 * MiB;
+
+// What a scenario measured
+struct Result {
+    std::size_t ops{0};
+    double ns{0.0};
+    std::size_t copied{0};
+};
+
+// We fold results into this so the compiler cannot drop the work
+static volatile std::size_t sink = 0;
+
+// Helper to time a block of work in nanoseconds
+static double time_ns(const std::function<void()> &fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+// Helper to build a buffer of a given size out of printable lines, we insert
+// it in blocks so we never hold a second copy of the whole text
+static GapBuffer make_buffer(std::size_t size) {
+    std::string block;
+    for (std::size_t i = 0; block.size() < MiB; ++i) {
+        block += "the quick brown fox jumps over the lazy dog ";
+        block += std::to_string(i);
+        block += '\n';
+    }
+    GapBuffer buf(64);
+    buf.reserve(size);
+    while (buf.size() < size) {
+        buf.insert(std::string_view(block).substr(
+            0, std::min(block.size(), size - buf.size())));
+    }
+    buf.reset_stats();
+    return buf;
+}
+
+// Helper to format a byte count
+static std::string bytes(double n) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int u = 0;
+    while (n >= 1024.0 && u < 4) {
+        n /= 1024.0;
+        ++u;
+    }
+    char out[32];
+    std::snprintf(out, sizeof(out), "%.1f %s", n, units[u]);
+    return out;
+}
+
+// Helper to read the peak resident set size of this process
+static std::size_t peak_rss() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * KiB;
+#endif
+}
+
+// Helper to run a scenario in its own process so the peak RSS we report
+// belongs to that scenario alone
+static void run(const std::string &name, const std::function<Result()> &fn) {
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        Result r = fn();
+        std::printf("%-32s %10zu %14.1f %14s %12s\n", name.c_str(), r.ops,
+                    r.ops ? r.ns / r.ops : 0.0, bytes(r.copied).c_str(),
+                    bytes(peak_rss()).c_str());
+        std::fflush(stdout);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::printf("%-32s failed (out of memory?)\n", name.c_str());
+    }
+}
+
+// Random inserts and erases all over a 1 MiB document
+static Result random_edits() {
+    GapBuffer buf = make_buffer(MiB);
+    std::mt19937_64 rng(42);
+    const std::size_t ops = 200000;
+    std::string text(16, 'x');
+    Result r;
+    r.ops = ops;
+    r.ns = time_ns([&] {
+        for (std::size_t i = 0; i < ops; ++i) {
+            buf.set_cursor(rng() % (buf.size() + 1));
+            std::size_t n = 1 + rng() % 16;
+            if (rng() & 1) {
+                buf.insert(std::string_view(text).substr(0, n));
+            } else {
+                buf.erase_back(n);
+            }
+        }
+    });
+    r.copied = buf.stats().bytes_copied();
+    sink = sink + buf.size();
+    return r;
+}
+
+// Cursor jumps between the two ends of a 16 MiB document, every jump drags
+// almost the whole document across the gap
+static Result long_jumps() {
+    GapBuffer buf = make_buffer(16 * MiB);
+    const std::size_t ops = 200;
+    Result r;
+    r.ops = ops;
+    r.ns = time_ns([&] {
+        for (std::size_t i = 0; i < ops; ++i) {
+            buf.set_cursor(i & 1 ? buf.size() - i : i);
+        }
+    });
+    r.copied = buf.stats().bytes_copied();
+    sink = sink + buf.cursor();
+    return r;
+}
+
+// A single 100 MB paste into the middle of a 1 MiB document
+static Result big_paste() {
+    GapBuffer buf = make_buffer(MiB);
+    std::string paste(100 * 1000 * 1000, 'p');
+    buf.set_cursor(buf.size() / 2);
+    buf.reset_stats();
+    Result r;
+    r.ops = 1;
+    r.ns = time_ns([&] { buf.insert(paste); });
+    r.copied = buf.stats().bytes_copied();
+    sink = sink + buf.size();
+    return r;
+}
+
+// Typing with c_str() after every keystroke, which is what drawing used to do
+static Result c_str_per_edit() {
+    GapBuffer buf = make_buffer(MiB);
+    buf.set_cursor(buf.size() / 2);
+    buf.reset_stats();
+    const std::size_t ops = 2000;
+    Result r;
+    r.ops = ops;
+    r.ns = time_ns([&] {
+        for (std::size_t i = 0; i < ops; ++i) {
+            buf.insert('a');
+            sink = sink + static_cast<unsigned char>(buf.c_str()[i]);
+        }
+    });
+    r.copied = buf.stats().bytes_copied();
+    return r;
+}
+
+// Flattening the whole document, the copy str() makes is not the buffer's own
+// so we count it here
+static Result flatten(std::size_t size) {
+    GapBuffer buf = make_buffer(size);
+    buf.set_cursor(buf.size() / 2);
+    buf.reset_stats();
+    std::size_t ops = std::clamp<std::size_t>(GiB / size, 1, 100000);
+    Result r;
+    r.ops = ops;
+    r.ns = time_ns([&] {
+        for (std::size_t i = 0; i < ops; ++i) {
+            std::string s = buf.str();
+            sink = sink + s.size();
+        }
+    });
+    r.copied = buf.stats().bytes_copied() + ops * size;
+    return r;
+}
+
+// Building the line index of a document the way opening a file does, the
+// offsets are checked against a plain memchr scan so a wrong fast path
+// shows up as a failed scenario
+static Result index_build(std::size_t size) {
+    GapBuffer buf = make_buffer(size);
+    std::string_view text = buf.segments().first;
+    std::vector<std::size_t> fast;
+    Result r;
+    r.ops = 1;
+    r.ns = time_ns([&] { scan_newlines_parallel(text, 0, fast); });
+    std::vector<std::size_t> slow;
+    for (const char *p = text.data(), *end = p + text.size(); p < end;) {
+        const void *hit = std::memchr(p, '\n', end - p);
+        if (!hit) {
+            break;
+        }
+        p = static_cast<const char *>(hit);
+        slow.push_back(p - text.data());
+        ++p;
+    }
+    if (fast != slow) {
+        std::exit(1);
+    }
+    sink = sink + fast.size();
+    return r;
+}
+
+// Opening a file through load_file like the editor does, stream pumps the
+// loader until it is done like the render thread would, without it the table
+// is built up front like a replay does
+// The file is written first and its pages are cold only if the kernel
+// dropped them, so this measures scanning and not the disk
+static Result load(std::size_t size, bool stream) {
+    std::string path = "/tmp/phosphor-bench-XXXXXX";
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        std::exit(1);
+    }
+    close(fd);
+    std::size_t lines = 0;
+    {
+        GapBuffer buf = make_buffer(size);
+        std::ofstream out(path, std::ios::binary);
+        auto [a, b] = buf.segments();
+        out.write(a.data(), static_cast<std::streamsize>(a.size()));
+        out.write(b.data(), static_cast<std::streamsize>(b.size()));
+        lines = buf.line_count();
+    }
+    // load_file reports what it opened, that would break up the table
+    std::cout.setstate(std::ios::badbit);
+    Loaded loaded;
+    Result r;
+    r.ops = 1;
+    r.ns = time_ns([&] {
+        loaded = load_file(path, "piece", stream);
+        while (loaded.loader && !loaded.loader->done()) {
+            loaded.loader->pump();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    unlink(path.c_str());
+    if (loaded.buffer->size() != size || loaded.buffer->line_count() != lines) {
+        std::exit(1);
+    }
+    return r;
+}
+
+// Typing a query one character at a time into the search, the first
+// character scans the document and the rest only check the earlier matches
+static Result incremental_search(std::size_t size) {
+    GapBuffer buf = make_buffer(size);
+    buf.set_cursor(buf.size() / 2);
+    const std::string query = "lazy dog 12345";
+    Search search;
+    Result r;
+    r.ops = query.size();
+    r.ns = time_ns([&] {
+        for (std::size_t n = 1; n <= query.size(); ++n) {
+            search.update(buf, std::string_view(query).substr(0, n));
+        }
+    });
+    sink = sink + search.matches().size();
+    return r;
+}
+
+// Replacing a word that is on every line with a longer one, which is the
+// worst case for editing match by match since every match shifts the rest
+// The bytes copied should stay within a small multiple of the document
+static Result replace_all(std::size_t size) {
+    GapBuffer buf = make_buffer(size);
+    buf.set_cursor(buf.size() / 2);
+    buf.reset_stats();
+    std::vector<std::size_t> at;
+    Result r;
+    r.ops = 1;
+    r.ns = time_ns([&] {
+        find_matches(buf, "fox", at);
+        buf.replace_matches(at, 3, "ferret");
+    });
+    if (at.size() + 1 < buf.line_count()) {
+        std::exit(1);
+    }
+    r.copied = buf.stats().bytes_copied();
+    sink = sink + at.size();
+    return r;
+}
+
+// Typing at 10k cursors spread over the document, every keystroke is one
+// splice and then the cursor goes back to the primary cursor like the editor
+// does, so a keystroke should copy about the span of the cursors twice and
+// not once per cursor
+static Result multi_cursor(std::size_t size) {
+    GapBuffer buf = make_buffer(size);
+    const std::size_t cursors = 10000;
+    std::vector<std::size_t> at(cursors);
+    for (std::size_t i = 0; i < cursors; ++i) {
+        at[i] = size / cursors * i;
+    }
+    std::vector<Splice> edits(cursors);
+    buf.set_cursor(at[cursors / 2]);
+    buf.reset_stats();
+    Result r;
+    r.ops = 64;
+    r.ns = time_ns([&] {
+        for (std::size_t k = 0; k < r.ops; ++k) {
+            for (std::size_t i = 0; i < cursors; ++i) {
+                edits[i] = {at[i], 0, "x"};
+                at[i] += i + 1;
+            }
+            buf.splice(edits);
+            buf.set_cursor(at[cursors / 2]);
+        }
+    });
+    r.copied = buf.stats().bytes_copied();
+    sink = sink + buf.size();
+    return r;
+}
+
+// Helper to let the highlighter finish what the view needs, like frames
+// running until it has nothing left to lex
+static void settle(Highlighter &syntax, const GapBuffer &buf,
+                   std::size_t top, std::size_t bottom) {
+    std::size_t first = SIZE_MAX;
+    std::size_t last = 0;
+    do {
+        syntax.pump(buf, top, bottom, first, last);
+        std::this_thread::yield();
+    } while (syntax.busy());
+}
+
+// Typing into a 100k line C file with the view near its end, every keystroke
+// is lexed again from its line until the states line up with the old ones
+// Bytes copied are what the worker lexed, a keystroke should cost the lines
+// from it to the bottom of the view and never the whole file
+static Result highlight_edits() {
+    GapBuffer buf(64);
+    std::string text;
+    for (std::size_t i = 0; i < 100000; ++i) {
+        text += "static int fox_" + std::to_string(i) + " = " +
+                std::to_string(i) + "; /* the lazy dog */\n";
+    }
+    buf.insert(text);
+    CLexer lexer;
+    Highlighter syntax;
+    syntax.set_lexer(&lexer);
+    const std::size_t top = buf.line_count() - 50;
+    const std::size_t bottom = top + 40;
+    settle(syntax, buf, top, bottom);
+    std::uint64_t before = syntax.lexed_bytes();
+    Result r;
+    r.ops = 1000;
+    r.ns = time_ns([&] {
+        for (std::size_t k = 0; k < r.ops; ++k) {
+            std::size_t line = top + 10 + k % 20;
+            buf.set_cursor(buf.line_start(line) + 11);
+            buf.insert("x");
+            syntax.invalidate(line, 0, 0);
+            settle(syntax, buf, top, bottom);
+        }
+    });
+    r.copied = syntax.lexed_bytes() - before;
+    sink = sink + buf.size();
+    return r;
+}
+
+int main(int argc, char **argv) {
+    std::size_t max_str = GiB;
+    if (argc > 1) {
+        max_str = std::strtoull(argv[1], nullptr, 10);
+    }
+
+    std::printf("%-32s %10s %14s %14s %12s\n", "scenario", "ops", "ns/op",
+                "bytes copied", "peak RSS");
+    run("random insert/erase (1 MiB)", random_edits);
+    run("set_cursor end to end (16 MiB)", long_jumps);
+    run("insert 100 MB paste", big_paste);
+    run("c_str() after every edit", c_str_per_edit);
+    run("index newlines (64 MiB)", [] { return index_build(64 * MiB); });
+    run("index newlines " + bytes(max_str),
+        [max_str] { return index_build(max_str); });
+    run("load_file " + bytes(max_str),
+        [max_str] { return load(max_str, false); });
+    run("load_file streamed " + bytes(max_str),
+        [max_str] { return load(max_str, true); });
+    run("search keystroke " + bytes(max_str),
+        [max_str] { return incremental_search(max_str); });
+    run("replace all (64 MiB)", [] { return replace_all(64 * MiB); });
+    run("10k cursors typing (64 MiB)", [] { return multi_cursor(64 * MiB); });
+    run("highlight keystroke (100k lines)", highlight_edits);
+    for (std::size_t size = KiB; size <= max_str; size *= 16) {
+        run("str() " + bytes(size), [size] { return flatten(size); });
+        // If the cap is not on the ladder we still finish with it
+        if (size < max_str && size * 16 > max_str) {
+            run("str() " + bytes(max_str),
+                [max_str] { return flatten(max_str); });
+        }
+    }
+    return 0;
+}
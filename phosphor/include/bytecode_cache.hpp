@@ -0,0 +1,40 @@
+#ifndef BYTECODE_CACHE_HPP
+#define BYTECODE_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * On disk cache of compiled Lua chunks
+ * Each script gets one file named after a hash of its absolute path, the file
+ * starts with the source's modification time, size and content hash, so an
+ * edited script (or one copied over with an old mtime) never loads stale code
+ * The cache knows nothing about Lua, it only stores bytes, Lua itself rejects
+ * bytecode from a different version when it is loaded
+ */
+class BytecodeCache {
+  public:
+    explicit BytecodeCache(std::filesystem::path dir);
+
+    // Where the cache lives by default, under XDG_CACHE_HOME or ~/.cache
+    static std::filesystem::path default_dir();
+
+    // Method to find the compiled chunk for a script, nothing is returned if
+    // there is none or it was compiled from different source
+    std::optional<std::string> load(const std::filesystem::path &source,
+                                     std::string_view text) const;
+    // Method to store a compiled chunk, failing to write is not an error
+    // since the script simply compiles from source again next time
+    void store(const std::filesystem::path &source, std::string_view text,
+               std::string_view bytecode) const;
+
+  private:
+    std::filesystem::path dir_;
+
+    std::filesystem::path entry(const std::filesystem::path &source) const;
+};
+
+#endif
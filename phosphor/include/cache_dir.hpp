@@ -0,0 +1,18 @@
+#ifndef CACHE_DIR_HPP
+#define CACHE_DIR_HPP
+
+#include <filesystem>
+#include <string>
+
+// Helper to find where a kind of cache lives, under XDG_CACHE_HOME or
+// ~/.cache/phosphor, the directory is only created when something is stored
+// Without either it is a directory of our own in the temp directory
+std::filesystem::path cache_dir(const std::string &name);
+
+// Helper to create a cache directory nobody else can look into, mode 0700
+// It returns false if the directory exists but is a symlink, belongs to
+// someone else or is open to others, we never write copies of the user's
+// files there
+bool private_dir(const std::filesystem::path &dir);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef CARETS_HPP
+#define CARETS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// One cursor, head is where it sits and anchor is where its selection
+// started, they are the same when nothing is selected
+struct Caret {
+    std::size_t anchor{0};
+    std::size_t head{0};
+
+    std::size_t start() const noexcept { return std::min(anchor, head); }
+    std::size_t end() const noexcept { return std::max(anchor, head); }
+};
+
+/*
+ * The cursors of a multi-cursor edit
+ * They are kept sorted by where they start and never overlap, so an edit at
+ * every cursor becomes one sorted list of edits the storage applies in a
+ * single pass
+ * The primary cursor is the last one added, it is the one the view follows
+ * and the one the storage's own cursor is kept on
+ * An empty set means we are editing with the storage's cursor alone
+ */
+class Carets {
+  public:
+    bool empty() const noexcept;
+    std::size_t size() const noexcept;
+    const Caret &primary() const;
+    const std::vector<Caret> &all() const noexcept;
+    // The cursors can be moved in place, normalize has to be called after
+    std::vector<Caret> &all() noexcept;
+    void clear() noexcept;
+    // Method to add a cursor and make it the primary one
+    void add(Caret caret);
+    // Method to sort the cursors and merge the ones that now overlap, a
+    // merged cursor is the primary one if either of the two was
+    void normalize();
+
+  private:
+    std::vector<Caret> carets_;
+    std::size_t primary_{0};
+};
+
+#endif
@@ -1,10 +1,19 @@
 #ifndef EDITOR_HPP
 #define EDITOR_HPP
 
-#include "gap_buffer.hpp"
+#include "carets.hpp"
+#include "file_loader.hpp"
+#include "highlighter.hpp"
+#include "input.hpp"
 #include "keychords.hpp"
+#include "profiler.hpp"
+#include "save_worker.hpp"
 #include "scripting.hpp"
+#include "search.hpp"
+#include "text_storage.hpp"
 #include "ui.hpp"
+#include "undo.hpp"
+#include "workspace.hpp"
 
 #include "../vendor/raylib.h"
 #include <array>
@@ -13,7 +22,9 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -31,18 +42,32 @@ using Command = std::function<void(Editor &)>;
 // using Command = void(*)(Editor&);
 
 // DO NOT TOUCH THE ORDER OF THIS - THE STATE MANAGER WILL BREAK
-enum class EditingState { Editing, Renaming, Count };
+enum class EditingState { Editing, Renaming, Searching, Count };
 
 class Editor {
     friend class ScriptingVM;
 
   public:
     // Constructor for the editor class
-    Editor(std::string contents, std::filesystem::path file);
+    // When a loader is given the buffer is still streaming in and the loader
+    // is pumped once a frame until it is done
+    // Input is read from the window unless another source is given
+    Editor(Loaded loaded, std::filesystem::path file,
+           std::unique_ptr<InputSource> input = nullptr);
     // Main method to draw to window
     void draw();
-    // Main logic to poll for keyboard events
-    void poll_input();
+    // Method standing in for draw when nothing is rendered, it does the same
+    // layout work and bookkeeping as draw without a single draw call
+    void draw_headless();
+    // Method to tell the main loop whether anything changed since the last
+    // draw, when nothing did it can sleep until the next input event
+    bool needs_redraw() const noexcept;
+    // Method to tell the main loop that work is running in the background and
+    // will need a frame when it finishes even if no input arrives
+    bool busy() const;
+    // Main logic to poll for keyboard events, returns false once the input
+    // source has run out, which only happens when replaying a recording
+    bool poll_input();
     // Method for inserting text that we expose to the Lua API
     void insert_text(std::string text);
     // Method for picking a palette exposed to the Lua API
@@ -53,23 +78,156 @@ class Editor {
     void enter();
     void tab();
     void paste();
+    // Method to replace every occurrence of query at once, exposed to the Lua
+    // API, it is a single undo step and returns how many were replaced
+    std::size_t replace_all(std::string_view query, std::string_view with);
+    // Methods to group edits into one transaction, derived state like the
+    // viewport is only refreshed once when the outermost transaction commits
+    void begin_edit(std::size_t reserve = 0);
+    void commit_edit();
+    // Methods for undo and redo exposed to the Lua API
+    void undo();
+    void redo();
+    void set_undo_budget(std::size_t bytes);
+    // Method to load the file again from disk, exposed to the Lua API, the
+    // edits since the last save and their history are dropped
+    void reload();
+    // Methods for editing at several cursors at once, exposed to the Lua API
+    // Typing and backspace apply at every cursor as a single undo step
+    void add_cursor(std::size_t pos);
+    // Method to select the word under the cursor, or once something is
+    // selected the next occurrence of it with a new cursor
+    void select_next();
+    // Method to put a cursor on every occurrence of the selection
+    void select_all();
+    void clear_cursors();
+    std::size_t cursor_count() const noexcept;
+    // Methods for working with several open files, only the active one is
+    // edited, the others are parked in the workspace with their history
+    // add_buffer parks a loaded file without switching to it
+    std::size_t add_buffer(Loaded loaded, std::filesystem::path file);
+    // Method to switch to a file, loading it if it is not open yet
+    bool open(const std::filesystem::path &file);
+    void switch_buffer(std::size_t index);
+    void next_buffer();
+    void prev_buffer();
+    std::size_t buffer_count() const noexcept;
+    std::size_t current_buffer() const noexcept;
+    void set_buffer_budget(std::size_t bytes);
+    // Methods for the profiler overlay and trace exposed to the Lua API
+    void toggle_profiler();
+    void dump_trace(const std::filesystem::path &path);
 
   private:
     void name_file();
     void editing();
+    void searching();
+    void start_search();
+    void end_search();
+    void set_query(std::string query);
+    void find_next();
+    void find_prev();
+    void jump_to_match(std::size_t index);
     void save();
     void bind();
     void move_left();
     void move_right();
     void move_up();
     void move_down();
+    // Where each motion takes a cursor at pos
+    std::size_t left_of(std::size_t pos) const;
+    std::size_t right_of(std::size_t pos) const;
+    std::size_t above(std::size_t pos) const;
+    std::size_t below(std::size_t pos) const;
+    void move_cursors(std::size_t (Editor::*motion)(std::size_t) const);
+    Caret word_at(std::size_t pos) const;
+    void edit_cursors(std::string_view text, bool erase);
+    void sync_cursors();
     void move_to_mouse(Vector2 mouse_pos);
+    void scroll(long long lines);
+    void scroll_horizontal(float dx);
+    void follow_cursor();
+    void track_view();
+    void collect_saves();
+    void pump_loader();
+    void check_source();
+    void park(Document &doc);
+    void unpark(Document &doc);
+    void run_idle();
+    void finish_paint(std::size_t cursor_line);
+    // Every edit goes through these two so it can be recorded for undo
+    void apply_insert(std::string_view text);
+    void apply_erase(std::size_t num_chars);
+    // Every edit reports the lines it replaced through lines_changed, inside
+    // a transaction they are merged and the caches hear about them once
+    void lines_changed(std::size_t first, std::size_t old_lines,
+                       std::size_t new_lines);
+    void flush_lines();
     ScriptingVM vm_;
-    GapBuffer buffer_;
+    std::unique_ptr<TextStorage> buffer_;
+    // The loader refers to the buffer so it is declared after it, which
+    // makes sure it stops before the buffer goes away
+    std::unique_ptr<FileLoader> loader_;
+    // The file the buffer reads in place, if it changes on disk we copy what
+    // it still holds into memory before anything reads it again
+    std::shared_ptr<MappedFile> source_;
+    // A save asked for while loading waits until everything is loaded,
+    // otherwise we would write out a truncated file
+    bool save_after_load_{false};
+    UndoHistory history_;
+    // Every open file, the slot of the active one is empty while its state
+    // lives in the fields above
+    Workspace workspace_;
     std::unordered_map<KeyChord, Command, KeyChordHash> chordmap_;
+    // Where input comes from and what it delivered this frame
+    std::unique_ptr<InputSource> input_;
+    InputFrame frame_;
     std::filesystem::path file_;
-    std::string contents_;
     std::string new_name_{};
+    // Extra cursors, empty unless a multi-cursor edit is going on, the
+    // primary one is always where the buffer's cursor is
+    Carets carets_;
+    // Incremental search, typing a query jumps to the first match after
+    // where the cursor was when the search started
+    Search search_;
+    std::size_t search_origin_{0};
+    // Colors of the active file, lexed on a worker thread as lines come into
+    // view and lexed again from an edit on down until the states line up
+    Highlighter syntax_;
+    // Saves are written by a background thread, the status line shows how
+    // the last one went
+    SaveWorker saver_;
+    std::string status_{};
+    // First document line shown in the viewport
+    std::size_t top_line_{0};
+    // How far the viewport is scrolled to the right, in pixels
+    float scroll_x_{0.0f};
+    // Transaction bookkeeping, we remember where the cursor was and how big
+    // the buffer was when the outermost transaction began
+    int edit_depth_{0};
+    std::size_t edit_cursor_{0};
+    std::size_t edit_size_{0};
+    // Lines the edits of the open transaction replaced, first to last in the
+    // document as it is now, and how many lines it gained, the caches are
+    // told about them when the outermost transaction commits
+    bool lines_pending_{false};
+    std::size_t pending_first_{0};
+    std::size_t pending_last_{0};
+    std::ptrdiff_t pending_grown_{0};
+    // Characters typed during the current frame, inserted in one go
+    std::string typed_;
+    // What needs repainting, and what the view looked like when it was last
+    // painted so we can tell what moved
+    Damage damage_;
+    std::size_t painted_cursor_{0};
+    std::size_t painted_line_{0};
+    std::size_t painted_top_{0};
+    float painted_scroll_x_{0.0f};
+    // When input last arrived, and whether on_idle still has to run for it
+    std::uint64_t last_input_ns_{0};
+    bool idle_pending_{false};
+    // Whether the frame time overlay is drawn over the text
+    bool show_profiler_{false};
     EditingState state_;
     UI ui_;
 };
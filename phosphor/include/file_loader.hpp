@@ -0,0 +1,80 @@
+#ifndef FILE_LOADER_HPP
+#define FILE_LOADER_HPP
+
+#include "mapped_file.hpp"
+#include "piece_table.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Streams a mapped file into a piece table
+ * Worker threads, one per core, take the mapping's chunks in turn, which
+ * pages the file in and finds its newlines, the expensive part of opening a
+ * huge file
+ * The editor calls pump once a frame to reveal the scanned chunks in file
+ * order, a chunk that finished early waits for the ones before it, so the
+ * table is only ever touched by the render thread and the first screenful
+ * shows up as soon as the first small chunk is done
+ */
+class FileLoader {
+  public:
+    FileLoader(std::shared_ptr<const MappedFile> file, PieceTable &table);
+    // The workers are told to stop and joined, whatever is left is dropped
+    ~FileLoader();
+    FileLoader(const FileLoader &) = delete;
+    FileLoader &operator=(const FileLoader &) = delete;
+
+    // Method to reveal every scanned chunk, returns how many bytes were added
+    std::size_t pump();
+    bool done() const noexcept;
+    // Fraction of the file that is part of the document, from 0 to 1
+    float progress() const noexcept;
+    double elapsed_ms() const noexcept;
+
+  private:
+    struct Chunk {
+        bool ready{false};
+        std::size_t size{0};
+        std::vector<std::size_t> newlines;
+    };
+
+    std::shared_ptr<const MappedFile> file_;
+    PieceTable &table_;
+    std::mutex mutex_;
+    // One slot per chunk of the file, filled in whatever order the workers
+    // finish them
+    std::vector<Chunk> chunks_;
+    // The next chunk a worker takes and the next one pump reveals
+    std::atomic<std::size_t> next_{0};
+    std::size_t next_reveal_{0};
+    std::atomic<bool> stop_{false};
+    std::size_t revealed_{0};
+    std::chrono::steady_clock::time_point start_;
+    std::vector<std::thread> threads_;
+
+    void run();
+};
+
+// What load_file hands back, the loader is only set when the file is still
+// streaming into the buffer and source only when the buffer reads the file's
+// mapping in place, which has to be detached if the file changes on disk
+struct Loaded {
+    std::unique_ptr<TextStorage> buffer;
+    std::unique_ptr<FileLoader> loader;
+    std::shared_ptr<MappedFile> source;
+};
+
+// Helper function to load a file into a storage engine, storage_name is gap,
+// piece or auto, when stream is set a huge file streams in with a loader
+Loaded load_file(const std::filesystem::path &path,
+                 const std::string &storage_name, bool stream);
+
+#endif
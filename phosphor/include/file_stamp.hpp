@@ -0,0 +1,25 @@
+#ifndef FILE_STAMP_HPP
+#define FILE_STAMP_HPP
+
+#include <cstdint>
+#include <filesystem>
+
+// Which file a path named and how it looked at one moment
+// Two stamps match only if nothing wrote to, truncated or replaced the file
+// in between, as far as the file system's timestamps can tell
+struct FileStamp {
+    std::uint64_t dev{0};
+    std::uint64_t ino{0};
+    std::uint64_t size{0};
+    std::int64_t mtime_ns{0};
+
+    bool operator==(const FileStamp &other) const noexcept;
+    bool operator!=(const FileStamp &other) const noexcept;
+};
+
+// Helpers to stamp an open file or whatever a path names now, they return
+// false if the file cannot be looked at
+bool stamp_fd(int fd, FileStamp &out);
+bool stamp_path(const std::filesystem::path &path, FileStamp &out);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef FONT_ATLAS_HPP
+#define FONT_ATLAS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../vendor/raylib.h"
+
+// Metrics of one rasterized glyph, in pixels at the atlas' base size
+struct Glyph {
+    int offset_x{0};
+    int offset_y{0};
+    int advance_x{0};
+    // Where the glyph sits in the atlas, empty for glyphs with no pixels
+    Rectangle rec{0.0f, 0.0f, 0.0f, 0.0f};
+    // The font has no such glyph, it is drawn and measured as '?'
+    bool missing{false};
+};
+
+/*
+ * Glyph atlas for one TTF font that fills itself in as text needs it
+ * LoadFont rasterizes a fixed ASCII set up front and anything else is drawn
+ * as '?', here ASCII is rasterized up front and every other code point is
+ * rasterized and packed into the atlas the first time it is drawn or measured
+ *
+ * The atlas pixels and every glyph's metrics are cached on disk, keyed by the
+ * font file, its size and modification time and the base size, so later
+ * starts upload the cached atlas and never touch the TTF unless a new glyph
+ * shows up
+ * Glyphs are packed on shelves, when the atlas is full it grows taller and
+ * the glyphs already in it keep their place
+ */
+class GlyphAtlas {
+  public:
+    GlyphAtlas() = default;
+    // The cache is written if glyphs were added and the texture is freed
+    ~GlyphAtlas();
+    GlyphAtlas(const GlyphAtlas &) = delete;
+    GlyphAtlas &operator=(const GlyphAtlas &) = delete;
+
+    // Method to load a font at a base size, from the cache when it is valid
+    // The texture is only made once a window is open, without one glyphs are
+    // rasterized and measured on the CPU but cannot be drawn
+    bool load(const std::filesystem::path &ttf, int base_size);
+    int base_size() const noexcept;
+    bool from_cache() const noexcept;
+
+    // Method to look a glyph up, rasterizing it on first use
+    const Glyph &glyph(int codepoint);
+    // Method to return how far the pen moves after a character, in pixels
+    // at the given size, this matches what DrawTextEx does
+    float advance(int codepoint, float size, float spacing);
+
+    // Drawing, these replace DrawTextCodepoint and DrawTextEx
+    void draw_codepoint(int codepoint, Vector2 pos, float size, Color tint);
+    void draw_text(const char *text, Vector2 pos, float size, float spacing,
+                   Color tint);
+
+  private:
+    // Room left around every glyph so filtering never bleeds neighbours in,
+    // the same padding LoadFont uses
+    static constexpr int PADDING = 4;
+    static constexpr int ATLAS_WIDTH = 1024;
+    static constexpr int MAX_ATLAS_HEIGHT = 8192;
+
+    std::filesystem::path ttf_path_;
+    // The font file, only read once a glyph has to be rasterized
+    std::vector<unsigned char> ttf_;
+    int base_size_{0};
+    bool from_cache_{false};
+    // Glyphs were added since the cache was read or written
+    bool dirty_{false};
+
+    std::vector<int> codepoints_;
+    std::vector<Glyph> glyphs_;
+    std::unordered_map<int, std::size_t> index_;
+    // ASCII glyphs by code point so the common case never hashes
+    std::array<int, 128> ascii_{};
+    std::size_t fallback_{0};
+
+    // Gray and alpha bytes of every pixel, kept so the atlas can grow and be
+    // written to the cache
+    std::vector<unsigned char> pixels_;
+    int width_{0};
+    int height_{0};
+    Texture2D texture_{};
+    // Shelf packer state
+    int pen_x_{0};
+    int pen_y_{0};
+    int shelf_height_{0};
+
+    std::size_t rasterize(int codepoint);
+    bool place(int w, int h, int &x, int &y);
+    void upload();
+    bool read_cache();
+    void write_cache() const;
+    std::filesystem::path cache_path() const;
+    std::size_t add(int codepoint, const GlyphInfo &info);
+};
+
+#endif
@@ -1,27 +1,92 @@
 #ifndef GAP_BUFFER_HPP
 #define GAP_BUFFER_HPP
 
+#include "line_index.hpp"
+#include "text_range.hpp"
+#include "text_storage.hpp"
+
 #include <algorithm>
 #include <cstring>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-class GapBuffer {
+class GapBuffer : public TextStorage {
   public:
+    // Iterator that hands out one line of the buffer at a time as a view
+    class LineIterator {
+      public:
+        LineIterator(const GapBuffer *buf, std::size_t line)
+            : buf_(buf), line_(line) {}
+        TextRange operator*() const;
+        LineIterator &operator++() {
+            ++line_;
+            return *this;
+        }
+        bool operator!=(const LineIterator &o) const {
+            return line_ != o.line_;
+        }
+
+      private:
+        const GapBuffer *buf_;
+        std::size_t line_;
+    };
+
+    // Pair of line iterators so a block of lines can be used in a range for
+    struct LineSpan {
+        LineIterator first;
+        LineIterator last;
+        LineIterator begin() const { return first; }
+        LineIterator end() const { return last; }
+    };
+
+    // Counters for the benchmarks, every byte the buffer shuffles around is
+    // counted so regressions in how much memory we move are easy to see
+    struct Stats {
+        std::size_t gap_moves{0};
+        // Bytes memmoved to follow the cursor
+        std::size_t bytes_moved{0};
+        std::size_t grows{0};
+        // Bytes copied into a bigger buffer when the gap ran out
+        std::size_t bytes_grown{0};
+        // Bytes copied in by inserts
+        std::size_t bytes_inserted{0};
+        // Bytes copied to rebuild the c_str cache
+        std::size_t bytes_cached{0};
+
+        std::size_t bytes_copied() const noexcept;
+    };
+
     explicit GapBuffer(std::size_t start_capacity = 64);
 
-    explicit GapBuffer(const std::string &start_string);
+    explicit GapBuffer(std::string_view start_string);
 
-    std::size_t cursor() const noexcept;
-    void set_cursor(std::size_t pos);
-    void move_cursor(long long delta);
-    std::size_t size() const noexcept;
-    bool empty() const noexcept;
-    std::string str() const;
+    StorageKind kind() const noexcept override;
+    std::size_t cursor() const noexcept override;
+    void set_cursor(std::size_t pos) override;
+    std::size_t size() const noexcept override;
     const char *c_str() const;
+    std::string substr(std::size_t pos, std::size_t len) const;
+    TextRange segments() const noexcept;
+    TextRange range(std::size_t pos, std::size_t len) const noexcept;
+    TextRange line(std::size_t n) const;
+    LineSpan line_span(std::size_t first, std::size_t last) const;
     void insert(char c);
-    void insert(std::string str);
-    void erase_back(std::size_t num_chars);
+    void insert(std::string_view str) override;
+    void erase_back(std::size_t num_chars) override;
+    void reserve(std::size_t n) override;
+    void replace_matches(const std::vector<std::size_t> &at, std::size_t len,
+                         std::string_view with) override;
+    void splice(const std::vector<Splice> &edits) override;
+    void for_each_chunk(std::size_t pos, std::size_t len,
+                        const ChunkFn &fn) const override;
+    const LineIndex &lines() const noexcept;
+    const Stats &stats() const noexcept;
+    void reset_stats() noexcept;
+    std::size_t line_count() const noexcept override;
+    std::size_t line_start(std::size_t line) const override;
+    std::size_t line_of(std::size_t offset) const override;
 
   private:
     std::vector<char> buf_;
@@ -33,10 +98,12 @@ class GapBuffer {
     std::size_t right_len() const noexcept;
     void ensure_gap(std::size_t want);
     void move_gap_to(std::size_t pos);
+    template <typename Edit> void sweep(std::size_t n, const Edit &edit);
     void compute_cache() const;
     mutable std::string cached_str_;
     mutable bool cache_valid_{false};
-    mutable bool idx_valid_{false};
+    LineIndex lines_;
+    mutable Stats stats_;
 };
 
 #endif
\ No newline at end of file
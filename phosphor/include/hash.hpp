@@ -0,0 +1,17 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstdint>
+#include <string_view>
+
+// Where every 64 bit FNV-1a hash starts
+inline constexpr std::uint64_t FNV1A_SEED = 0xcbf29ce484222325ull;
+
+// Helper to hash bytes with 64 bit FNV-1a
+// The result is the same on every build and platform, so it can name files
+// that outlive the process, and a hash of text split in parts is continued
+// by passing the hash of the parts so far as the seed
+std::uint64_t fnv1a(std::string_view text,
+                    std::uint64_t seed = FNV1A_SEED) noexcept;
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef HIGHLIGHTER_HPP
+#define HIGHLIGHTER_HPP
+
+#include "syntax.hpp"
+#include "text_storage.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Syntax highlighting that runs on a worker thread
+ * We remember the lexer state every line starts in, after an edit only the
+ * states past the edited line are in doubt, so lexing starts again at that
+ * line and stops as soon as a line past the edit starts in the state it did
+ * before, everything after it is colored the same as it was
+ * Only what the viewport needs is lexed, so opening a huge file and looking
+ * at its top never lexes the rest of it
+ * Once a frame the editor collects what the worker finished and we hand it
+ * the next batch, a copy of the lines to lex and the state to start in, so
+ * the worker never reads the document while the editor changes it
+ * Lines keep their old colors until the worker gets to them, typing never
+ * waits for it
+ */
+class Highlighter {
+  public:
+    Highlighter();
+    // The worker is told to stop and joined, a batch in flight is dropped
+    ~Highlighter();
+    Highlighter(const Highlighter &) = delete;
+    Highlighter &operator=(const Highlighter &) = delete;
+
+    // Method to pick the language, nullptr turns highlighting off, anything
+    // lexed before is thrown away
+    void set_lexer(const Lexer *lexer);
+    const Lexer *lexer() const noexcept;
+    // Method to report an edit that replaced old_lines + 1 lines starting at
+    // first with new_lines + 1 lines, like LayoutCache::invalidate
+    void invalidate(std::size_t first, std::size_t old_lines,
+                    std::size_t new_lines);
+    // Method to report that anything from line first on may have changed,
+    // for edits that do not say which lines they touched
+    void invalidate_from(std::size_t first);
+    // Method to collect finished work and start the next batch the lines
+    // top to bottom need, returns true if the colors of lines first to last
+    // changed
+    bool pump(const TextStorage &buf, std::size_t top, std::size_t bottom,
+              std::size_t &first, std::size_t &last);
+    // True while a batch is being lexed or waits to be collected
+    bool busy() const noexcept;
+    // Colored runs of a line, nullptr if it has never been lexed
+    const std::vector<Span> *spans(std::size_t line) const;
+    // Bytes handed to the worker so far, for the bench
+    std::uint64_t lexed_bytes() const noexcept;
+
+  private:
+    // Most we copy for the worker in one batch, and how much of a single
+    // line we lex, a longer line is colored up to there
+    static constexpr std::size_t MAX_BATCH = 4ull << 20;
+    static constexpr std::size_t MAX_LINE = 64ull << 10;
+    // We forget the colors of lines off screen past this many lines
+    static constexpr std::size_t MAX_ROWS = 4096;
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    struct Row {
+        std::vector<Span> spans;
+        // The line was edited since it was lexed, we keep drawing its old
+        // colors until it is lexed again
+        bool stale{false};
+    };
+
+    struct Job {
+        std::uint64_t generation;
+        const Lexer *lexer;
+        std::size_t first;
+        std::size_t lines;
+        LexState state;
+        std::string text;
+        // Lines we want the colors of, the rest only give us states
+        std::size_t spans_from;
+        std::size_t spans_to;
+    };
+
+    struct Result {
+        std::uint64_t generation;
+        std::size_t first;
+        // State each line ends in, which is the state the next one starts in
+        std::vector<LexState> states;
+        std::size_t spans_from;
+        std::vector<std::vector<Span>> spans;
+    };
+
+    // Only touched by the editor's thread
+    const Lexer *lexer_{nullptr};
+    // Bumped when the lexer changes so a batch for the old one is dropped
+    std::uint64_t generation_{0};
+    // State every line starts in, the first valid_ are known to be right,
+    // past clean_from_ they were right before the last edits and the lines
+    // have not changed, so a match there means we can stop lexing
+    std::vector<LexState> states_;
+    std::size_t valid_{0};
+    std::size_t clean_from_{0};
+    std::unordered_map<std::size_t, Row> rows_;
+    bool in_flight_{false};
+    // First line edited since the batch in flight was copied
+    std::size_t touched_{NONE};
+    std::uint64_t lexed_bytes_{0};
+
+    // Shared with the worker
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::optional<Job> job_;
+    std::optional<Result> result_;
+    bool stop_{false};
+    std::thread thread_;
+
+    void run();
+    static Result lex(const Job &job);
+    bool apply(const TextStorage &buf, const Result &done, std::size_t &first,
+               std::size_t &last);
+    void issue(const TextStorage &buf, std::size_t top, std::size_t bottom);
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef INPUT_HPP
+#define INPUT_HPP
+
+#include "keychords.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Everything the editor reads from the keyboard and mouse in one frame
+struct InputFrame {
+    // Code points typed and keys pressed, in the order they arrived
+    std::vector<int> chars;
+    std::vector<int> keys;
+    // Modifiers held when the frame was polled
+    Mod mods{MOD_NONE};
+    bool click{false};
+    float mouse_x{0.0f};
+    float mouse_y{0.0f};
+    float wheel_x{0.0f};
+    float wheel_y{0.0f};
+    bool resized{false};
+
+    bool empty() const noexcept;
+    bool pressed(int key) const noexcept;
+    void clear() noexcept;
+};
+
+/*
+ * Where the editor's input comes from
+ * The editor polls one frame at a time and never calls raylib for input
+ * itself, so the same editor can be driven by a person, a recorded session
+ * or nothing at all
+ */
+class InputSource {
+  public:
+    virtual ~InputSource() = default;
+    // Method to fill in the next frame, returns false once there is no more
+    // input, which only happens when a recording runs out
+    virtual bool poll(InputFrame &frame) = 0;
+    // Method to read the clipboard for a paste in the current frame
+    virtual std::string clipboard() = 0;
+};
+
+// Input read from the window through raylib
+class RaylibInput : public InputSource {
+  public:
+    bool poll(InputFrame &frame) override;
+    std::string clipboard() override;
+};
+
+/*
+ * Records every frame another source produces to a trace file
+ * Frames are varint encoded and an idle frame is a single byte, so even a
+ * long session stays small
+ * A frame is written once the next one is polled, because a paste during the
+ * frame adds the clipboard to it
+ */
+class RecordingInput : public InputSource {
+  public:
+    RecordingInput(std::unique_ptr<InputSource> inner,
+                   const std::filesystem::path &path);
+    // The last frame is written and the file flushed
+    ~RecordingInput() override;
+    bool ok() const noexcept;
+    bool poll(InputFrame &frame) override;
+    std::string clipboard() override;
+
+  private:
+    std::unique_ptr<InputSource> inner_;
+    std::ofstream out_;
+    InputFrame frame_;
+    bool pending_{false};
+    bool has_clipboard_{false};
+    std::string clipboard_;
+
+    void write_frame();
+};
+
+/*
+ * Plays a trace file back frame by frame
+ * The whole trace is read up front so playback never touches the disk
+ */
+class ReplayInput : public InputSource {
+  public:
+    explicit ReplayInput(const std::filesystem::path &path);
+    bool ok() const noexcept;
+    bool poll(InputFrame &frame) override;
+    std::string clipboard() override;
+    // How much has been played back so far
+    std::size_t frames() const noexcept;
+    std::size_t events() const noexcept;
+
+  private:
+    std::vector<std::uint8_t> data_;
+    std::size_t pos_{0};
+    bool ok_{false};
+    std::string clipboard_;
+    std::size_t frames_{0};
+    std::size_t events_{0};
+};
+
+#endif
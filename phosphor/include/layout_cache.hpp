@@ -0,0 +1,93 @@
+#ifndef LAYOUT_CACHE_HPP
+#define LAYOUT_CACHE_HPP
+
+#include "font_atlas.hpp"
+#include "text_storage.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "../vendor/raylib.h"
+
+/*
+ * Horizontal layout of a single line
+ * When the font is monospaced and the line is plain ASCII we do not store
+ * anything per glyph, every byte is one cell so a column is just a multiply
+ * Otherwise x holds the left edge of every character plus the right edge of
+ * the last one, and at holds where each character starts unless they are all
+ * one byte long
+ * Only the first measured bytes of a long line get edges, past them every
+ * byte is a tail wide cell, the same way the highlighter only colors the
+ * start of a long line
+ */
+struct LineLayout {
+    std::size_t bytes{0};
+    float width{0.0f};
+    // Width of a cell when we are on the monospace fast path, zero otherwise
+    float cell{0.0f};
+    std::size_t measured{0};
+    float tail{0.0f};
+    std::vector<float> x;
+    std::vector<std::uint32_t> at;
+
+    // Method to return the left edge of the character starting at col
+    float x_of(std::size_t col) const noexcept;
+    // Method to return the character boundary nearest to a horizontal
+    // position, used for hit testing
+    std::size_t col_at(float pos) const noexcept;
+    // Method to return the start of the character covering a horizontal
+    // position, used to find the first character worth drawing
+    std::size_t col_before(float pos) const noexcept;
+
+  private:
+    std::size_t index_of(std::size_t col) const noexcept;
+    std::size_t col_of(std::size_t index) const noexcept;
+    std::size_t col_past(float pos, bool nearest) const noexcept;
+};
+
+/*
+ * Cache of line layouts keyed by line number
+ * Measuring text means looking up every glyph in the font, so we only do it
+ * when a line is first shown or after an edit touched it
+ * Edits report which lines they replaced, lines before them are kept, lines
+ * after them are shifted and only the touched lines are measured again
+ */
+class LayoutCache {
+  public:
+    // Method to pick the font the layouts are measured with, this throws away
+    // every cached line since their widths no longer apply
+    void configure(GlyphAtlas &atlas, float size, float spacing);
+    const LineLayout &line(const TextStorage &buf, std::size_t line);
+    // Method to report an edit that replaced old_lines + 1 lines starting at
+    // first with new_lines + 1 lines
+    void invalidate(std::size_t first, std::size_t old_lines,
+                    std::size_t new_lines);
+    void clear() noexcept;
+    bool monospace() const noexcept;
+    float cell() const noexcept;
+
+  private:
+    // We forget everything past this many lines, only the viewport and the
+    // cursor's line are ever asked for so this is only hit after long jumps
+    static constexpr std::size_t MAX_LINES = 4096;
+    // Most of a single line we measure, far more than anyone scrolls across
+    static constexpr std::size_t MAX_MEASURE = 64ull << 10;
+
+    GlyphAtlas *atlas_{nullptr};
+    float size_{0.0f};
+    float spacing_{0.0f};
+    float cell_{0.0f};
+    bool monospace_{false};
+    // Advance of every ASCII character so the common case is a plain lookup
+    // instead of going through the atlas
+    std::array<float, 128> ascii_{};
+    std::unordered_map<std::size_t, LineLayout> lines_;
+
+    float advance(int codepoint) const;
+    void measure(const TextStorage &buf, std::size_t line, LineLayout &out);
+};
+
+#endif
@@ -1,6 +1,64 @@
 #ifndef LINE_INDEX_HPP
 #define LINE_INDEX_HPP
 
-struct LineIndex {};
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
 
-#endif
\ No newline at end of file
+// Simple pair returned by offset lookups, both values are zero based and the
+// column is counted in bytes from the start of the line
+struct LineCol {
+    std::size_t line;
+    std::size_t col;
+};
+
+/*
+ * The line index mirrors the gap buffer it belongs to
+ * We store the offsets of every '\n' in two sorted arrays that meet at a split
+ * point, which always sits at the same place as the buffer's gap
+ *
+ *   left_  holds absolute offsets of newlines before the split
+ *   right_ holds distances from the end of the text for newlines after it
+ *
+ * Since edits only ever happen at the gap, inserting or erasing text only
+ * touches the back of left_, and the right side never needs to be shifted
+ * because its entries are measured from the end
+ * Lookups are a binary search over each side so they stay O(log n) and never
+ * touch the buffer bytes
+ */
+class LineIndex {
+  public:
+    LineIndex() = default;
+
+    // Method to rebuild the index from scratch, the split is placed between
+    // the two pieces of text
+    void build(std::string_view left, std::string_view right = {});
+    // Method to follow the buffer's gap when it moves
+    void move_split(std::size_t pos);
+    // Method to record text inserted at the split
+    void insert(const char *data, std::size_t n);
+    // Method to record text erased directly before the split
+    void erase_back(std::size_t n);
+
+    std::size_t size() const noexcept;
+    std::size_t line_count() const noexcept;
+    std::size_t line_start(std::size_t line) const;
+    std::size_t line_end(std::size_t line) const;
+    std::size_t line_length(std::size_t line) const;
+    std::size_t line_of(std::size_t offset) const;
+    LineCol position(std::size_t offset) const;
+    std::size_t offset(std::size_t line, std::size_t col) const;
+
+  private:
+    std::size_t newline_count() const noexcept;
+    std::size_t newline_at(std::size_t k) const noexcept;
+    std::vector<std::size_t> left_;
+    std::vector<std::size_t> right_;
+    std::size_t split_{0};
+    std::size_t size_{0};
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include "file_stamp.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+/*
+ * Read only memory mapping of a file
+ * The kernel pages the file in on demand so opening is near instant and the
+ * bytes are never copied into our own heap unless a storage engine asks for it
+ * A private mapping only keeps our own writes to ourselves, another process
+ * writing to the file in place changes what we see and truncating it makes
+ * reading past the new end fault
+ * Faults in a mapping are caught and the page is swapped for zeros, so a
+ * truncation can never bring down the thread that happens to read it, and
+ * once changed says the file moved under us detach copies what is left into
+ * private memory at the same address, so every view stays valid
+ * Our own saves are safe, they rename a new file over the path and the old
+ * one lives on as long as it is mapped
+ */
+class MappedFile {
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Method to map a file, returns false if it could not be opened
+    bool open(const std::filesystem::path &path);
+    std::string_view view() const noexcept;
+    std::size_t size() const noexcept;
+    // Method to tell if the file we mapped was written to or truncated since,
+    // a new file renamed over the path does not count
+    bool changed() const;
+    // Method to stop reading the file, the bytes the mapping shows right now
+    // are copied into private memory in its place, bytes a truncation took
+    // are zeros
+    void detach();
+
+  private:
+    void *data_{nullptr};
+    std::size_t size_{0};
+    // We keep the file open so we can ask about the file we mapped and not
+    // whatever the path names now
+    int fd_{-1};
+    FileStamp stamp_;
+};
+
+#endif
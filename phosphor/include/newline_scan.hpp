@@ -0,0 +1,27 @@
+#ifndef NEWLINE_SCAN_HPP
+#define NEWLINE_SCAN_HPP
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Texts at least this big are scanned on several threads
+inline constexpr std::size_t PARALLEL_SCAN_THRESHOLD = 16ull << 20;
+
+/*
+ * Finding every newline is most of the work of opening a file, the line
+ * index needs all of them before the first line can be drawn
+ * We compare 32 bytes at a time with AVX2 when the CPU has it, 16 at a time
+ * with SSE2 otherwise, and fall back to memchr everywhere else
+ */
+
+// Method to append base plus the offset of every '\n' in text to out
+void scan_newlines(std::string_view text, std::size_t base,
+                   std::vector<std::size_t> &out);
+
+// Method that does the same, big texts are cut into one slice per core and
+// the slices' offsets are appended in order, so out ends up identical
+void scan_newlines_parallel(std::string_view text, std::size_t base,
+                            std::vector<std::size_t> &out);
+
+#endif
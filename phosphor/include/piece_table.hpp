@@ -0,0 +1,126 @@
+#ifndef PIECE_TABLE_HPP
+#define PIECE_TABLE_HPP
+
+#include "text_storage.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Piece table storage for very large files
+ * The original text is kept untouched in a read only buffer and everything
+ * the user types is appended to add buffers that never move once written
+ * The document is the in order walk of a list of pieces, each one pointing at
+ * a slice of one of those buffers
+ *
+ * The pieces live in a treap (a randomized balanced tree) keyed implicitly by
+ * their position in the document, every node caches the byte and newline
+ * totals of its subtree so inserts, deletes and line lookups are all O(log n)
+ * Newline counts inside a piece come from a sorted list of newline offsets
+ * kept for each buffer, so splitting a piece never rescans its bytes
+ */
+class PieceTable : public TextStorage {
+  public:
+    // When stream is set the document starts out empty and the original is
+    // added a chunk at a time with reveal, so a huge file can be shown before
+    // it has all been scanned
+    explicit PieceTable(std::string_view original = {},
+                        std::shared_ptr<const void> owner = nullptr,
+                        bool stream = false);
+
+    StorageKind kind() const noexcept override;
+    std::size_t cursor() const noexcept override;
+    void set_cursor(std::size_t pos) override;
+    std::size_t size() const noexcept override;
+    void insert(std::string_view text) override;
+    void erase_back(std::size_t num_chars) override;
+    void reserve(std::size_t n) override;
+    void replace_matches(const std::vector<std::size_t> &at, std::size_t len,
+                         std::string_view with) override;
+    void for_each_chunk(std::size_t pos, std::size_t len,
+                        const ChunkFn &fn) const override;
+    std::size_t line_count() const noexcept override;
+    std::size_t line_start(std::size_t line) const override;
+    std::size_t line_of(std::size_t offset) const override;
+    Snapshot snapshot() const override;
+    std::size_t piece_count() const noexcept;
+    // Method to append the next n bytes of the original to the end of the
+    // document, newlines are the offsets of its '\n's relative to the chunk
+    void reveal(std::size_t n, const std::vector<std::size_t> &newlines);
+    std::size_t revealed() const noexcept;
+    // Bytes that only live in our memory, an original read in place from its
+    // owner (like a file mapping) is not counted
+    std::size_t private_bytes() const noexcept;
+    // Methods to move those bytes out of memory, private_parts lists them in
+    // order and rehome points their buffers at a copy of exactly those bytes
+    // laid out back to back at data, which owner keeps alive
+    // Nothing may be edited in between, later inserts go to a new add buffer
+    Snapshot private_parts() const;
+    void rehome(const char *data, std::shared_ptr<const void> owner);
+
+  private:
+    // Index into the node pool, we use indices instead of pointers so the pool
+    // can grow without invalidating the tree
+    using NodeId = std::int32_t;
+    static constexpr NodeId NIL = -1;
+
+    // A backing buffer, the first one is the original text and the rest are
+    // add buffers that are filled up to their fixed capacity
+    // own is set while the bytes are our private copy on the heap
+    struct Buffer {
+        std::shared_ptr<const char> owner;
+        const char *data;
+        std::size_t size;
+        std::size_t capacity;
+        std::vector<std::size_t> newlines;
+        bool own;
+    };
+
+    // A slice of one of the buffers
+    struct Piece {
+        std::uint32_t buf;
+        std::size_t start;
+        std::size_t len;
+        std::size_t lf;
+    };
+
+    struct Node {
+        Piece piece;
+        std::uint32_t prio;
+        NodeId left;
+        NodeId right;
+        std::size_t sum_len;
+        std::size_t sum_lf;
+    };
+
+    std::vector<Buffer> bufs_;
+    std::vector<Node> nodes_;
+    std::vector<NodeId> free_;
+    NodeId root_{NIL};
+    std::size_t cursor_{0};
+    std::uint32_t seed_{0x9e3779b9u};
+    // Writable view of the add buffer we are currently filling
+    char *add_data_{nullptr};
+    std::uint32_t add_buf_{0};
+
+    std::uint32_t next_prio() noexcept;
+    NodeId alloc(const Piece &piece);
+    void release(NodeId t);
+    void pull(NodeId t) noexcept;
+    std::size_t len_of(NodeId t) const noexcept;
+    std::size_t lf_of(NodeId t) const noexcept;
+    std::size_t count_lf(std::uint32_t buf, std::size_t start,
+                         std::size_t len) const noexcept;
+    NodeId merge(NodeId a, NodeId b);
+    void split(NodeId t, std::size_t pos, NodeId &l, NodeId &r);
+    bool extend(NodeId t, std::size_t pos, const Piece &piece);
+    bool walk(NodeId t, std::size_t base, std::size_t pos, std::size_t end,
+              const ChunkFn &fn) const;
+    void start_add_buffer(std::size_t capacity);
+    Piece append_to_add(std::string_view text);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Digest of the recent frames, this is what the overlay shows
+struct ProfileSummary {
+    // Frame times in milliseconds, from the moment input woke us up to the
+    // moment the frame was handed to raylib
+    std::size_t frames{0};
+    double frame_p50{0.0};
+    double frame_p95{0.0};
+    double frame_p99{0.0};
+    double frame_max{0.0};
+    // The same but only for frames that handled a key or a click, this is
+    // the keystroke to draw latency
+    std::size_t inputs{0};
+    double latency_p50{0.0};
+    double latency_p95{0.0};
+    double latency_max{0.0};
+
+    // Time spent in each instrumented scope over the recent frames
+    struct Scope {
+        const char *name;
+        std::size_t calls;
+        double total_ms;
+        double max_ms;
+    };
+    std::vector<Scope> scopes;
+    // The most recent frame times, oldest first, for the graph
+    std::vector<float> recent;
+};
+
+/*
+ * Frame profiler
+ * Scopes record their name, start and duration into a fixed ring buffer, a
+ * slot is claimed with a single atomic add so any thread can record without
+ * a lock, and old events are simply overwritten
+ * Every slot carries a sequence number so readers can tell a slot that is
+ * being rewritten from one that is complete
+ *
+ * The render thread also marks the start and end of every frame that is
+ * drawn and whether it handled input, which gives us frame times and the
+ * keystroke to draw latency
+ */
+class Profiler {
+  public:
+    Profiler();
+
+    static std::uint64_t now_ns() noexcept;
+
+    // Method to record a finished scope, safe to call from any thread
+    // The name must outlive the profiler, use intern for built strings
+    void record(const char *name, std::uint64_t start_ns,
+                std::uint64_t dur_ns) noexcept;
+    // Method to turn a built name (a Lua command for example) into one that
+    // lives as long as the profiler
+    const char *intern(const std::string &name);
+
+    // Frame bookkeeping, these are only called from the render thread
+    void begin_frame() noexcept;
+    void mark_input() noexcept;
+    void end_frame() noexcept;
+
+    ProfileSummary summary(std::size_t max_scopes = 6) const;
+    // Method to write the ring buffer out in the Chrome trace event format,
+    // it opens in chrome://tracing or ui.perfetto.dev
+    bool dump_chrome_trace(const std::filesystem::path &path) const;
+
+  private:
+    static constexpr std::size_t EVENT_CAPACITY = 1 << 16;
+    static constexpr std::size_t FRAME_CAPACITY = 240;
+
+    struct Slot {
+        // Zero while the slot is being written, index + 1 once it is done
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<std::uint64_t> start{0};
+        std::atomic<std::uint64_t> dur{0};
+        std::atomic<std::uint32_t> tid{0};
+    };
+
+    // A copy of a slot that was read consistently
+    struct Event {
+        const char *name;
+        std::uint64_t start;
+        std::uint64_t dur;
+        std::uint32_t tid;
+    };
+
+    std::unique_ptr<Slot[]> events_;
+    std::atomic<std::uint64_t> head_{0};
+    std::mutex names_mutex_;
+    std::unordered_set<std::string> names_;
+    // Frame rings, only touched by the render thread
+    std::array<float, FRAME_CAPACITY> frame_ms_{};
+    std::array<float, FRAME_CAPACITY> latency_ms_{};
+    std::size_t frame_count_{0};
+    std::size_t latency_count_{0};
+    std::uint64_t frame_start_{0};
+    bool frame_input_{false};
+    std::uint64_t epoch_;
+
+    std::vector<Event> snapshot(std::uint64_t since_ns) const;
+};
+
+// The editor's profiler, every instrumented scope records into it
+Profiler &profiler();
+
+// Scoped timer, records its lifetime into the profiler when it goes away
+class ProfileScope {
+  public:
+    explicit ProfileScope(const char *name) noexcept
+        : name_(name), start_(Profiler::now_ns()) {}
+    ~ProfileScope() {
+        profiler().record(name_, start_, Profiler::now_ns() - start_);
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+  private:
+    const char *name_;
+    std::uint64_t start_;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SAVE_WORKER_HPP
+#define SAVE_WORKER_HPP
+
+#include "file_stamp.hpp"
+#include "text_storage.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <sys/types.h>
+
+// Outcome of a save, handed back to the editor
+struct SaveResult {
+    std::filesystem::path path;
+    bool ok{false};
+    // The contents matched what we last wrote and the file is still the one
+    // we wrote, so nothing was written
+    bool skipped{false};
+    std::size_t bytes{0};
+    double ms{0.0};
+    std::string error;
+};
+
+/*
+ * Background thread that writes snapshots to disk
+ * The render thread only takes a snapshot and hands it over, the worker does
+ * the slow part, writing to a temporary file next to the target, syncing it
+ * and renaming it over the target, so a crash at any point leaves either the
+ * old file or the new one and never a truncated one
+ * The target is the file a symlink points at, so the link stays a link, and
+ * the temporary file gets a unique name and the target's mode, owner and
+ * group before it takes its place
+ * If a save is requested while one is in flight the newest one replaces any
+ * that is still waiting, there is no point writing contents twice
+ */
+class SaveWorker {
+  public:
+    SaveWorker();
+    // Any save still waiting is finished before the thread is joined
+    ~SaveWorker();
+    SaveWorker(const SaveWorker &) = delete;
+    SaveWorker &operator=(const SaveWorker &) = delete;
+
+    void submit(std::filesystem::path path, Snapshot snap);
+    // Method to collect a finished save, called once a frame by the editor
+    std::optional<SaveResult> poll();
+    // True while a save is waiting, running or has a result nobody collected
+    bool busy() const;
+
+    static std::uint64_t hash(const Snapshot &snap) noexcept;
+
+  private:
+    struct Job {
+        std::filesystem::path path;
+        Snapshot snap;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::optional<Job> pending_;
+    std::deque<SaveResult> results_;
+    bool writing_{false};
+    bool stop_{false};
+    // What we last wrote and how the file looked right after, only touched
+    // by the worker thread
+    std::filesystem::path last_path_;
+    std::uint64_t last_hash_{0};
+    FileStamp last_stamp_;
+    bool has_last_{false};
+    // Mode of files that did not exist before, read once since umask can
+    // only be read by setting it
+    mode_t new_mode_;
+    std::thread thread_;
+
+    void run();
+    SaveResult write(const Job &job);
+};
+
+#endif
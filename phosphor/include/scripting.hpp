@@ -12,14 +12,39 @@ extern "C" {
 #include "palette.hpp"
 
 #include "../include/ranlib.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+// Events scripts can hook into with on_change, on_insert and so on
+// DO NOT TOUCH THE ORDER OF THIS - THE HOOK NAMES ARE INDEXED BY IT
+enum class Hook { Insert, Delete, Save, CursorMove, Idle, Change, Count };
+
+// How long a single hook handler may run before it is stopped
+inline constexpr double DEFAULT_HOOK_BUDGET_MS = 4.0;
 
 class Editor;
+
+/*
+ * Lua VM that runs init.lua, key bound commands and event hooks
+ * Edits and saves are queued as they happen and delivered once a frame, so a
+ * burst of typing is one on_change call with every edit in it and not one
+ * call per key
+ * Edits are kept in the order they were made, on_change gets them as one
+ * list and on_insert and on_delete get the inserting and deleting halves of
+ * the same list
+ * Every hook handler runs under a time budget enforced by a Lua debug hook,
+ * a handler that goes over is stopped and reported instead of freezing the
+ * editor
+ */
 class ScriptingVM {
     friend class Editor;
 
@@ -31,12 +56,44 @@ class ScriptingVM {
 
     void push_api(sol::state &L);
 
+    // Methods the editor calls as things happen, they only queue the event
+    // and do nothing at all when no script listens for it
+    void note_insert(std::size_t at, std::string_view text);
+    void note_erase(std::size_t at, std::size_t length);
+    // Method to queue an edit that replaced length bytes at at with text
+    void note_edit(std::size_t at, std::size_t length, std::string_view text);
+    void note_save(const std::filesystem::path &path, bool ok);
+    // Method to deliver everything queued this frame
+    void flush_hooks(bool cursor_moved);
+    void run_idle_hooks();
+    bool has_hooks(Hook hook) const noexcept;
+
   private:
+    // An edit waiting to be delivered, length bytes at at were replaced by
+    // text, at is where the edit happened after every edit before it
+    struct Edit {
+        std::size_t at;
+        std::size_t length;
+        std::string text;
+    };
+
+    template <typename... Args> void run_hooks(Hook hook, const Args &...args);
+    bool has_edit_hooks() const noexcept;
+    void flush_edits();
+
     // Pointer to the Editor since it owns this class
     Editor *owner_;
     sol::state lua_;
     std::unordered_map<int, int> keys_;
     std::unordered_map<KeyChord, sol::function, KeyChordHash> chordmap_;
+    std::array<std::vector<sol::protected_function>,
+               static_cast<std::size_t>(Hook::Count)>
+        hooks_;
+    std::vector<Edit> edits_;
+    std::vector<std::pair<std::string, bool>> saves_;
+    // Set while hooks run, edits the hooks make are not reported back to them
+    bool dispatching_{false};
+    double hook_budget_ms_{DEFAULT_HOOK_BUDGET_MS};
 };
 
 #endif
\ No newline at end of file
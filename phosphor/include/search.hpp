@@ -0,0 +1,68 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include "text_storage.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Method to collect the start of every match of query in the document,
+// overlapping ones included, returns false if it stopped at limit matches
+bool find_matches(const TextStorage &buf, std::string_view query,
+                  std::vector<std::size_t> &out,
+                  std::size_t limit = static_cast<std::size_t>(-1));
+
+/*
+ * Incremental search over a document
+ * The document is read a chunk at a time through for_each_chunk, which for
+ * the gap buffer means its two segments, so nothing is ever flattened
+ * A match that straddles two chunks (the gap for example) is found by
+ * searching the seam, the last bytes of one chunk and the first of the next
+ * Inside a chunk candidates are found 16 bytes at a time by comparing the
+ * query's first and last bytes at once, only candidates that pass both are
+ * compared in full
+ * Typing usually grows the query, and every match of the longer query
+ * starts where a match of the shorter one did, so we check the old matches
+ * in place instead of scanning the document again
+ */
+class Search {
+  public:
+    // We stop collecting past this many matches, a one letter query on a
+    // huge file would otherwise hold an offset for most of its bytes
+    static constexpr std::size_t MAX_MATCHES = 1ull << 22;
+    // Returned by next and prev when there is nothing to jump to
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    // Method to search for a query, reusing the last matches when the query
+    // only grew and the document has not changed since
+    void update(const TextStorage &buf, std::string_view query);
+    // Method to forget the matches, called after the document changes
+    void invalidate() noexcept;
+    // Method to forget the query and the matches
+    void clear() noexcept;
+
+    const std::string &query() const noexcept;
+    // Start offsets of every match, sorted, each is query().size() bytes
+    const std::vector<std::size_t> &matches() const noexcept;
+    // More matches exist past the last one we kept
+    bool truncated() const noexcept;
+    // Index of the first match at or after pos, wrapping to the first one
+    std::size_t next(std::size_t pos) const noexcept;
+    // Index of the last match before pos, wrapping to the last one
+    std::size_t prev(std::size_t pos) const noexcept;
+
+  private:
+    std::string query_;
+    std::vector<std::size_t> matches_;
+    // The matches belong to query_ and the document as it is now
+    bool valid_{false};
+    bool truncated_{false};
+    std::string scratch_;
+
+    void scan(const TextStorage &buf);
+    void refine(const TextStorage &buf);
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SPILL_WRITER_HPP
+#define SPILL_WRITER_HPP
+
+#include "text_storage.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+// A spill file the writer finished, handed back to the workspace
+struct SpillDone {
+    std::size_t doc;
+    std::filesystem::path path;
+    bool ok;
+};
+
+/*
+ * Background thread that writes parked documents out to spill files
+ * Writing a big document takes a while, so the workspace only hands over the
+ * bytes to write and picks the file up once it is on disk, the render thread
+ * never waits for the disk
+ * The bytes are read in place, the workspace leaves a document alone while
+ * it is being written and cancels the write if the document is activated
+ */
+class SpillWriter {
+  public:
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    SpillWriter();
+    // Writes still queued are dropped and files nobody collected removed
+    ~SpillWriter();
+    SpillWriter(const SpillWriter &) = delete;
+    SpillWriter &operator=(const SpillWriter &) = delete;
+
+    // Method to queue the parts of a document for writing
+    void submit(std::size_t doc, Snapshot parts);
+    // Method to collect a finished spill, called once a frame
+    std::optional<SpillDone> poll();
+    // Method to drop a document's spill, once it returns nothing reads its
+    // bytes any more and no file of it is left
+    void cancel(std::size_t doc);
+
+  private:
+    struct Job {
+        std::size_t doc;
+        Snapshot parts;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    std::deque<SpillDone> done_;
+    std::size_t writing_{NONE};
+    std::atomic<std::size_t> cancel_{NONE};
+    bool stop_{false};
+    // Spill files are numbered, the process id keeps two editors apart
+    std::uint64_t next_{0};
+    std::thread thread_;
+
+    void run();
+    bool write(const Job &job, std::filesystem::path &target);
+};
+
+#endif
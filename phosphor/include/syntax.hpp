@@ -0,0 +1,74 @@
+#ifndef SYNTAX_HPP
+#define SYNTAX_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+// What a run of text is, the renderer picks a color for each from the palette
+enum class Token : std::uint8_t {
+    Text,
+    Keyword,
+    Type,
+    String,
+    Number,
+    Comment,
+    Preprocessor,
+    Count
+};
+
+// A colored run inside a line, in bytes from the start of the line
+// Bytes no span covers are plain text
+struct Span {
+    std::uint32_t start{0};
+    std::uint32_t len{0};
+    Token kind{Token::Text};
+
+    bool operator==(const Span &other) const noexcept {
+        return start == other.start && len == other.len && kind == other.kind;
+    }
+};
+
+// What a lexer carries from the end of one line to the start of the next,
+// an open block comment for example, zero is the state a file starts in
+using LexState = std::uint32_t;
+
+/*
+ * A lexer for one language
+ * It works a line at a time, starting from the state the line before ended
+ * in, so after an edit we can lex again from the edited line and stop as
+ * soon as a line ends in the same state it did before
+ * Lexers hold no state of their own, the worker thread shares them
+ */
+class Lexer {
+  public:
+    virtual ~Lexer() = default;
+    virtual const char *name() const noexcept = 0;
+    // Method to append the spans of line to out and return the state the
+    // line ends in, line has no newline
+    virtual LexState lex(std::string_view line, LexState state,
+                         std::vector<Span> &out) const = 0;
+};
+
+// C and C++, block comments and strings continued with a backslash carry
+// over to the next line
+class CLexer : public Lexer {
+  public:
+    const char *name() const noexcept override;
+    LexState lex(std::string_view line, LexState state,
+                 std::vector<Span> &out) const override;
+};
+
+// Lua, long comments and long strings carry over with their level
+class LuaLexer : public Lexer {
+  public:
+    const char *name() const noexcept override;
+    LexState lex(std::string_view line, LexState state,
+                 std::vector<Span> &out) const override;
+};
+
+// Helper to pick a lexer from a file's extension, nullptr for plain text
+const Lexer *lexer_for(const std::filesystem::path &file);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TEXT_RANGE_HPP
+#define TEXT_RANGE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+/*
+ * A view into part of the buffer without copying it
+ * The gap splits the text in two so any range is at most two contiguous
+ * pieces, first sits before the gap and second sits after it
+ * Either piece may be empty
+ * The views are only valid until the next edit to the buffer
+ */
+struct TextRange {
+    std::string_view first;
+    std::string_view second;
+
+    // Small forward iterator so the range can be walked like a string
+    class const_iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = char;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const char *;
+        using reference = const char &;
+
+        const_iterator(const TextRange *range, std::size_t idx)
+            : range_(range), idx_(idx) {}
+
+        reference operator*() const {
+            std::size_t split = range_->first.size();
+            return idx_ < split ? range_->first[idx_]
+                                : range_->second[idx_ - split];
+        }
+
+        const_iterator &operator++() {
+            ++idx_;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++idx_;
+            return old;
+        }
+
+        bool operator==(const const_iterator &o) const {
+            return idx_ == o.idx_;
+        }
+        bool operator!=(const const_iterator &o) const {
+            return idx_ != o.idx_;
+        }
+
+      private:
+        const TextRange *range_;
+        std::size_t idx_;
+    };
+
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size()}; }
+
+    std::size_t size() const noexcept { return first.size() + second.size(); }
+    bool empty() const noexcept { return size() == 0; }
+
+    // Method to narrow the range down to n bytes starting at pos
+    TextRange sub(std::size_t pos, std::size_t n = std::string_view::npos)
+        const noexcept {
+        TextRange out;
+        if (pos < first.size()) {
+            out.first = first.substr(pos, n);
+            n -= std::min(n, out.first.size());
+            pos = 0;
+        } else {
+            pos -= first.size();
+        }
+        if (n && pos < second.size()) {
+            out.second = second.substr(pos, n);
+        }
+        return out;
+    }
+
+    // Method to copy the range into a string, the string's capacity is reused
+    // so callers can keep a scratch string around
+    void copy_to(std::string &out) const {
+        out.assign(first);
+        out.append(second);
+    }
+
+    std::string str() const {
+        std::string out;
+        copy_to(out);
+        return out;
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef TEXT_STORAGE_HPP
+#define TEXT_STORAGE_HPP
+
+#include "line_index.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The storage engines we can pick from at start up
+enum class StorageKind { Gap, Piece, Count };
+
+// A frozen view of the whole document that another thread can read while the
+// editor keeps editing, the owners keep the memory behind the parts alive
+struct Snapshot {
+    std::vector<std::string_view> parts;
+    std::vector<std::shared_ptr<const void>> owners;
+    std::size_t size{0};
+};
+
+// One edit of a batch, len bytes at pos are replaced with text
+struct Splice {
+    std::size_t pos;
+    std::size_t len;
+    std::string_view text;
+};
+
+/*
+ * Interface the editor uses to talk to the document
+ * Every engine has a single insertion point, the cursor, and edits always
+ * happen there, which matches how the gap buffer has always worked
+ * Reading is done through for_each_chunk so engines can hand out their
+ * internal pieces without flattening the document
+ */
+class TextStorage {
+  public:
+    // Alias for a chunk visitor, returning false stops the walk early
+    using ChunkFn = std::function<bool(std::string_view)>;
+
+    virtual ~TextStorage() = default;
+
+    virtual StorageKind kind() const noexcept = 0;
+    virtual std::size_t cursor() const noexcept = 0;
+    virtual void set_cursor(std::size_t pos) = 0;
+    virtual std::size_t size() const noexcept = 0;
+    virtual void insert(std::string_view text) = 0;
+    virtual void erase_back(std::size_t num_chars) = 0;
+    // Hint that about n bytes are about to be inserted at the cursor, so
+    // engines can make room once instead of growing per insert
+    virtual void reserve(std::size_t n);
+    virtual void for_each_chunk(std::size_t pos, std::size_t len,
+                                const ChunkFn &fn) const = 0;
+    // Method to replace len bytes at every offset in at with the same text
+    // The offsets are sorted and the matches do not overlap, engines rebuild
+    // the document in one pass instead of editing it once per match
+    // The cursor is left wherever the engine likes, callers place it after
+    virtual void replace_matches(const std::vector<std::size_t> &at,
+                                 std::size_t len, std::string_view with);
+    // Method to apply a batch of edits, sorted by position and not
+    // overlapping, every pos is an offset into the document before the batch
+    // This is how an edit at many cursors is applied, the cursor is left
+    // wherever the engine likes like it is for replace_matches
+    virtual void splice(const std::vector<Splice> &edits);
+
+    // Line queries every engine has to answer in O(log n)
+    virtual std::size_t line_count() const noexcept = 0;
+    virtual std::size_t line_start(std::size_t line) const = 0;
+    virtual std::size_t line_of(std::size_t offset) const = 0;
+
+    // By default a snapshot is a single copy of the document, engines whose
+    // memory never moves can hand out views instead
+    virtual Snapshot snapshot() const;
+
+    // Helpers built on top of the virtual methods
+    void insert(char c);
+    void move_cursor(long long delta);
+    // Character aware motion, offsets always land on the start of a
+    // character so multi byte text is never split
+    std::size_t next_char(std::size_t pos) const;
+    std::size_t prev_char(std::size_t pos) const;
+    std::size_t next_grapheme(std::size_t pos) const;
+    std::size_t prev_grapheme(std::size_t pos) const;
+    // Columns counted in characters rather than bytes
+    std::size_t column(std::size_t offset) const;
+    std::size_t offset_at_column(std::size_t line, std::size_t col) const;
+    bool empty() const noexcept;
+    std::size_t line_end(std::size_t line) const;
+    std::size_t line_length(std::size_t line) const;
+    LineCol position(std::size_t offset) const;
+    std::size_t offset(std::size_t line, std::size_t col) const;
+    void copy(std::size_t pos, std::size_t len, std::string &out) const;
+    std::string_view chunk_at(std::size_t pos, std::size_t max) const;
+    // Method to write the document as it reads with every match replaced to
+    // out, which has to hold replaced_size bytes
+    void write_replaced(const std::vector<std::size_t> &at, std::size_t len,
+                        std::string_view with, char *out) const;
+    std::size_t replaced_size(std::size_t matches, std::size_t len,
+                              std::string_view with) const noexcept;
+    std::string str() const;
+};
+
+// Files at least this big default to the piece table
+inline constexpr std::size_t PIECE_TABLE_THRESHOLD = 64ull << 20;
+
+// Factory for the storage engines
+// If owner keeps text alive (a file mapping for example) engines that can read
+// from it in place do so instead of copying
+std::unique_ptr<TextStorage>
+make_storage(StorageKind kind, std::string_view text,
+             std::shared_ptr<const void> owner = nullptr);
+
+// Helper to pick an engine given the size of the file being opened
+StorageKind pick_storage(std::size_t file_size) noexcept;
+
+#endif
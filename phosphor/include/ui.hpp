@@ -1,13 +1,56 @@
 #ifndef UI_HPP
 #define UI_HPP
 
+#include "carets.hpp"
+#include "font_atlas.hpp"
+#include "highlighter.hpp"
+#include "layout_cache.hpp"
+#include "profiler.hpp"
+#include "text_storage.hpp"
 #include "palette.hpp"
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <iostream>
 #include <vector>
 
 #include "../vendor/raylib.h"
 
+// Parts of the window that changed since they were last painted
+struct Damage {
+    // Everything, used at start up and when the colors change
+    bool full{true};
+    bool header{false};
+    // The profiler overlay is drawn over the canvas, showing or hiding it
+    // needs a new frame but nothing in the canvas changes
+    bool overlay{false};
+    // Range of document lines to repaint, empty when first > last
+    std::size_t first{1};
+    std::size_t last{0};
+
+    void lines(std::size_t from, std::size_t to) noexcept;
+    void line(std::size_t n) noexcept;
+    bool any() const noexcept;
+    void reset() noexcept;
+};
+
+// Search matches to highlight, sorted start offsets of matches that are all
+// len bytes long, current is the offset of the match the cursor is on
+// Selections are the cursors of a multi-cursor edit, sorted as well
+// Syntax gives the colored runs of the lines it has lexed
+struct Highlights {
+    const std::vector<std::size_t> *starts{nullptr};
+    std::size_t len{0};
+    std::size_t current{SIZE_MAX};
+    const std::vector<Caret> *selections{nullptr};
+    const Highlighter *syntax{nullptr};
+};
+
+// Size the fonts are rasterized at, the same as LoadFont so text looks like
+// it always has, every other size is scaled from it
+inline constexpr int FONT_BASE_SIZE = 32;
+
 struct UI {
     UI();
     ~UI();
@@ -17,19 +60,44 @@ struct UI {
     const Vector2 header_ln_strt_{10, 60};
     const Vector2 header_ln_end_{1190, 60};
     const Vector2 rename_pos_{700, 25};
+    const Vector2 status_pos_{300, 32};
     const Vector2 buffer_pos_{60, 70};
     const float line_idx_xpos_{15};
     const float text_size_{20.0f};
     const float header_size_{30.0f};
     const float text_spacing_{2.0f};
+    const float line_height_{text_size_ + 4.0f};
+    const float gutter_size_{16.0f};
     void draw_ui() const;
     void draw_bg() const;
     void draw_header() const;
-    void draw_buffer(const char *str) const;
+    void begin_paint() const;
+    void end_paint() const;
+    void present() const;
+    void clear_header() const;
+    void draw_buffer(const TextStorage &buf, std::size_t top_line,
+                     float scroll_x, std::size_t first = 0,
+                     std::size_t last = SIZE_MAX,
+                     const Highlights &marks = {}) const;
+    void draw_matches(const TextStorage &buf, std::size_t line,
+                      const LineLayout &layout, float y, float scroll_x,
+                      const Highlights &marks) const;
+    void draw_selections(const TextStorage &buf, std::size_t line,
+                         const LineLayout &layout, float y, float scroll_x,
+                         const std::vector<Caret> &selections) const;
+    std::size_t visible_lines() const;
+    float text_width() const;
     void draw_fn(const char *fn) const;
+    void draw_status(const char *status) const;
     void draw_rename_fn(const char *fn) const;
-    void draw_cursor() const;
+    void draw_search(const char *query) const;
+    void draw_cursor(const TextStorage &buf, std::size_t top_line,
+                     float scroll_x) const;
+    void draw_caret(const TextStorage &buf, std::size_t pos,
+                    std::size_t top_line, float scroll_x) const;
+    void draw_profiler(const ProfileSummary &summary) const;
     void dispatch_palette();
+    void tint_tokens() noexcept;
     void phosphor_green() noexcept;
     void phosphor_amber() noexcept;
     void phosphor_blue() noexcept;
@@ -37,13 +105,25 @@ struct UI {
     void phosphor_cyan() noexcept;
     void phosphor_magenta() noexcept;
     void phosphor_white() noexcept;
-    Font title_font_;
-    Font text_font_;
+    // Drawing can rasterize glyphs the atlases have not seen yet
+    mutable GlyphAtlas title_font_;
+    mutable GlyphAtlas text_font_;
+    // Everything is painted into this texture, which keeps what was painted
+    // so a frame only repaints the parts that changed and copies it out
+    RenderTexture2D canvas_{};
+    // Glyph positions of the lines we have drawn, measured with text_font_
+    mutable LayoutCache layout_;
+    mutable std::string line_scratch_;
     Color title_color_{PhosphorGreen::LightGreen};
     Color text_color_{PhosphorGreen::DarkGreen};
     Color ui_color_{PhosphorGreen::SoftGreen};
     Color bg_color_{PhosphorGreen::DarkBg};
     Palette palette_{Palette::Green};
+    // Color of each kind of token, derived from the shades above
+    std::array<Color, static_cast<std::size_t>(Token::Count)> token_colors_{};
+    // How much of the file has been loaded, a bar is drawn under the header
+    // while this is below one
+    float load_progress_{1.0f};
     const char *title_{"phosphor\0"};
 };
 
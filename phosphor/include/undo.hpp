@@ -0,0 +1,122 @@
+#ifndef UNDO_HPP
+#define UNDO_HPP
+
+#include "text_storage.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Default amount of memory the undo history may use
+inline constexpr std::size_t DEFAULT_UNDO_BUDGET = 64ull << 20;
+
+// Called with every edit an undo or redo applies, in the order it applies
+// them, pos is where the edit happened after every edit before it
+// The text is only valid during the call
+using AppliedFn = std::function<void(const Splice &)>;
+
+/*
+ * Undo/redo history
+ * Every edit is stored as a compact record (position, length and an offset
+ * into a shared byte arena) instead of a copy of the document
+ *
+ * Inserts do not copy anything when they are recorded, the inserted bytes are
+ * still in the document, so we only copy them into the arena if the insert is
+ * undone (redo needs them back)
+ * Erases copy the erased bytes since that is the only place they survive
+ * A replace all is one record holding the two strings and where the matches
+ * were, never the text around them, undoing it is another replace all
+ * An edit at many cursors is one record too, with the bytes each edit removed
+ * and inserted, so undoing it is one more batch of edits
+ *
+ * Records are grouped, an undo or redo applies a whole group at once
+ * Consecutive typing is merged into a single record so a sentence is one
+ * undo step and not one per key
+ * When the history grows past its budget the oldest groups are dropped
+ * A parked document's history can be spilled with its text, the records stay
+ * in memory and only the stored bytes go
+ */
+class UndoHistory {
+  public:
+    explicit UndoHistory(std::size_t budget = DEFAULT_UNDO_BUDGET);
+
+    // Methods to record edits before they are applied to the storage
+    void record_insert(std::size_t pos, std::string_view text);
+    void record_erase(const TextStorage &buf, std::size_t pos,
+                      std::size_t len);
+    // Method to record a replace all, at holds the offsets of the matches of
+    // from before it is applied
+    void record_replace(const std::vector<std::size_t> &at,
+                        std::string_view from, std::string_view to);
+    // Method to record a batch of edits that is about to be applied
+    void record_splice(const TextStorage &buf,
+                       const std::vector<Splice> &edits);
+    // Method to mark a transaction boundary, the next record starts a new
+    // group unless it simply continues the current run of typing
+    void seal() noexcept;
+    // Method to stop the current run of typing from being continued
+    void break_run() noexcept;
+
+    bool undo(TextStorage &buf, const AppliedFn &applied = nullptr);
+    bool redo(TextStorage &buf, const AppliedFn &applied = nullptr);
+    bool can_undo() const noexcept;
+    bool can_redo() const noexcept;
+    // Offset of the first byte the last undo or redo may have changed,
+    // nothing before it moved
+    std::size_t touched() const noexcept;
+    void clear();
+
+    void set_budget(std::size_t bytes);
+    std::size_t budget() const noexcept;
+    std::size_t memory() const noexcept;
+
+    // Methods to move the stored bytes out while the history is spilled
+    // stored compacts them and returns a view that is valid until the
+    // history changes, forget frees them once they are written out and the
+    // history cannot be used until restore gives the same bytes back
+    std::string_view stored();
+    void forget();
+    void restore(std::string_view bytes);
+
+  private:
+    enum class Op : std::uint8_t { Insert, Erase, Replace, Splice };
+
+    struct Record {
+        Op op;
+        std::size_t pos;
+        std::size_t len;
+        std::size_t data;
+        std::uint64_t group;
+    };
+
+    static constexpr std::size_t NO_DATA = static_cast<std::size_t>(-1);
+
+    std::deque<Record> records_;
+    // Number of records currently applied, anything after it can be redone
+    std::size_t current_{0};
+    std::string arena_;
+    std::size_t live_bytes_{0};
+    std::size_t budget_;
+    std::uint64_t next_group_{0};
+    bool sealed_{true};
+    bool run_{false};
+    std::size_t touched_{0};
+
+    void push(Op op, std::size_t pos, std::size_t len, std::size_t data);
+    void drop_redo();
+    void drop_bytes(const Record &r) noexcept;
+    std::size_t store(const TextStorage &buf, std::size_t pos,
+                      std::size_t len);
+    void replay(const Record &r, bool forward, TextStorage &buf,
+                const AppliedFn &applied) const;
+    void replay_splice(const Record &r, bool forward, TextStorage &buf,
+                       const AppliedFn &applied) const;
+    void enforce_budget();
+    void compact();
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef UTF8_HPP
+#define UTF8_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*
+ * UTF-8 helpers shared by the storage engines and the editor
+ * A character starts at every byte that is not a continuation byte
+ * (10xxxxxx), so counting characters is counting those bytes and does not
+ * need the text to be decoded
+ * Stray continuation bytes in invalid text stick to the character before
+ * them, which keeps counting and cursor motion in agreement on any input
+ * The counting helpers look at 16 bytes at a time with SSE2 or NEON where we
+ * have it, decoding is scalar everywhere
+ */
+namespace utf8 {
+
+// Code point drawn in place of anything we cannot encode or decode
+inline constexpr int REPLACEMENT = 0xFFFD;
+
+// Method to test if a byte continues a character instead of starting one
+constexpr bool continuation(char c) noexcept {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+// Method to append the encoding of a code point, surrogates and anything past
+// U+10FFFF are replaced
+void encode(int codepoint, std::string &out);
+// Method to decode the character at the start of text, returns how many bytes
+// it used, at least one, with REPLACEMENT for invalid sequences
+std::size_t decode(std::string_view text, int &codepoint) noexcept;
+
+// Method to return how many leading bytes are plain ASCII
+std::size_t ascii_prefix(std::string_view text) noexcept;
+// Method to count the characters that start in text
+std::size_t count(std::string_view text) noexcept;
+// Method to find where the nth character (zero based) starts in text
+// If text has fewer than n + 1 characters the size of text is returned and n
+// is reduced by the number it had, so the search can go on in the next chunk
+std::size_t nth(std::string_view text, std::size_t &n) noexcept;
+
+// Method to test if a code point continues the grapheme before it, combining
+// marks, variation selectors, zero width joiners and emoji modifiers
+// This is not full UAX #29 segmentation, it covers the clusters people type
+bool extends_grapheme(int codepoint) noexcept;
+
+} // namespace utf8
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef WORKSPACE_HPP
+#define WORKSPACE_HPP
+
+#include "file_loader.hpp"
+#include "spill_writer.hpp"
+#include "text_storage.hpp"
+#include "undo.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+
+// Default amount of text inactive documents may keep in memory
+inline constexpr std::size_t DEFAULT_RESIDENT_BUDGET = 256ull << 20;
+
+// Everything that belongs to one open file
+// The editor works on the active document's fields directly, a document only
+// holds them while it is parked in the workspace
+struct Document {
+    std::unique_ptr<TextStorage> buffer;
+    std::unique_ptr<FileLoader> loader;
+    // The file the buffer reads in place, see Loaded
+    std::shared_ptr<MappedFile> source;
+    bool save_after_load{false};
+    UndoHistory history;
+    std::filesystem::path file;
+    // Where the view was when the document was parked
+    std::size_t cursor{0};
+    std::size_t top_line{0};
+    float scroll_x{0.0f};
+    // Set once the document was spilled, the file is already unlinked and
+    // lives on through the mapping
+    // A buffer that reads its file in place keeps its buffer and only its
+    // private bytes went to the spill, any other buffer is empty until the
+    // document is paged back in
+    std::shared_ptr<MappedFile> spill;
+    // How much of the spill file is text, the history's bytes follow it
+    std::size_t spill_text{0};
+    // Set while the spill writer reads the document, nothing may change it
+    bool spilling{false};
+    StorageKind kind{StorageKind::Gap};
+    // When the document was last active, the least recent is spilled first
+    std::uint64_t used{0};
+};
+
+// Helper to test if two paths name the same file, relative paths are resolved
+// against the working directory and an empty path matches nothing
+bool same_file(const std::filesystem::path &a,
+               const std::filesystem::path &b);
+
+/*
+ * The set of open documents
+ * Only the active document is edited, the rest are parked here with their
+ * undo history and view so switching back picks up where we left off
+ * Inactive documents keep their text and undo history in memory up to a
+ * budget, past it the least recently used are spilled, their text and the
+ * bytes their history stores are written to the cache directory on a worker
+ * thread and dropped from memory once they are on disk
+ * A piece table reading its file in place only counts and spills what was
+ * typed into it, the file itself is already on disk and the kernel can drop
+ * its pages whenever it likes, so a big log that was opened and never edited
+ * costs nothing
+ * A spill file is mapped and unlinked as soon as it is written, so the kernel
+ * only pages in what we read back and nothing is left on disk after us
+ * Recently used documents are the last to be spilled, so switching back and
+ * forth between a few files never touches the disk
+ */
+class Workspace {
+  public:
+    // Returned by find when no document has the path
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    explicit Workspace(std::size_t budget = DEFAULT_RESIDENT_BUDGET);
+    Workspace(const Workspace &) = delete;
+    Workspace &operator=(const Workspace &) = delete;
+
+    // Method to add a document, returns its index
+    std::size_t add(Document doc);
+    std::size_t size() const noexcept;
+    std::size_t active() const noexcept;
+    Document &at(std::size_t i);
+    // Method to find the document open on a file
+    std::size_t find(const std::filesystem::path &file) const;
+    // Method to make a document the active one, paging its text back in if
+    // it was spilled and calling off a spill that is still being written
+    void activate(std::size_t i);
+    // Method to tell if any document is still streaming in or being spilled
+    bool loading() const noexcept;
+
+    // Method to start spilling the least recently used inactive documents
+    // until what the rest keep in memory fits the budget
+    void enforce_budget();
+    // Method to pick up the spills the writer finished, called once a frame
+    void collect_spills();
+    void set_budget(std::size_t bytes);
+    std::size_t budget() const noexcept;
+    // Bytes of text and undo history inactive documents keep in memory
+    std::size_t resident() const noexcept;
+
+  private:
+    // A deque so documents never move while the spill writer reads them
+    std::deque<Document> docs_;
+    std::size_t active_{0};
+    std::size_t budget_;
+    std::uint64_t clock_{0};
+    // Declared last so it stops before the documents it reads go away
+    SpillWriter spiller_;
+
+    void spill(std::size_t i);
+    void page_in(Document &doc);
+};
+
+#endif
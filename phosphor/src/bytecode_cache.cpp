@@ -0,0 +1,109 @@
+#include "../include/bytecode_cache.hpp"
+#include "../include/cache_dir.hpp"
+#include "../include/hash.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#include <unistd.h>
+
+// Every cache entry starts with this, the last character is the format
+static constexpr char MAGIC[8] = {'P', 'H', 'L', 'U', 'A', 'C', '1', '\n'};
+
+// What a cache entry was compiled from
+struct Stamp {
+    std::int64_t mtime;
+    std::uint64_t size;
+    std::uint64_t hash;
+};
+
+// Helper to stamp a script as it is on disk right now
+static std::optional<Stamp> stamp(const std::filesystem::path &source,
+                                  std::string_view text) {
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(source, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    return Stamp{static_cast<std::int64_t>(mtime.time_since_epoch().count()),
+                 text.size(), fnv1a(text)};
+}
+
+BytecodeCache::BytecodeCache(std::filesystem::path dir)
+    : dir_(std::move(dir)) {}
+
+// Lua chunks get their own directory next to the other caches
+std::filesystem::path BytecodeCache::default_dir() { return cache_dir("lua"); }
+
+// Method to read a cache entry back, any mismatch means we compile again
+std::optional<std::string>
+BytecodeCache::load(const std::filesystem::path &source,
+                    std::string_view text) const {
+    std::optional<Stamp> want = stamp(source, text);
+    std::ifstream in(entry(source), std::ios::binary);
+    if (!want || !in) {
+        return std::nullopt;
+    }
+    char magic[sizeof(MAGIC)];
+    Stamp have{};
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(&have), sizeof(have));
+    if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        have.mtime != want->mtime || have.size != want->size ||
+        have.hash != want->hash) {
+        return std::nullopt;
+    }
+    std::string code(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>{});
+    if (code.empty()) {
+        return std::nullopt;
+    }
+    return code;
+}
+
+// Method to write a cache entry
+// We write a temporary file and rename it over the entry so two editors
+// starting at once never read a half written chunk
+void BytecodeCache::store(const std::filesystem::path &source,
+                          std::string_view text,
+                          std::string_view bytecode) const {
+    std::optional<Stamp> have = stamp(source, text);
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    if (!have || ec) {
+        return;
+    }
+    std::filesystem::path target = entry(source);
+    std::filesystem::path tmp = target;
+    tmp += "." + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(MAGIC, sizeof(MAGIC));
+        out.write(reinterpret_cast<const char *>(&*have), sizeof(Stamp));
+        out.write(bytecode.data(),
+                  static_cast<std::streamsize>(bytecode.size()));
+        if (!out.flush()) {
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp, target, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+    }
+}
+
+// Helper method to name the entry for a script after its absolute path
+std::filesystem::path
+BytecodeCache::entry(const std::filesystem::path &source) const {
+    std::error_code ec;
+    std::filesystem::path abs = std::filesystem::absolute(source, ec);
+    std::string key = (ec ? source : abs).lexically_normal().string();
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.luac",
+                  static_cast<unsigned long long>(fnv1a(key)));
+    return dir_ / name;
+}
@@ -0,0 +1,41 @@
+#include "../include/cache_dir.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// We follow the XDG layout, which macOS tools commonly use as well
+std::filesystem::path cache_dir(const std::string &name) {
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        return std::filesystem::path(xdg) / "phosphor" / name;
+    }
+    if (const char *home = std::getenv("HOME"); home && *home) {
+        return std::filesystem::path(home) / ".cache" / "phosphor" / name;
+    }
+    // The user id keeps users apart, private_dir checks that nobody else got
+    // there first
+    std::error_code ec;
+    return std::filesystem::temp_directory_path(ec) /
+           ("phosphor-" + std::to_string(::getuid()) + "-" + name);
+}
+
+// We create the parents as usual and only the directory itself private,
+// then look at what is really there since it may have existed already
+// A directory of ours that older versions left open is closed up
+bool private_dir(const std::filesystem::path &dir) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir.parent_path(), ec);
+    if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat st;
+    if (::lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != ::getuid()) {
+        return false;
+    }
+    return (st.st_mode & 077) == 0 || ::chmod(dir.c_str(), 0700) == 0;
+}
@@ -0,0 +1,69 @@
+#include "../include/carets.hpp"
+
+#include <utility>
+
+bool Carets::empty() const noexcept { return carets_.empty(); }
+
+std::size_t Carets::size() const noexcept { return carets_.size(); }
+
+const Caret &Carets::primary() const { return carets_.at(primary_); }
+
+const std::vector<Caret> &Carets::all() const noexcept { return carets_; }
+
+std::vector<Caret> &Carets::all() noexcept { return carets_; }
+
+void Carets::clear() noexcept {
+    carets_.clear();
+    primary_ = 0;
+}
+
+// Method to add a cursor, it becomes the primary one
+void Carets::add(Caret caret) {
+    carets_.push_back(caret);
+    primary_ = carets_.size() - 1;
+    normalize();
+}
+
+// Method to restore the order and drop overlaps
+// Two cursors overlap when their selections share a byte or they sit on the
+// same spot, a cursor right at the end of a selection is left alone since
+// their edits do not touch
+void Carets::normalize() {
+    if (carets_.empty()) {
+        return;
+    }
+    // We carry the primary flag through the sort instead of searching for
+    // the primary cursor afterwards, two cursors can be equal
+    std::vector<std::pair<Caret, bool>> order;
+    order.reserve(carets_.size());
+    for (std::size_t i = 0; i < carets_.size(); ++i) {
+        order.push_back({carets_[i], i == primary_});
+    }
+    std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) {
+        return a.first.start() != b.first.start()
+                   ? a.first.start() < b.first.start()
+                   : a.first.end() < b.first.end();
+    });
+    carets_.clear();
+    primary_ = 0;
+    for (const auto &[caret, primary] : order) {
+        if (!carets_.empty()) {
+            Caret &last = carets_.back();
+            if (caret.start() < last.end() || caret.start() == last.start()) {
+                // The merged selection keeps the direction of the first one
+                std::size_t from = last.start();
+                std::size_t to = std::max(last.end(), caret.end());
+                last = last.anchor <= last.head ? Caret{from, to}
+                                                : Caret{to, from};
+                if (primary) {
+                    primary_ = carets_.size() - 1;
+                }
+                continue;
+            }
+        }
+        if (primary) {
+            primary_ = carets_.size();
+        }
+        carets_.push_back(caret);
+    }
+}
@@ -1,56 +1,175 @@
 #include "../include/editor.hpp"
 #include "../include/palette.hpp"
+#include "../include/utf8.hpp"
 
-// Helper method to decide if a mod key is currently applied
-static inline Mod current_mods() {
-    Mod m = MOD_NONE;
-    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
-        m |= MOD_CTRL;
-    }
-    if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
-        m |= MOD_SHIFT;
-    }
-    if (IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT)) {
-        m |= MOD_ALT;
-    }
-    if (IsKeyDown(KEY_LEFT_SUPER) || IsKeyDown(KEY_RIGHT_SUPER)) {
-        m |= MOD_SUPER;
-    }
-    return m;
-}
+#include <cctype>
+
+// How long input has to stop before on_idle hooks run
+static constexpr std::uint64_t IDLE_DELAY_NS = 500'000'000ull;
 
 // Constructor for the Editor class
-// We pass in the parsed contents and the file path
+// We pass in the already loaded storage and the file path
 // We also initialize a vector of keys we want to poll for
-Editor::Editor(std::string contents, std::filesystem::path file)
-    : buffer_(contents), contents_(contents), file_(file), vm_(this) {
+Editor::Editor(Loaded loaded, std::filesystem::path file,
+               std::unique_ptr<InputSource> input)
+    : vm_(this), buffer_(std::move(loaded.buffer)),
+      loader_(std::move(loaded.loader)), source_(std::move(loaded.source)),
+      input_(input ? std::move(input) : std::make_unique<RaylibInput>()),
+      file_(file) {
+    // The file we start with is the active document, its slot stays empty
+    // while it is active
+    workspace_.add(Document());
     // We bind the keymap in our initializer
     bind();
+    syntax_.set_lexer(lexer_for(file_));
     vm_.load_init(std::filesystem::path("init.lua"));
     state_ = EditingState::Editing;
 }
 
 // Function to draw editor contents to window
+// We only repaint what was damaged into the UI's canvas and then copy the
+// canvas to the screen
 void Editor::draw() {
+    ProfileScope scope("draw");
+    ui_.begin_paint();
     // We draw the main UI components
-    ui_.draw_ui();
-    // We use the ui helper function to draw the buffer
-    ui_.draw_buffer(buffer_.c_str());
-    // If we are editing we display the file name
-    if (state_ == EditingState::Editing) {
-        ui_.draw_fn(file_.c_str());
-        // If we are renaming we need to display the new name to the screen
-    } else if (state_ == EditingState::Renaming) {
-        ui_.draw_rename_fn(new_name_.c_str());
+    if (damage_.full) {
+        ui_.draw_ui();
+        damage_.lines(0, SIZE_MAX);
+    } else if (damage_.header) {
+        ui_.clear_header();
+    }
+    if (damage_.full || damage_.header) {
+        ui_.draw_status(status_.c_str());
+        // If we are editing we display the file name
+        if (state_ == EditingState::Editing) {
+            // With more than one file open we show which one this is
+            if (workspace_.size() > 1) {
+                ui_.draw_fn(TextFormat("%s  (%zu/%zu)", file_.c_str(),
+                                       workspace_.active() + 1,
+                                       workspace_.size()));
+            } else {
+                ui_.draw_fn(file_.c_str());
+            }
+            // If we are renaming we need to display the new name to the screen
+        } else if (state_ == EditingState::Renaming) {
+            ui_.draw_rename_fn(new_name_.c_str());
+        } else if (state_ == EditingState::Searching) {
+            ui_.draw_search(search_.query().c_str());
+        }
+    }
+    // Matches are highlighted for as long as the search is open
+    Highlights marks;
+    if (state_ == EditingState::Searching) {
+        marks = {&search_.matches(), search_.query().size(),
+                 buffer_->cursor()};
+    }
+    if (!carets_.empty()) {
+        marks.selections = &carets_.all();
+    }
+    marks.syntax = &syntax_;
+    // We use the ui helper function to draw the damaged visible lines
+    ui_.draw_buffer(*buffer_, top_line_, scroll_x_, damage_.first,
+                    damage_.last, marks);
+    // The cursor lives on its line, so it only needs drawing if that line was
+    // just repainted
+    std::size_t line = buffer_->line_of(buffer_->cursor());
+    if (line >= damage_.first && line <= damage_.last) {
+        ui_.draw_cursor(*buffer_, top_line_, scroll_x_);
+    }
+    // Every other cursor on a repainted line gets its bar too, they are
+    // sorted so we only walk the ones on screen
+    std::size_t first = std::max(damage_.first, top_line_);
+    std::size_t last = std::min({damage_.last, top_line_ + ui_.visible_lines(),
+                                 buffer_->line_count() - 1});
+    if (!carets_.empty() && first <= last) {
+        std::size_t from = buffer_->line_start(first);
+        std::size_t to = buffer_->line_start(last) + buffer_->line_length(last);
+        const std::vector<Caret> &carets = carets_.all();
+        auto it = std::lower_bound(
+            carets.begin(), carets.end(), from,
+            [](const Caret &c, std::size_t pos) { return c.head < pos; });
+        for (; it != carets.end() && it->head <= to; ++it) {
+            ui_.draw_caret(*buffer_, it->head, top_line_, scroll_x_);
+        }
+    }
+    ui_.end_paint();
+    ui_.present();
+    // The overlay goes on top of the canvas, so hiding it costs no repaint
+    if (show_profiler_) {
+        ui_.draw_profiler(profiler().summary());
+    }
+    finish_paint(line);
+}
+
+// Method to do a frame's work without drawing it
+// We still lay out every damaged line on screen, so a headless replay pays
+// for the layout cache like a real frame does
+void Editor::draw_headless() {
+    ProfileScope scope("draw");
+    if (damage_.full) {
+        damage_.lines(0, SIZE_MAX);
+    }
+    std::size_t bottom =
+        std::min(top_line_ + ui_.visible_lines(), buffer_->line_count());
+    for (std::size_t line = std::max(damage_.first, top_line_);
+         line < bottom && line <= damage_.last; ++line) {
+        ui_.layout_.line(*buffer_, line);
     }
+    finish_paint(buffer_->line_of(buffer_->cursor()));
+}
+
+// Helper method to remember what the view looked like when it was painted
+void Editor::finish_paint(std::size_t cursor_line) {
+    damage_.reset();
+    painted_cursor_ = buffer_->cursor();
+    painted_line_ = cursor_line;
+    painted_top_ = top_line_;
+    painted_scroll_x_ = scroll_x_;
+}
+
+// Method to tell the main loop whether anything needs repainting
+bool Editor::needs_redraw() const noexcept { return damage_.any(); }
+
+// Method to tell the main loop whether background work is in flight
+// A pending on_idle hook counts too, nothing would wake us up to run it
+bool Editor::busy() const {
+    return loader_ || workspace_.loading() || saver_.busy() || idle_pending_ ||
+           syntax_.busy();
 }
 
 // Function to poll for keyboard input
-void Editor::poll_input() {
+bool Editor::poll_input() {
+    ProfileScope scope("poll_input");
     // We make an alias to a function pointer for a member function that returns
     // a void
-    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-        move_to_mouse(GetMousePosition());
+    // We pick up any save or spill the workers finished since the last frame
+    // and whatever part of the file was loaded
+    collect_saves();
+    workspace_.collect_spills();
+    check_source();
+    pump_loader();
+    // Everything below reads this frame's input and nothing else
+    bool more = input_->poll(frame_);
+    std::size_t cursor = buffer_->cursor();
+    if (frame_.click) {
+        profiler().mark_input();
+        move_to_mouse({frame_.mouse_x, frame_.mouse_y});
+    }
+    // We scroll the viewport with the mouse wheel, a notch moves three lines
+    // Holding shift or using a horizontal wheel scrolls sideways instead
+    Vector2 wheel{frame_.wheel_x, frame_.wheel_y};
+    if (frame_.mods & MOD_SHIFT) {
+        wheel = {wheel.y, 0.0f};
+    }
+    if (wheel.x != 0.0f || wheel.y != 0.0f) {
+        profiler().mark_input();
+    }
+    if (wheel.y != 0.0f) {
+        scroll(static_cast<long long>(-wheel.y * 3.0f));
+    }
+    if (wheel.x != 0.0f) {
+        scroll_horizontal(-wheel.x * 3.0f * ui_.layout_.cell());
     }
 
     using IO = void (Editor::*)();
@@ -60,15 +179,194 @@ void Editor::poll_input() {
     static std::array<IO, static_cast<size_t>(EditingState::Count)> TABLE = {
         &Editor::editing,
         &Editor::name_file,
+        &Editor::searching,
     };
     // We then cast our state into a size_t so we can index the correct
     // method
     (this->*TABLE[static_cast<size_t>(state_)])();
+    // Scripts hear about the frame's edits, saves and cursor motion in one go
+    // before we work out what to repaint, so their own edits are drawn too
+    vm_.flush_hooks(buffer_->cursor() != cursor);
+    run_idle();
+    // A script can leave a transaction open, the caches still catch up with
+    // its edits before anything is drawn
+    flush_lines();
+    track_view();
+    // The lines on screen get their colors once the edits of the frame are
+    // in, the worker lexes them while we draw
+    std::size_t first = SIZE_MAX;
+    std::size_t last = 0;
+    if (syntax_.pump(*buffer_, top_line_, top_line_ + ui_.visible_lines(),
+                     first, last)) {
+        damage_.lines(first, last);
+    }
+    return more;
+}
+
+// Method to run the on_idle hooks once input has stopped for a moment
+void Editor::run_idle() {
+    std::uint64_t now = Profiler::now_ns();
+    if (!frame_.empty()) {
+        last_input_ns_ = now;
+        idle_pending_ = vm_.has_hooks(Hook::Idle);
+        return;
+    }
+    if (idle_pending_ && now - last_input_ns_ >= IDLE_DELAY_NS) {
+        idle_pending_ = false;
+        vm_.run_idle_hooks();
+    }
+}
+
+// Method to show or hide the frame time overlay
+void Editor::toggle_profiler() {
+    show_profiler_ = !show_profiler_;
+    damage_.overlay = true;
+}
+
+// Method to write what the profiler recorded to a Chrome trace file
+void Editor::dump_trace(const std::filesystem::path &path) {
+    if (profiler().dump_chrome_trace(path)) {
+        status_ = "trace written to " + path.string();
+    } else {
+        status_ = "could not write " + path.string();
+    }
+    damage_.header = true;
+}
+
+// Method to report finished saves in the status line
+void Editor::collect_saves() {
+    while (std::optional<SaveResult> r = saver_.poll()) {
+        if (!r->ok) {
+            std::cerr << "Could not save " << r->path << ": " << r->error
+                      << std::endl;
+            status_ = "save failed: " + r->error;
+        } else if (r->skipped) {
+            status_ = "no changes";
+        } else {
+            status_ = TextFormat("saved %zu bytes in %.0f ms", r->bytes,
+                                 r->ms);
+        }
+        vm_.note_save(r->path, r->ok);
+        damage_.header = true;
+    }
+}
+
+// Method to add the part of the file loaded since the last frame
+void Editor::pump_loader() {
+    // Parked files keep loading too, nothing is on screen for them
+    for (std::size_t i = 0; i < workspace_.size(); ++i) {
+        Document &doc = workspace_.at(i);
+        if (!doc.loader) {
+            continue;
+        }
+        doc.loader->pump();
+        if (doc.loader->done()) {
+            doc.loader.reset();
+            if (doc.save_after_load) {
+                doc.save_after_load = false;
+                saver_.submit(doc.file, doc.buffer->snapshot());
+            }
+        }
+    }
+    if (!loader_) {
+        return;
+    }
+    std::size_t last = buffer_->line_count() - 1;
+    if (loader_->pump() == 0) {
+        return;
+    }
+    // The last line may have grown and new lines follow it
+    lines_changed(last, 0, 0);
+    search_.invalidate();
+    damage_.lines(last, SIZE_MAX);
+    damage_.header = true;
+    if (!loader_->done()) {
+        ui_.load_progress_ = loader_->progress();
+        status_ = TextFormat("loading %.0f%%", loader_->progress() * 100.0f);
+        return;
+    }
+    status_ = TextFormat("loaded %zu bytes in %.0f ms", buffer_->size(),
+                         loader_->elapsed_ms());
+    ui_.load_progress_ = 1.0f;
+    loader_.reset();
+    if (save_after_load_) {
+        save_after_load_ = false;
+        save();
+    }
+}
+
+// Method to stop reading the file in place once another process changed it
+// The bytes the mapping still shows are copied into memory where they were,
+// so the buffer, the loader and the save worker carry on with the document
+// as it was and no edit is lost, loading what is on disk now is up to the
+// user
+void Editor::check_source() {
+    if (!source_ || !source_->changed()) {
+        return;
+    }
+    // The buffer keeps the copy alive, it is not the file any more
+    source_->detach();
+    source_.reset();
+    status_ = "file changed on disk, Ctrl+R loads it again";
+    damage_.header = true;
+}
+
+// Method to load the file from disk again
+// Edits since the file was loaded were made against the old text, so they
+// and their history go too, which is why this only happens when asked
+void Editor::reload() {
+    if (file_.empty()) {
+        return;
+    }
+    std::size_t cursor = buffer_->cursor();
+    bool edited = history_.can_undo();
+    flush_lines();
+    // The loader reads the mapping too so it stops first
+    loader_.reset();
+    source_.reset();
+    Loaded loaded = load_file(file_, "auto", true);
+    if (!loaded.buffer) {
+        loaded.buffer = make_storage(StorageKind::Gap, {});
+    }
+    buffer_ = std::move(loaded.buffer);
+    loader_ = std::move(loaded.loader);
+    source_ = std::move(loaded.source);
+    buffer_->set_cursor(std::min(cursor, buffer_->size()));
+    top_line_ = std::min(top_line_, buffer_->line_count() - 1);
+    history_.clear();
+    clear_cursors();
+    search_.invalidate();
+    ui_.layout_.clear();
+    syntax_.set_lexer(lexer_for(file_));
+    ui_.load_progress_ = loader_ ? loader_->progress() : 1.0f;
+    status_ = edited ? "reloaded, your edits were dropped" : "reloaded";
+    damage_.full = true;
+}
+
+// Method to work out what the input handled this frame damaged
+// Edits mark their own lines, here we pick up cursor motion and scrolling
+void Editor::track_view() {
+    if (frame_.resized) {
+        damage_.full = true;
+    }
+    // Scrolling moves every line on screen
+    if (top_line_ != painted_top_ || scroll_x_ != painted_scroll_x_) {
+        damage_.lines(0, SIZE_MAX);
+    }
+    // The cursor has to be erased from its old line and drawn on the new one
+    if (buffer_->cursor() != painted_cursor_) {
+        damage_.line(painted_line_);
+        damage_.line(buffer_->line_of(buffer_->cursor()));
+    }
 }
 
 // Wrapper method for inserting characters to the buffer
 // Useful for exposing insertion capabilites for Lua extension
-void Editor::insert_text(std::string text) { buffer_.insert(text); }
+void Editor::insert_text(std::string text) {
+    begin_edit(text.size());
+    apply_insert(text);
+    commit_edit();
+}
 
 // Helper exposed to the Lua VM for picking color palettes
 void Editor::pick_palette(const int palette) {
@@ -82,6 +380,8 @@ void Editor::pick_palette(const int palette) {
     ui_.palette_ = static_cast<Palette>(palette);
     // Afterwards we need to dispatch to the correct pallete type
     ui_.dispatch_palette();
+    // Every color on screen changed
+    damage_.full = true;
 }
 
 // Helper exposed to Lua API for toggling between palletes
@@ -102,53 +402,192 @@ void Editor::toggle_palette() {
 // Function to rename files
 void Editor::name_file() {
     // We listen for keyboard events and return the code point
-    for (int code_point; (code_point = GetCharPressed()) != 0;) {
+    for (int code_point : frame_.chars) {
         // If the code is greater than 32 or a new line or a tab we process
         // it
+        profiler().mark_input();
         if (code_point >= 32 || code_point == '\n' || code_point == '\t') {
             new_name_ += code_point;
+            damage_.header = true;
         }
     }
     // After we hit enter we save the new name and return to an editing state
-    if (IsKeyPressed(KEY_ENTER)) {
+    if (frame_.pressed(KEY_ENTER)) {
+        profiler().mark_input();
         file_ = new_name_;
         new_name_.clear();
+        // A new extension can mean another language
+        if (const Lexer *lexer = lexer_for(file_); lexer != syntax_.lexer()) {
+            syntax_.set_lexer(lexer);
+            damage_.lines(0, SIZE_MAX);
+        }
         save();
         state_ = EditingState::Editing;
+        damage_.header = true;
         // We need to be able to erase characters from the new name so
         // we pop back teh value if he new name string is not empty
-    } else if (IsKeyPressed(KEY_BACKSPACE)) {
+    } else if (frame_.pressed(KEY_BACKSPACE)) {
+        profiler().mark_input();
         if (!new_name_.empty()) {
             new_name_.pop_back();
+            damage_.header = true;
+        }
+    }
+}
+
+// Function to handle the search state, typing edits the query and every
+// change to it searches again
+void Editor::searching() {
+    // A script may have edited the document since the last frame, this only
+    // searches again if it did
+    search_.update(*buffer_, search_.query());
+    std::string query = search_.query();
+    for (int cp : frame_.chars) {
+        profiler().mark_input();
+        if ((frame_.mods & ~MOD_SHIFT) != MOD_NONE) {
+            continue;
+        }
+        if (cp >= 32) {
+            utf8::encode(cp, query);
         }
     }
+    set_query(query);
+    for (int key : frame_.keys) {
+        profiler().mark_input();
+        if (key == KEY_BACKSPACE && !query.empty()) {
+            // We take off a whole character and not just its last byte
+            std::size_t n = query.size() - 1;
+            while (n > 0 && utf8::continuation(query[n])) {
+                --n;
+            }
+            query.resize(n);
+            set_query(query);
+        } else if (key == KEY_ENTER ||
+                   (key == KEY_F && (frame_.mods & MOD_CTRL))) {
+            // Enter steps through the matches, shift goes backwards
+            if (frame_.mods & MOD_SHIFT) {
+                find_prev();
+            } else {
+                find_next();
+            }
+        } else if (key == KEY_ESCAPE) {
+            end_search();
+            return;
+        }
+    }
+}
+
+// Method to open the search, the last query is kept so searching again
+// shows where it matches right away
+void Editor::start_search() {
+    clear_cursors();
+    state_ = EditingState::Searching;
+    search_origin_ = buffer_->cursor();
+    // Escape closes the search instead of the window while it is open
+    SetExitKey(KEY_NULL);
+    if (!search_.query().empty()) {
+        search_.update(*buffer_, search_.query());
+        std::size_t index = search_.next(search_origin_);
+        jump_to_match(index);
+    }
+    damage_.lines(0, SIZE_MAX);
+    damage_.header = true;
+}
+
+// Method to close the search, the cursor stays on the match it was on
+void Editor::end_search() {
+    state_ = EditingState::Editing;
+    SetExitKey(KEY_ESCAPE);
+    damage_.lines(0, SIZE_MAX);
+    damage_.header = true;
+}
+
+// Method to change the query and jump to its first match after the origin
+void Editor::set_query(std::string query) {
+    if (query == search_.query()) {
+        return;
+    }
+    search_.update(*buffer_, query);
+    // An empty query puts the cursor back where the search started
+    if (query.empty()) {
+        begin_edit();
+        buffer_->set_cursor(std::min(search_origin_, buffer_->size()));
+        commit_edit();
+    }
+    jump_to_match(search_.next(search_origin_));
+}
+
+// Method to jump to the match after the cursor, also used after the search
+// is closed to keep stepping through the last query's matches
+void Editor::find_next() {
+    if (search_.query().empty()) {
+        return;
+    }
+    search_.update(*buffer_, search_.query());
+    jump_to_match(search_.next(buffer_->cursor() + 1));
+}
+
+// Method to jump to the match before the cursor
+void Editor::find_prev() {
+    if (search_.query().empty()) {
+        return;
+    }
+    search_.update(*buffer_, search_.query());
+    jump_to_match(search_.prev(buffer_->cursor()));
+}
+
+// Helper method to move the cursor onto a match and report where we are
+void Editor::jump_to_match(std::size_t index) {
+    // Highlights move with the query so every visible line may change
+    damage_.lines(0, SIZE_MAX);
+    damage_.header = true;
+    if (index == Search::NONE) {
+        status_ = search_.query().empty() ? "" : "no matches";
+        return;
+    }
+    clear_cursors();
+    begin_edit();
+    buffer_->set_cursor(search_.matches()[index]);
+    commit_edit();
+    status_ = TextFormat("match %zu of %zu%s", index + 1,
+                         search_.matches().size(),
+                         search_.truncated() ? "+" : "");
 }
 
 // Function to handle editting logic
 void Editor::editing() {
+    // Everything that happens during a frame is one transaction, so the
+    // viewport is only updated once no matter how many keys were handled
+    begin_edit();
     // We listen for keyboard events and return the code point
-    for (int cp; (cp = GetCharPressed()) != 0;) {
-        // I will think of something later but for now, the catch below prevents
-        // shifted characters so we'll just jump over it for now
-        if (current_mods() & MOD_SHIFT) {
-            goto shifted;
-        }
-        // We prevents Ctrl+S from inserting 's' or other combos
-        if (current_mods() != MOD_NONE) {
+    for (int cp : frame_.chars) {
+        // This frame handled input, so its time counts towards the
+        // keystroke to draw latency
+        profiler().mark_input();
+        // We prevents Ctrl+S from inserting 's' or other combos, shift on
+        // its own is fine since it just picks the shifted character
+        // This also keeps Ctrl+Shift+Z from typing a 'Z'
+        if ((frame_.mods & ~MOD_SHIFT) != MOD_NONE) {
             continue;
         }
-    shifted:
-        // Otherwise can insert the character into the buffer
+        // Otherwise we queue the character for insertion, encoded as UTF-8
+        // since a code point past ASCII takes more than one byte
         if (cp >= 32 || cp == '\n' || cp == '\t') {
-            buffer_.insert(cp);
+            utf8::encode(cp, typed_);
         }
     }
+    // We insert everything typed this frame with a single insert
+    if (!typed_.empty()) {
+        apply_insert(typed_);
+        typed_.clear();
+    }
 
     // We listen for which Key is pressed and create a chord object
-    for (int key; (key = GetKeyPressed()) != 0;) {
+    for (int key : frame_.keys) {
+        profiler().mark_input();
         // We create the object with the current key and whether we are
         // pressing a modifying key, ie Ctrl or Super
-        KeyChord chord{key, current_mods()};
+        KeyChord chord{key, frame_.mods};
         // We then loop up the chord in the chordmap
         if (auto it = chordmap_.find(chord); it != chordmap_.end()) {
             // If we find it we dispatch the method and return to listening
@@ -157,6 +596,269 @@ void Editor::editing() {
             continue;
         }
     }
+
+    commit_edit();
+}
+
+// Method to open a transaction, they can nest and only the outermost one
+// does any work
+void Editor::begin_edit(std::size_t reserve) {
+    if (edit_depth_++ == 0) {
+        edit_cursor_ = buffer_->cursor();
+        edit_size_ = buffer_->size();
+        // Each transaction is its own undo step, unless it just continues
+        // the current run of typing
+        history_.seal();
+    }
+    // If the caller knows how much it is about to insert we make room once
+    if (reserve) {
+        buffer_->reserve(reserve);
+    }
+}
+
+// Method to close a transaction
+void Editor::commit_edit() {
+    // We guard against a script committing more than it began
+    if (edit_depth_ == 0 || --edit_depth_ != 0) {
+        return;
+    }
+    flush_lines();
+    // We only scroll the viewport when an edit or motion actually happened,
+    // otherwise the mouse wheel would be snapped back to the cursor
+    if (buffer_->cursor() != edit_cursor_ || buffer_->size() != edit_size_) {
+        // Moving the cursor without editing ends the run of typing, so
+        // typing again somewhere else is a separate undo step
+        if (buffer_->size() == edit_size_) {
+            history_.break_run();
+        }
+        follow_cursor();
+    }
+}
+
+// Method to undo the last group of edits
+// A group can touch lines anywhere in the document so we drop every layout
+void Editor::undo() {
+    clear_cursors();
+    begin_edit();
+    flush_lines();
+    // Scripts hear about the edits the history puts back like any others
+    auto note = [this](const Splice &e) {
+        vm_.note_edit(e.pos, e.len, e.text);
+    };
+    if (history_.undo(*buffer_, note)) {
+        search_.invalidate();
+        ui_.layout_.clear();
+        syntax_.invalidate_from(buffer_->line_of(
+            std::min(history_.touched(), buffer_->size())));
+        damage_.lines(0, SIZE_MAX);
+    }
+    commit_edit();
+}
+
+// Method to redo the last undone group of edits
+void Editor::redo() {
+    clear_cursors();
+    begin_edit();
+    flush_lines();
+    // Scripts hear about the edits the history puts back like any others
+    auto note = [this](const Splice &e) {
+        vm_.note_edit(e.pos, e.len, e.text);
+    };
+    if (history_.redo(*buffer_, note)) {
+        search_.invalidate();
+        ui_.layout_.clear();
+        syntax_.invalidate_from(buffer_->line_of(
+            std::min(history_.touched(), buffer_->size())));
+        damage_.lines(0, SIZE_MAX);
+    }
+    commit_edit();
+}
+
+// Method to cap how much memory the undo history may hold
+void Editor::set_undo_budget(std::size_t bytes) { history_.set_budget(bytes); }
+
+// Method to park a loaded file in the workspace without switching to it
+std::size_t Editor::add_buffer(Loaded loaded, std::filesystem::path file) {
+    Document doc;
+    doc.buffer = std::move(loaded.buffer);
+    doc.loader = std::move(loaded.loader);
+    doc.source = std::move(loaded.source);
+    doc.file = std::move(file);
+    doc.history.set_budget(history_.budget());
+    std::size_t index = workspace_.add(std::move(doc));
+    workspace_.enforce_budget();
+    return index;
+}
+
+// Method to switch to a file, it is loaded and added if it is not open yet
+bool Editor::open(const std::filesystem::path &file) {
+    if (same_file(file, file_)) {
+        return true;
+    }
+    std::size_t index = workspace_.find(file);
+    if (index == Workspace::NONE) {
+        Loaded loaded = load_file(file, "auto", true);
+        if (!loaded.buffer) {
+            return false;
+        }
+        index = add_buffer(std::move(loaded), file);
+    }
+    switch_buffer(index);
+    return workspace_.active() == index;
+}
+
+// Method to make another open file the active one
+// The one we leave is parked with its history and view, and parking it may
+// push older files over the budget and out to disk
+void Editor::switch_buffer(std::size_t index) {
+    if (index >= workspace_.size() || index == workspace_.active()) {
+        return;
+    }
+    // Queued hook events belong to the file we are leaving
+    if (!vm_.dispatching_) {
+        vm_.flush_hooks(false);
+    }
+    // The cursors belong to the file we are leaving too
+    clear_cursors();
+    // Lines changed in the file we leave are of no use to the next one
+    flush_lines();
+    park(workspace_.at(workspace_.active()));
+    workspace_.activate(index);
+    unpark(workspace_.at(index));
+    workspace_.enforce_budget();
+    // The search keeps its query but its matches were for the other file
+    if (state_ == EditingState::Searching) {
+        end_search();
+    }
+    state_ = EditingState::Editing;
+    search_.invalidate();
+    ui_.layout_.clear();
+    ui_.load_progress_ = loader_ ? loader_->progress() : 1.0f;
+    status_ = TextFormat("buffer %zu of %zu", index + 1, workspace_.size());
+    damage_.full = true;
+    // The file may have changed on disk while it was parked
+    check_source();
+    // A transaction that is open carries on in the new file as if it had
+    // just begun there
+    edit_cursor_ = buffer_->cursor();
+    edit_size_ = buffer_->size();
+    history_.seal();
+}
+
+void Editor::next_buffer() {
+    switch_buffer((workspace_.active() + 1) % workspace_.size());
+}
+
+void Editor::prev_buffer() {
+    switch_buffer((workspace_.active() + workspace_.size() - 1) %
+                  workspace_.size());
+}
+
+std::size_t Editor::buffer_count() const noexcept { return workspace_.size(); }
+
+std::size_t Editor::current_buffer() const noexcept {
+    return workspace_.active();
+}
+
+// Method to cap how much text parked files keep in memory
+void Editor::set_buffer_budget(std::size_t bytes) {
+    workspace_.set_budget(bytes);
+}
+
+// Helper method to move the active file's state into its slot
+void Editor::park(Document &doc) {
+    doc.cursor = buffer_->cursor();
+    doc.buffer = std::move(buffer_);
+    doc.loader = std::move(loader_);
+    doc.source = std::move(source_);
+    doc.save_after_load = save_after_load_;
+    doc.history = std::move(history_);
+    doc.file = std::move(file_);
+    doc.top_line = top_line_;
+    doc.scroll_x = scroll_x_;
+}
+
+// Helper method to take a file's state out of its slot
+void Editor::unpark(Document &doc) {
+    buffer_ = std::move(doc.buffer);
+    loader_ = std::move(doc.loader);
+    source_ = std::move(doc.source);
+    save_after_load_ = doc.save_after_load;
+    history_ = std::move(doc.history);
+    file_ = std::move(doc.file);
+    syntax_.set_lexer(lexer_for(file_));
+    buffer_->set_cursor(std::min(doc.cursor, buffer_->size()));
+    top_line_ = std::min(doc.top_line, buffer_->line_count() - 1);
+    scroll_x_ = doc.scroll_x;
+}
+
+// Method to insert text at the cursor and record it for undo
+void Editor::apply_insert(std::string_view text) {
+    if (!carets_.empty()) {
+        edit_cursors(text, false);
+        return;
+    }
+    std::size_t line = buffer_->line_of(buffer_->cursor());
+    history_.record_insert(buffer_->cursor(), text);
+    vm_.note_insert(buffer_->cursor(), text);
+    search_.invalidate();
+    buffer_->insert(text);
+    // The cursor's line is split into one more line per newline inserted
+    std::size_t added = std::count(text.begin(), text.end(), '\n');
+    lines_changed(line, 0, added);
+    // New lines push everything below them down
+    damage_.lines(line, added ? SIZE_MAX : line);
+}
+
+// Method to erase before the cursor and record it for undo
+void Editor::apply_erase(std::size_t num_chars) {
+    std::size_t n = std::min(num_chars, buffer_->cursor());
+    // Every line the erased range touches is joined into the first one
+    std::size_t first = buffer_->line_of(buffer_->cursor() - n);
+    std::size_t last = buffer_->line_of(buffer_->cursor());
+    history_.record_erase(*buffer_, buffer_->cursor() - n, n);
+    search_.invalidate();
+    vm_.note_erase(buffer_->cursor() - n, n);
+    buffer_->erase_back(n);
+    lines_changed(first, last - first, 0);
+    // Joined lines pull everything below them up
+    damage_.lines(first, last != first ? SIZE_MAX : first);
+}
+
+// Method to tell the caches an edit replaced old_lines + 1 lines starting
+// at first with new_lines + 1 lines
+// Inside a transaction we only widen the range the edits so far replaced,
+// it is kept in the document as it is now, so it ends where the last edit
+// past it ended and everything past that moved by how many lines were added
+void Editor::lines_changed(std::size_t first, std::size_t old_lines,
+                           std::size_t new_lines) {
+    std::ptrdiff_t grown = static_cast<std::ptrdiff_t>(new_lines) -
+                           static_cast<std::ptrdiff_t>(old_lines);
+    if (!lines_pending_) {
+        lines_pending_ = true;
+        pending_first_ = first;
+        pending_last_ = first + old_lines;
+        pending_grown_ = 0;
+    }
+    pending_first_ = std::min(pending_first_, first);
+    pending_last_ = std::max(pending_last_, first + old_lines) + grown;
+    pending_grown_ += grown;
+    if (edit_depth_ == 0) {
+        flush_lines();
+    }
+}
+
+// Method to hand the lines the pending edits replaced to the caches
+void Editor::flush_lines() {
+    if (!lines_pending_) {
+        return;
+    }
+    lines_pending_ = false;
+    std::size_t old_last = pending_last_ - pending_grown_;
+    ui_.layout_.invalidate(pending_first_, old_last - pending_first_,
+                           pending_last_ - pending_first_);
+    syntax_.invalidate(pending_first_, old_last - pending_first_,
+                       pending_last_ - pending_first_);
 }
 
 // Helper function to bind the methods to our keymap
@@ -171,59 +873,450 @@ void Editor::bind() {
     chordmap_[{KEY_UP, MOD_NONE}] = [](Editor &e) { e.move_up(); };
     chordmap_[{KEY_DOWN, MOD_NONE}] = [](Editor &e) { e.move_down(); };
     chordmap_[{KEY_V, MOD_CTRL}] = [](Editor &e) { e.paste(); };
+    chordmap_[{KEY_Z, MOD_CTRL}] = [](Editor &e) { e.undo(); };
+    chordmap_[{KEY_Z, MOD_CTRL | MOD_SHIFT}] = [](Editor &e) { e.redo(); };
+    chordmap_[{KEY_R, MOD_CTRL}] = [](Editor &e) { e.reload(); };
+    chordmap_[{KEY_F, MOD_CTRL}] = [](Editor &e) { e.start_search(); };
+    chordmap_[{KEY_G, MOD_CTRL}] = [](Editor &e) { e.find_next(); };
+    chordmap_[{KEY_G, MOD_CTRL | MOD_SHIFT}] = [](Editor &e) { e.find_prev(); };
+    chordmap_[{KEY_TAB, MOD_CTRL}] = [](Editor &e) { e.next_buffer(); };
+    chordmap_[{KEY_TAB, MOD_CTRL | MOD_SHIFT}] = [](Editor &e) {
+        e.prev_buffer();
+    };
+    chordmap_[{KEY_D, MOD_CTRL}] = [](Editor &e) { e.select_next(); };
+    chordmap_[{KEY_L, MOD_CTRL | MOD_SHIFT}] = [](Editor &e) {
+        e.select_all();
+    };
+    chordmap_[{KEY_ESCAPE, MOD_NONE}] = [](Editor &e) { e.clear_cursors(); };
+    chordmap_[{KEY_F3, MOD_NONE}] = [](Editor &e) { e.toggle_profiler(); };
+    chordmap_[{KEY_F4, MOD_NONE}] = [](Editor &e) {
+        e.dump_trace("phosphor-trace.json");
+    };
+}
+
+// Methods to move the cursor, or every cursor when there are several
+void Editor::move_left() { move_cursors(&Editor::left_of); }
+
+void Editor::move_right() { move_cursors(&Editor::right_of); }
+
+void Editor::move_up() { move_cursors(&Editor::above); }
+
+void Editor::move_down() { move_cursors(&Editor::below); }
+
+// Left moves a whole character with its combining marks
+std::size_t Editor::left_of(std::size_t pos) const {
+    return buffer_->prev_grapheme(pos);
 }
 
-// Method to move the cursor left
-void Editor::move_left() { buffer_.move_cursor(-1); }
+std::size_t Editor::right_of(std::size_t pos) const {
+    return buffer_->next_grapheme(pos);
+}
 
-// Method to move the cursor right
-void Editor::move_right() { buffer_.move_cursor(1); }
+// Up moves to the line above
+std::size_t Editor::above(std::size_t pos) const {
+    // We look up where the cursor sits using the line index
+    LineCol at = buffer_->position(pos);
+    // There is nowhere to go if we are already on the first line
+    if (at.line == 0) {
+        return pos;
+    }
+    // We keep the same column in characters, counting bytes would land in
+    // the middle of a character when the lines hold different scripts
+    // Shorter lines clamp it to their end
+    std::size_t col = buffer_->column(pos);
+    return buffer_->offset_at_column(at.line - 1, col);
+}
 
-// TODO: Implement up moves
-void Editor::move_up() { std::cout << "Up key pressed" << std::endl; }
+std::size_t Editor::below(std::size_t pos) const {
+    LineCol at = buffer_->position(pos);
+    // There is nowhere to go if we are already on the last line
+    if (at.line + 1 >= buffer_->line_count()) {
+        return pos;
+    }
+    std::size_t col = buffer_->column(pos);
+    return buffer_->offset_at_column(at.line + 1, col);
+}
 
-// TODO: Implement down moves
-void Editor::move_down() { std::cout << "Down key pressed" << std::endl; }
+// Helper method to apply a motion to the cursor
+// With several cursors each one moves and drops its selection, and the
+// storage's cursor is only moved once to the primary one, so the gap buffer
+// does not shift its gap once per cursor
+void Editor::move_cursors(std::size_t (Editor::*motion)(std::size_t) const) {
+    if (carets_.empty()) {
+        buffer_->set_cursor((this->*motion)(buffer_->cursor()));
+        return;
+    }
+    for (Caret &caret : carets_.all()) {
+        caret.head = (this->*motion)(caret.head);
+        caret.anchor = caret.head;
+    }
+    sync_cursors();
+}
 
-// Method to handle backspace, we simply erase back one char
-void Editor::backspace() { buffer_.erase_back(1); }
+// Method to add a cursor, the one we had becomes the first of several
+void Editor::add_cursor(std::size_t pos) {
+    begin_edit();
+    if (carets_.empty()) {
+        carets_.add({buffer_->cursor(), buffer_->cursor()});
+    }
+    pos = std::min(pos, buffer_->size());
+    carets_.add({pos, pos});
+    sync_cursors();
+    status_ = TextFormat("%zu cursors", cursor_count());
+    damage_.header = true;
+    commit_edit();
+}
+
+// Method to select the next occurrence of what is selected
+// Without a selection the first press selects the word under each cursor,
+// after that every press adds a cursor on the next occurrence of the primary
+// selection that is not selected yet, wrapping around the end
+void Editor::select_next() {
+    begin_edit();
+    if (carets_.empty()) {
+        carets_.add({buffer_->cursor(), buffer_->cursor()});
+    }
+    const Caret primary = carets_.primary();
+    if (primary.anchor == primary.head) {
+        for (Caret &caret : carets_.all()) {
+            caret = word_at(caret.head);
+        }
+        sync_cursors();
+        commit_edit();
+        return;
+    }
+    // The search keeps its matches while the document is unchanged, so
+    // pressing this again does not scan the document again
+    std::string needle;
+    buffer_->copy(primary.start(), primary.end() - primary.start(), needle);
+    search_.update(*buffer_, needle);
+    const std::vector<std::size_t> &matches = search_.matches();
+    const std::vector<Caret> &carets = carets_.all();
+    std::size_t index = search_.next(primary.end());
+    for (std::size_t tries = 0; tries < matches.size(); ++tries) {
+        std::size_t at = matches[(index + tries) % matches.size()];
+        // A match already selected, or overlapping a selection, is skipped
+        auto it = std::lower_bound(
+            carets.begin(), carets.end(), at,
+            [](const Caret &c, std::size_t pos) { return c.end() <= pos; });
+        if (it != carets.end() && it->start() < at + needle.size()) {
+            continue;
+        }
+        carets_.add({at, at + needle.size()});
+        sync_cursors();
+        status_ = TextFormat("%zu cursors", cursor_count());
+        damage_.header = true;
+        commit_edit();
+        return;
+    }
+    status_ = "all occurrences selected";
+    damage_.header = true;
+    sync_cursors();
+    commit_edit();
+}
+
+// Method to select every occurrence of the primary selection at once
+// Overlapping matches keep the first of each run like replace all does
+void Editor::select_all() {
+    begin_edit();
+    if (carets_.empty() || carets_.primary().anchor == carets_.primary().head) {
+        carets_.clear();
+        Caret word = word_at(buffer_->cursor());
+        carets_.add(word);
+    }
+    const Caret primary = carets_.primary();
+    std::string needle;
+    buffer_->copy(primary.start(), primary.end() - primary.start(), needle);
+    if (!needle.empty()) {
+        search_.update(*buffer_, needle);
+        std::vector<Caret> &carets = carets_.all();
+        carets.clear();
+        carets.reserve(search_.matches().size() + 1);
+        std::size_t end = 0;
+        for (std::size_t at : search_.matches()) {
+            if (at >= end) {
+                end = at + needle.size();
+                carets.push_back({at, end});
+            }
+        }
+        // Adding the old primary again merges into its match, so the view
+        // stays where it was
+        carets_.add(primary);
+        status_ = TextFormat("%zu cursors", cursor_count());
+        damage_.header = true;
+    }
+    sync_cursors();
+    commit_edit();
+}
+
+// Method to go back to a single cursor, the primary one
+void Editor::clear_cursors() {
+    if (carets_.empty()) {
+        return;
+    }
+    carets_.clear();
+    SetExitKey(KEY_ESCAPE);
+    damage_.lines(0, SIZE_MAX);
+}
+
+std::size_t Editor::cursor_count() const noexcept {
+    return carets_.empty() ? 1 : carets_.size();
+}
+
+// Helper method to find the word around pos, letters, digits, underscores
+// and anything past ASCII count as word characters
+// Off a word we return an empty selection at pos
+Caret Editor::word_at(std::size_t pos) const {
+    auto word = [](char c) {
+        auto u = static_cast<unsigned char>(c);
+        return std::isalnum(u) || c == '_' || u >= 0x80;
+    };
+    std::size_t line = buffer_->line_of(pos);
+    std::size_t start = buffer_->line_start(line);
+    std::string text;
+    buffer_->copy(start, buffer_->line_length(line), text);
+    std::size_t a = pos - start;
+    std::size_t b = a;
+    while (a > 0 && word(text[a - 1])) {
+        --a;
+    }
+    while (b < text.size() && word(text[b])) {
+        ++b;
+    }
+    return {start + a, start + b};
+}
+
+// Helper method to tidy the cursors after they moved or the text changed
+// The storage's cursor follows the primary one, and once every cursor has
+// merged into one without a selection we are back to a single cursor
+void Editor::sync_cursors() {
+    carets_.normalize();
+    if (carets_.empty()) {
+        return;
+    }
+    const Caret &primary = carets_.primary();
+    buffer_->set_cursor(primary.head);
+    if (carets_.size() == 1 && primary.anchor == primary.head) {
+        clear_cursors();
+        return;
+    }
+    // Escape drops the extra cursors instead of closing the window
+    SetExitKey(KEY_NULL);
+    // Cursors can be anywhere on screen, so we repaint all of it
+    damage_.lines(0, SIZE_MAX);
+}
+
+// Helper method to make the same edit at every cursor
+// Each selection, or the character before a cursor for a backspace, is
+// replaced by text, and the edits go to the storage as one sorted list it
+// applies in a single pass and to the history as one record
+void Editor::edit_cursors(std::string_view text, bool erase) {
+    std::vector<Caret> &carets = carets_.all();
+    std::vector<Splice> edits;
+    edits.reserve(carets.size());
+    bool changes = !text.empty();
+    std::size_t end = 0;
+    for (const Caret &caret : carets) {
+        std::size_t from = caret.start();
+        // A backspace never reaches back into the cursor before it
+        if (erase && from == caret.end()) {
+            from = std::max(buffer_->prev_char(from), end);
+        }
+        edits.push_back({from, caret.end() - from, text});
+        changes = changes || from != caret.end();
+        end = caret.end();
+    }
+    if (!changes) {
+        return;
+    }
+    history_.record_splice(*buffer_, edits);
+    search_.invalidate();
+    flush_lines();
+    syntax_.invalidate_from(buffer_->line_of(edits.front().pos));
+    // Every edit moves the ones after it by how much it grew or shrank,
+    // scripts hear about them in order as if they were made one by one
+    std::size_t shift = 0;
+    for (std::size_t i = 0; i < edits.size(); ++i) {
+        const Splice &e = edits[i];
+        vm_.note_edit(e.pos + shift, e.len, e.text);
+        std::size_t after = e.pos + shift + e.text.size();
+        carets[i] = {after, after};
+        shift += e.text.size() - e.len;
+    }
+    buffer_->splice(edits);
+    // Lines anywhere in the document may have changed
+    ui_.layout_.clear();
+    sync_cursors();
+}
+
+// Method to scroll the viewport by a number of lines
+void Editor::scroll(long long lines) {
+    long long last = static_cast<long long>(buffer_->line_count()) - 1;
+    long long top = static_cast<long long>(top_line_) + lines;
+    top_line_ = static_cast<std::size_t>(std::clamp(top, 0LL, last));
+}
+
+// Method to scroll the viewport sideways by a number of pixels
+void Editor::scroll_horizontal(float dx) {
+    scroll_x_ = std::max(scroll_x_ + dx, 0.0f);
+}
+
+// Method to scroll just enough to keep the cursor in view
+void Editor::follow_cursor() {
+    LineCol at = buffer_->position(buffer_->cursor());
+    std::size_t rows = std::max<std::size_t>(ui_.visible_lines(), 1);
+    if (at.line < top_line_) {
+        top_line_ = at.line;
+    } else if (at.line >= top_line_ + rows) {
+        top_line_ = at.line - rows + 1;
+    }
+    // We read the cursor's x from the layout cache and keep a cell of room
+    // on the right so the cursor bar is never clipped
+    float x = ui_.layout_.line(*buffer_, at.line).x_of(at.col);
+    float cell = ui_.layout_.cell();
+    if (x < scroll_x_) {
+        scroll_x_ = x;
+    } else if (x + cell > scroll_x_ + ui_.text_width()) {
+        scroll_x_ = x + cell - ui_.text_width();
+    }
+}
+
+// Method to handle backspace, we erase back one character
+// This is a code point rather than a grapheme so a combining mark can be
+// taken off on its own
+void Editor::backspace() {
+    begin_edit();
+    if (!carets_.empty()) {
+        edit_cursors({}, true);
+        commit_edit();
+        return;
+    }
+    std::size_t pos = buffer_->cursor();
+    apply_erase(pos - buffer_->prev_char(pos));
+    commit_edit();
+}
 
 // Method to handle enter, we simply push a new line
-void Editor::enter() { buffer_.insert('\n'); }
+void Editor::enter() {
+    begin_edit();
+    apply_insert("\n");
+    commit_edit();
+}
 
 // Method to handle tab, we simply push a tab
 // can be problematic for Python so maybe need to offer a 4 space tab too
-void Editor::tab() { buffer_.insert('\t'); }
+void Editor::tab() {
+    begin_edit();
+    apply_insert("\t");
+    commit_edit();
+}
 
 // Method to paste clip board contents
 void Editor::paste() {
     // We need to make sure the contents are not empty
-    if (std::string contents = GetClipboardText(); !contents.empty()) {
-        buffer_.insert(contents);
+    if (std::string contents = input_->clipboard(); !contents.empty()) {
+        // The whole paste is a single reserve and copy, and its own undo step
+        begin_edit(contents.size());
+        history_.break_run();
+        apply_insert(contents);
+        history_.break_run();
+        commit_edit();
     }
 }
 
-void Editor::move_to_mouse(Vector2 mouse_pos) {
-    // We test if the click is above the text
-    if (mouse_pos.y < ui_.buffer_pos_.y) {
-        // We simply move to the start of the text
-        int index = buffer_.size();
-        buffer_.move_cursor(-index);
+// Method to replace every occurrence of a query
+// We find every match first and hand them all to the storage engine, which
+// rebuilds the document in one pass instead of editing it once per match
+std::size_t Editor::replace_all(std::string_view query, std::string_view with) {
+    if (query.empty()) {
+        return 0;
     }
-
-    // TODO: Figure out how to transform this to a logical positon below text
-    // Currently the text is only measure by the actual number of characters
-    // without accounting for new lines so the position is off by a lot
-    if (mouse_pos.y > MeasureTextEx(ui_.text_font_, buffer_.c_str(),
-                                    ui_.text_size_, ui_.text_spacing_)
-                          .y) {
-        std::cout << "Below text" << std::endl;
+    // Part of the file is not in the buffer yet, so we would miss matches
+    if (loader_) {
+        status_ = "can't replace while loading";
+        damage_.header = true;
+        return 0;
+    }
+    clear_cursors();
+    std::vector<std::size_t> at;
+    find_matches(*buffer_, query, at);
+    // Matches can overlap ("aa" in "aaa"), we keep the first of each run
+    // like a left to right search and replace would
+    std::size_t kept = 0;
+    std::size_t end = 0;
+    for (std::size_t pos : at) {
+        if (pos >= end) {
+            at[kept++] = pos;
+            end = pos + query.size();
+        }
+    }
+    at.resize(kept);
+    status_ = at.empty() ? "no matches"
+                         : TextFormat("replaced %zu", at.size());
+    damage_.header = true;
+    if (at.empty()) {
+        return 0;
+    }
+    // The cursor keeps its place in the text around it, one inside a match
+    // moves to the start of the replacement
+    std::size_t cursor = buffer_->cursor();
+    std::size_t before = std::lower_bound(at.begin(), at.end(), cursor,
+                                          [&](std::size_t pos, std::size_t c) {
+                                              return pos + query.size() <= c;
+                                          }) -
+                         at.begin();
+    if (before < at.size() && at[before] < cursor) {
+        cursor = at[before];
+    }
+    cursor = cursor - before * query.size() + before * with.size();
+    begin_edit();
+    history_.break_run();
+    history_.record_replace(at, query, with);
+    search_.invalidate();
+    flush_lines();
+    syntax_.invalidate_from(buffer_->line_of(at.front()));
+    buffer_->replace_matches(at, query.size(), with);
+    buffer_->set_cursor(cursor);
+    // Scripts hear about every match, each one moved by the ones before it
+    for (std::size_t i = 0; i < at.size(); ++i) {
+        vm_.note_edit(at[i] - i * query.size() + i * with.size(),
+                      query.size(), with);
     }
+    history_.break_run();
+    // Like undo this touches lines anywhere in the document
+    ui_.layout_.clear();
+    damage_.lines(0, SIZE_MAX);
+    commit_edit();
+    return at.size();
+}
 
-    // We test if the click is to the left of the text
-    if (mouse_pos.x < ui_.buffer_pos_.x) {
-        std::cout << "Right of text" << std::endl;
+// Method to move the cursor to where the mouse clicked
+// Alt+click adds a cursor there instead, a plain click drops the extra ones
+void Editor::move_to_mouse(Vector2 mouse_pos) {
+    begin_edit();
+    // A click above the text moves to the start of the document
+    std::size_t pos = 0;
+    if (mouse_pos.y >= ui_.buffer_pos_.y) {
+        // We find the row that was clicked, a click below the text lands on
+        // the last line
+        std::size_t row = static_cast<std::size_t>(
+            (mouse_pos.y - ui_.buffer_pos_.y) / ui_.line_height_);
+        std::size_t line =
+            std::min(top_line_ + row, buffer_->line_count() - 1);
+        // The layout cache turns the x position into the nearest character,
+        // a click in the gutter lands on the start of the line
+        float x = mouse_pos.x - ui_.buffer_pos_.x + scroll_x_;
+        flush_lines();
+        std::size_t col = ui_.layout_.line(*buffer_, line).col_at(x);
+        pos = buffer_->line_start(line) + col;
+    }
+    if (frame_.mods & MOD_ALT) {
+        add_cursor(pos);
+    } else {
+        clear_cursors();
+        buffer_->set_cursor(pos);
     }
+    commit_edit();
 }
 
 // Function to save changed buffer
@@ -232,23 +1325,22 @@ void Editor::save() {
     if (file_.empty()) {
         // If not we change to a renaming state
         state_ = EditingState::Renaming;
+        damage_.header = true;
         return;
     }
 
-    // We then make sure the buffer is not empty
-    if (buffer_.empty()) {
-        // If it's empty we return out
-        return;
-    }
-
-    // We then create an output file stream with our file data
-    std::ofstream out(file_);
-    // If the object was not created we return out
-    if (!out) {
+    // Saving a half loaded file would cut it short, so we wait
+    if (loader_) {
+        save_after_load_ = true;
+        status_ = "will save once loaded";
+        damage_.header = true;
         return;
     }
 
-    // We copy the written contents into a new string and write out
-    const std::string new_contents = buffer_.str();
-    out.write(new_contents.data(), (std::streamsize)new_contents.size());
+    // We hand a snapshot to the save worker, for the piece table this is a
+    // list of views so the render thread never copies or writes the file
+    // An empty buffer is saved too, emptying a file is a legitimate edit
+    saver_.submit(file_, buffer_->snapshot());
+    status_ = "saving...";
+    damage_.header = true;
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "../include/file_loader.hpp"
+#include "../include/newline_scan.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+// The first chunk is small so there is something to draw right away, after
+// that we go big so the per chunk overhead disappears
+static constexpr std::size_t FIRST_CHUNK = 256 * 1024;
+static constexpr std::size_t CHUNK = 8 * 1024 * 1024;
+
+// Helper to find where chunk k of the file starts
+static std::size_t chunk_start(std::size_t k) {
+    return k == 0 ? 0 : FIRST_CHUNK + (k - 1) * CHUNK;
+}
+
+// FileLoader constructor - the workers start after every member is ready
+// There is no point in more workers than chunks
+FileLoader::FileLoader(std::shared_ptr<const MappedFile> file,
+                       PieceTable &table)
+    : file_(std::move(file)), table_(table),
+      start_(std::chrono::steady_clock::now()) {
+    std::size_t size = file_->size();
+    std::size_t count =
+        size <= FIRST_CHUNK ? 1 : 2 + (size - FIRST_CHUNK - 1) / CHUNK;
+    chunks_.resize(count);
+    std::size_t workers = std::min<std::size_t>(
+        count, std::max(1u, std::thread::hardware_concurrency()));
+    threads_.reserve(workers);
+    for (std::size_t i = 0; i < workers; ++i) {
+        threads_.emplace_back(&FileLoader::run, this);
+    }
+}
+
+// Destructor - we stop the workers between chunks and wait for them
+FileLoader::~FileLoader() {
+    stop_ = true;
+    for (std::thread &thread : threads_) {
+        thread.join();
+    }
+}
+
+// Method to reveal every chunk that follows the ones revealed so far, this
+// runs on the render thread so the table never needs a lock
+std::size_t FileLoader::pump() {
+    ProfileScope scope("loader pump");
+    std::size_t bytes = 0;
+    for (;;) {
+        Chunk chunk;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (next_reveal_ == chunks_.size() ||
+                !chunks_[next_reveal_].ready) {
+                break;
+            }
+            chunk = std::move(chunks_[next_reveal_++]);
+        }
+        table_.reveal(chunk.size, chunk.newlines);
+        bytes += chunk.size;
+    }
+    revealed_ += bytes;
+    return bytes;
+}
+
+bool FileLoader::done() const noexcept { return revealed_ >= file_->size(); }
+
+float FileLoader::progress() const noexcept {
+    return file_->size() ? static_cast<float>(revealed_) / file_->size()
+                         : 1.0f;
+}
+
+double FileLoader::elapsed_ms() const noexcept {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+}
+
+// A worker's loop, we take the next chunk nobody has, scan it and file it
+// in its slot
+// Reading the chunk is what faults its pages in, so by the time it is drawn
+// it is already in memory
+void FileLoader::run() {
+    std::string_view text = file_->view();
+    while (!stop_) {
+        std::size_t k = next_++;
+        if (k >= chunks_.size()) {
+            return;
+        }
+        std::size_t pos = chunk_start(k);
+        std::size_t n =
+            std::min(k == 0 ? FIRST_CHUNK : CHUNK, text.size() - pos);
+        std::vector<std::size_t> newlines;
+        scan_newlines(text.substr(pos, n), 0, newlines);
+        std::lock_guard<std::mutex> lock(mutex_);
+        chunks_[k].size = n;
+        chunks_[k].newlines = std::move(newlines);
+        chunks_[k].ready = true;
+    }
+}
+
+// Helper function to load a file into a storage engine
+// The file is memory mapped so nothing is read up front, the gap buffer copies
+// the mapping once while the piece table reads it in place as its original
+// The piece table is used for huge files, so when streaming it does not scan
+// the file here, a loader streams it in on worker threads while the window is
+// already up
+// A replay waits for the whole file instead, keys only land in the same place
+// if the document looks the same as when they were recorded, so the table
+// indexes it up front on every core
+Loaded load_file(const std::filesystem::path &path,
+                 const std::string &storage_name, bool stream) {
+    auto start = std::chrono::steady_clock::now();
+    auto mapping = std::make_shared<MappedFile>();
+    if (!path.empty() && !mapping->open(path)) {
+        std::cerr << "File could not be opened." << std::endl;
+    }
+
+    // We pick the storage engine, auto decides by the size of the file
+    StorageKind storage = pick_storage(mapping->size());
+    if (storage_name == "gap") {
+        storage = StorageKind::Gap;
+    } else if (storage_name == "piece") {
+        storage = StorageKind::Piece;
+    } else if (storage_name != "auto") {
+        std::cerr << "Unknown storage engine: " << storage_name << std::endl;
+        return {};
+    }
+
+    if (storage == StorageKind::Piece && mapping->size() > 0 && stream) {
+        auto table =
+            std::make_unique<PieceTable>(mapping->view(), mapping, true);
+        auto loader = std::make_unique<FileLoader>(mapping, *table);
+        std::cout << "Streaming " << path.string() << " (" << mapping->size()
+                  << " bytes, piece table)" << std::endl;
+        return {std::move(table), std::move(loader), mapping};
+    }
+
+    std::unique_ptr<TextStorage> buffer =
+        make_storage(storage, mapping->view(), mapping);
+
+    // We report how long it took so slow loads are easy to spot
+    auto ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    if (!path.empty()) {
+        std::cout << "Loaded " << path.string() << " (" << mapping->size()
+                  << " bytes, "
+                  << (storage == StorageKind::Piece ? "piece table"
+                                                    : "gap buffer")
+                  << ") in " << ms << " ms" << std::endl;
+    }
+    // The gap buffer copied the mapping, the piece table reads it in place
+    return {std::move(buffer), nullptr,
+            storage == StorageKind::Piece ? mapping : nullptr};
+}
@@ -0,0 +1,43 @@
+#include "../include/file_stamp.hpp"
+
+#include <sys/stat.h>
+
+// Helper to pull the stamp out of what stat found
+static FileStamp from_stat(const struct stat &st) {
+#ifdef __APPLE__
+    const struct timespec &t = st.st_mtimespec;
+#else
+    const struct timespec &t = st.st_mtim;
+#endif
+    return {static_cast<std::uint64_t>(st.st_dev),
+            static_cast<std::uint64_t>(st.st_ino),
+            static_cast<std::uint64_t>(st.st_size),
+            static_cast<std::int64_t>(t.tv_sec) * 1'000'000'000 + t.tv_nsec};
+}
+
+bool FileStamp::operator==(const FileStamp &other) const noexcept {
+    return dev == other.dev && ino == other.ino && size == other.size &&
+           mtime_ns == other.mtime_ns;
+}
+
+bool FileStamp::operator!=(const FileStamp &other) const noexcept {
+    return !(*this == other);
+}
+
+bool stamp_fd(int fd, FileStamp &out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    out = from_stat(st);
+    return true;
+}
+
+bool stamp_path(const std::filesystem::path &path, FileStamp &out) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    out = from_stat(st);
+    return true;
+}
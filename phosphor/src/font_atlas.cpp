@@ -0,0 +1,483 @@
+#include "../include/font_atlas.hpp"
+#include "../include/cache_dir.hpp"
+#include "../include/hash.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <system_error>
+
+#include <unistd.h>
+
+// Every cache file starts with this, the last character is the format
+static constexpr char MAGIC[8] = {'P', 'H', 'A', 'T', 'L', 'A', 'S', '1'};
+
+// The atlas starts this tall and doubles when it fills up
+static constexpr int FIRST_ATLAS_HEIGHT = 256;
+
+// What the cache file holds before its glyphs and pixels
+struct CacheHeader {
+    char magic[8];
+    std::int64_t mtime;
+    std::uint64_t size;
+    std::int32_t base_size;
+    std::int32_t padding;
+    std::int32_t width;
+    std::int32_t height;
+    std::int32_t pen_x;
+    std::int32_t pen_y;
+    std::int32_t shelf_height;
+    std::uint32_t glyphs;
+};
+
+// One glyph as the cache file stores it
+struct CacheGlyph {
+    std::int32_t codepoint;
+    std::int32_t offset_x;
+    std::int32_t offset_y;
+    std::int32_t advance_x;
+    float x;
+    float y;
+    float w;
+    float h;
+    std::int32_t missing;
+};
+
+// Helper to read what the cache is keyed on, the font's mtime and size
+static bool font_stamp(const std::filesystem::path &ttf, std::int64_t &mtime,
+                       std::uint64_t &size) {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(ttf, ec);
+    if (ec) {
+        return false;
+    }
+    size = std::filesystem::file_size(ttf, ec);
+    mtime = static_cast<std::int64_t>(time.time_since_epoch().count());
+    return !ec;
+}
+
+GlyphAtlas::~GlyphAtlas() {
+    if (dirty_) {
+        write_cache();
+    }
+    if (texture_.id != 0) {
+        UnloadTexture(texture_);
+    }
+}
+
+// Method to load a font, from the cache if it matches the font file
+bool GlyphAtlas::load(const std::filesystem::path &ttf, int base_size) {
+    ttf_path_ = ttf;
+    base_size_ = base_size;
+    ascii_.fill(-1);
+    if (read_cache()) {
+        from_cache_ = true;
+        upload();
+        fallback_ = static_cast<std::size_t>(std::max(ascii_['?'], 0));
+        return true;
+    }
+
+    // Otherwise we rasterize printable ASCII in one go like LoadFont does
+    std::ifstream in(ttf, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open font " << ttf.string() << std::endl;
+        return false;
+    }
+    ttf_.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>{});
+    width_ = ATLAS_WIDTH;
+    height_ = FIRST_ATLAS_HEIGHT;
+    pixels_.assign(static_cast<std::size_t>(width_) * height_ * 2, 0);
+    std::vector<int> ascii;
+    for (int c = 32; c < 127; ++c) {
+        ascii.push_back(c);
+    }
+    int count = static_cast<int>(ascii.size());
+    GlyphInfo *info =
+        LoadFontData(ttf_.data(), static_cast<int>(ttf_.size()), base_size_,
+                     ascii.data(), count, FONT_DEFAULT);
+    if (!info) {
+        std::cerr << "Could not read font " << ttf.string() << std::endl;
+        return false;
+    }
+    for (std::size_t i = 0; i < ascii.size(); ++i) {
+        add(ascii[i], info[i]);
+    }
+    UnloadFontData(info, count);
+    fallback_ = static_cast<std::size_t>(std::max(ascii_['?'], 0));
+    upload();
+    dirty_ = true;
+    write_cache();
+    return true;
+}
+
+int GlyphAtlas::base_size() const noexcept { return base_size_; }
+
+bool GlyphAtlas::from_cache() const noexcept { return from_cache_; }
+
+// Method to look a glyph up, anything we have not seen yet is rasterized
+const Glyph &GlyphAtlas::glyph(int codepoint) {
+    static const Glyph NONE{};
+    int i = -1;
+    if (codepoint >= 0 && codepoint < 128) {
+        i = ascii_[codepoint];
+    } else if (auto it = index_.find(codepoint); it != index_.end()) {
+        i = static_cast<int>(it->second);
+    }
+    if (i < 0) {
+        i = static_cast<int>(rasterize(codepoint));
+    }
+    if (glyphs_.empty()) {
+        return NONE;
+    }
+    const Glyph &g = glyphs_[i];
+    return g.missing ? glyphs_[fallback_] : g;
+}
+
+// Method to return how far the pen moves after a character
+float GlyphAtlas::advance(int codepoint, float size, float spacing) {
+    const Glyph &g = glyph(codepoint);
+    float adv = g.advance_x != 0 ? g.advance_x : g.rec.width;
+    return base_size_ > 0 ? adv * size / base_size_ + spacing : spacing;
+}
+
+// Method to draw a single glyph with its top left corner at pos
+// The source rectangle takes the padding around the glyph along, exactly
+// like DrawTextCodepoint, so text looks the same as it did with LoadFont
+void GlyphAtlas::draw_codepoint(int codepoint, Vector2 pos, float size,
+                                Color tint) {
+    const Glyph &g = glyph(codepoint);
+    if (g.rec.width == 0.0f || base_size_ == 0) {
+        return;
+    }
+    float scale = size / base_size_;
+    const float pad = static_cast<float>(PADDING);
+    Rectangle src{g.rec.x - pad, g.rec.y - pad, g.rec.width + 2.0f * pad,
+                  g.rec.height + 2.0f * pad};
+    Rectangle dst{pos.x + (g.offset_x - pad) * scale,
+                  pos.y + (g.offset_y - pad) * scale, src.width * scale,
+                  src.height * scale};
+    DrawTexturePro(texture_, src, dst, {0.0f, 0.0f}, 0.0f, tint);
+}
+
+// Method to draw a UTF-8 string, newlines start a new row like DrawTextEx
+void GlyphAtlas::draw_text(const char *text, Vector2 pos, float size,
+                           float spacing, Color tint) {
+    Vector2 pen = pos;
+    for (std::size_t i = 0; text[i] != '\0';) {
+        int bytes = 1;
+        int cp = GetCodepointNext(text + i, &bytes);
+        i += std::max(bytes, 1);
+        if (cp == '\n') {
+            pen.x = pos.x;
+            pen.y += size + 2.0f;
+            continue;
+        }
+        if (cp != ' ' && cp != '\t') {
+            draw_codepoint(cp, pen, size, tint);
+        }
+        pen.x += advance(cp, size, spacing);
+    }
+}
+
+// Helper method to rasterize a glyph we have not seen before and add it to
+// the atlas and the texture
+std::size_t GlyphAtlas::rasterize(int codepoint) {
+    ProfileScope scope("rasterize glyph");
+    // The first new glyph after a cached start is the first time we need
+    // the font file at all
+    if (ttf_.empty()) {
+        std::ifstream in(ttf_path_, std::ios::binary);
+        ttf_.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>{});
+    }
+    GlyphInfo *info = nullptr;
+    if (!ttf_.empty()) {
+        info = LoadFontData(ttf_.data(), static_cast<int>(ttf_.size()),
+                            base_size_, &codepoint, 1, FONT_DEFAULT);
+    }
+    dirty_ = true;
+    if (!info) {
+        return add(codepoint, GlyphInfo{});
+    }
+    std::size_t i = add(codepoint, *info);
+    UnloadFontData(info, 1);
+
+    // If the atlas grew the old texture is gone and we upload it all,
+    // otherwise only the new glyph's pixels go to the GPU
+    const Rectangle &rec = glyphs_[i].rec;
+    if (!IsWindowReady()) {
+        return i;
+    }
+    if (texture_.id == 0) {
+        upload();
+    } else if (rec.width > 0.0f) {
+        int x = static_cast<int>(rec.x);
+        int y = static_cast<int>(rec.y);
+        int w = static_cast<int>(rec.width);
+        int h = static_cast<int>(rec.height);
+        std::vector<unsigned char> patch(static_cast<std::size_t>(w) * h * 2);
+        for (int row = 0; row < h; ++row) {
+            std::memcpy(patch.data() + static_cast<std::size_t>(row) * w * 2,
+                        pixels_.data() +
+                            (static_cast<std::size_t>(y + row) * width_ + x) *
+                                2,
+                        static_cast<std::size_t>(w) * 2);
+        }
+        UpdateTextureRec(texture_, rec, patch.data());
+    }
+    return i;
+}
+
+// Helper method to add a rasterized glyph, its bitmap is packed into the
+// atlas pixels and the glyph is indexed by code point
+// A code point the font does not have comes back with no bitmap and no
+// advance, we remember it as missing so we never ask the font again
+std::size_t GlyphAtlas::add(int codepoint, const GlyphInfo &info) {
+    Glyph g;
+    g.offset_x = info.offsetX;
+    g.offset_y = info.offsetY;
+    g.advance_x = info.advanceX;
+    g.missing = info.image.data == nullptr && info.advanceX == 0 &&
+                codepoint != ' ';
+    // Spaces are never drawn so they need no room in the atlas
+    int w = info.image.width;
+    int h = info.image.height;
+    int x = 0;
+    int y = 0;
+    if (info.image.data && codepoint != ' ' && w > 0 && h > 0) {
+        if (place(w, h, x, y)) {
+            const auto *src =
+                static_cast<const unsigned char *>(info.image.data);
+            for (int row = 0; row < h; ++row) {
+                for (int col = 0; col < w; ++col) {
+                    std::size_t at =
+                        (static_cast<std::size_t>(y + row) * width_ + x + col) *
+                        2;
+                    pixels_[at] = 255;
+                    pixels_[at + 1] = src[row * w + col];
+                }
+            }
+            g.rec = {static_cast<float>(x), static_cast<float>(y),
+                     static_cast<float>(w), static_cast<float>(h)};
+        } else {
+            // The atlas is as big as we let it get
+            g.missing = true;
+        }
+    }
+    std::size_t i = glyphs_.size();
+    glyphs_.push_back(g);
+    codepoints_.push_back(codepoint);
+    if (codepoint >= 0 && codepoint < 128) {
+        ascii_[codepoint] = static_cast<int>(i);
+    } else {
+        index_[codepoint] = i;
+    }
+    return i;
+}
+
+// Helper method to find room for a w by h bitmap plus padding on the shelves
+// When the atlas is full it doubles in height, the rows it already has do
+// not move so no glyph has to be placed again
+bool GlyphAtlas::place(int w, int h, int &x, int &y) {
+    int cw = w + 2 * PADDING;
+    int ch = h + 2 * PADDING;
+    if (cw > width_) {
+        return false;
+    }
+    if (pen_x_ + cw > width_) {
+        pen_y_ += shelf_height_;
+        pen_x_ = 0;
+        shelf_height_ = 0;
+    }
+    while (pen_y_ + ch > height_) {
+        if (height_ * 2 > MAX_ATLAS_HEIGHT) {
+            return false;
+        }
+        height_ *= 2;
+        pixels_.resize(static_cast<std::size_t>(width_) * height_ * 2, 0);
+        if (texture_.id != 0) {
+            UnloadTexture(texture_);
+            texture_ = {};
+        }
+    }
+    x = pen_x_ + PADDING;
+    y = pen_y_ + PADDING;
+    pen_x_ += cw;
+    shelf_height_ = std::max(shelf_height_, ch);
+    return true;
+}
+
+// Helper method to upload the whole atlas as a new texture
+void GlyphAtlas::upload() {
+    if (texture_.id != 0) {
+        UnloadTexture(texture_);
+        texture_ = {};
+    }
+    // Without a window there is no graphics context to upload to
+    if (pixels_.empty() || !IsWindowReady()) {
+        return;
+    }
+    Image image{pixels_.data(), width_, height_, 1,
+                PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA};
+    texture_ = LoadTextureFromImage(image);
+}
+
+// Helper to check that a cached glyph's bitmap and the padding around it
+// lie inside the atlas, a glyph with no bitmap has an empty rectangle
+static bool fits(const CacheGlyph &c, int width, int height, int padding) {
+    if (c.w == 0.0f && c.h == 0.0f) {
+        return true;
+    }
+    // Written this way round so a NaN fails every test
+    return c.w > 0.0f && c.h > 0.0f && c.x >= padding && c.y >= padding &&
+           c.x + c.w + padding <= width && c.y + c.h + padding <= height;
+}
+
+// Helper method to read the atlas back from the cache, any mismatch with the
+// font file, a file of the wrong size or a glyph outside the atlas means we
+// rasterize from scratch
+bool GlyphAtlas::read_cache() {
+    std::int64_t mtime = 0;
+    std::uint64_t size = 0;
+    if (!font_stamp(ttf_path_, mtime, size)) {
+        return false;
+    }
+    std::filesystem::path path = cache_path();
+    std::error_code ec;
+    std::uintmax_t file_size = std::filesystem::file_size(path, ec);
+    std::ifstream in(path, std::ios::binary);
+    CacheHeader head{};
+    if (ec || !in || !in.read(reinterpret_cast<char *>(&head), sizeof(head)) ||
+        std::memcmp(head.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        head.mtime != mtime || head.size != size ||
+        head.base_size != base_size_ || head.padding != PADDING ||
+        head.width != ATLAS_WIDTH || head.height <= 0 ||
+        head.height > MAX_ATLAS_HEIGHT) {
+        return false;
+    }
+    // The glyph count is only trusted once the file is exactly as big as
+    // the header says, so a corrupt count never turns into a huge allocation
+    std::size_t pixel_bytes =
+        static_cast<std::size_t>(head.width) * head.height * 2;
+    if (file_size < sizeof(head) + pixel_bytes ||
+        (file_size - sizeof(head) - pixel_bytes) / sizeof(CacheGlyph) !=
+            head.glyphs ||
+        (file_size - sizeof(head) - pixel_bytes) % sizeof(CacheGlyph) != 0) {
+        return false;
+    }
+    // The packer resumes where it stopped, so it has to be inside the atlas
+    if (head.pen_x < 0 || head.pen_x > head.width || head.pen_y < 0 ||
+        head.shelf_height < 0 ||
+        head.pen_y + head.shelf_height > head.height) {
+        return false;
+    }
+    std::vector<CacheGlyph> glyphs(head.glyphs);
+    std::vector<unsigned char> pixels(pixel_bytes);
+    in.read(reinterpret_cast<char *>(glyphs.data()),
+            static_cast<std::streamsize>(glyphs.size() * sizeof(CacheGlyph)));
+    in.read(reinterpret_cast<char *>(pixels.data()),
+            static_cast<std::streamsize>(pixels.size()));
+    if (!in) {
+        return false;
+    }
+    // Every glyph is drawn straight from its rectangle, and '?' stands in
+    // for the missing ones
+    bool has_fallback = false;
+    for (const CacheGlyph &c : glyphs) {
+        if (!fits(c, head.width, head.height, PADDING)) {
+            return false;
+        }
+        has_fallback = has_fallback || c.codepoint == '?';
+    }
+    if (!has_fallback) {
+        return false;
+    }
+    width_ = head.width;
+    height_ = head.height;
+    pen_x_ = head.pen_x;
+    pen_y_ = head.pen_y;
+    shelf_height_ = head.shelf_height;
+    pixels_ = std::move(pixels);
+    for (const CacheGlyph &c : glyphs) {
+        Glyph g;
+        g.offset_x = c.offset_x;
+        g.offset_y = c.offset_y;
+        g.advance_x = c.advance_x;
+        g.rec = {c.x, c.y, c.w, c.h};
+        g.missing = c.missing != 0;
+        std::size_t i = glyphs_.size();
+        glyphs_.push_back(g);
+        codepoints_.push_back(c.codepoint);
+        if (c.codepoint >= 0 && c.codepoint < 128) {
+            ascii_[c.codepoint] = static_cast<int>(i);
+        } else {
+            index_[c.codepoint] = i;
+        }
+    }
+    return true;
+}
+
+// Helper method to write the atlas to the cache, written to a temporary file
+// and renamed into place so another editor never reads half of it
+void GlyphAtlas::write_cache() const {
+    CacheHeader head{};
+    std::memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    std::error_code ec;
+    std::filesystem::path target = cache_path();
+    if (glyphs_.empty() || !font_stamp(ttf_path_, head.mtime, head.size) ||
+        (std::filesystem::create_directories(target.parent_path(), ec), ec)) {
+        return;
+    }
+    head.base_size = base_size_;
+    head.padding = PADDING;
+    head.width = width_;
+    head.height = height_;
+    head.pen_x = pen_x_;
+    head.pen_y = pen_y_;
+    head.shelf_height = shelf_height_;
+    head.glyphs = static_cast<std::uint32_t>(glyphs_.size());
+    std::vector<CacheGlyph> glyphs(glyphs_.size());
+    for (std::size_t i = 0; i < glyphs_.size(); ++i) {
+        const Glyph &g = glyphs_[i];
+        glyphs[i] = {codepoints_[i], g.offset_x,    g.offset_y,
+                     g.advance_x,    g.rec.x,       g.rec.y,
+                     g.rec.width,    g.rec.height,  g.missing ? 1 : 0};
+    }
+
+    std::filesystem::path tmp = target;
+    tmp += "." + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+        out.write(reinterpret_cast<const char *>(glyphs.data()),
+                  static_cast<std::streamsize>(glyphs.size() *
+                                               sizeof(CacheGlyph)));
+        out.write(reinterpret_cast<const char *>(pixels_.data()),
+                  static_cast<std::streamsize>(pixels_.size()));
+        if (!out.flush()) {
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp, target, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+    }
+}
+
+// Helper method to name the cache file after the font's absolute path and
+// the base size, hashed with FNV-1a so every build finds the same file
+std::filesystem::path GlyphAtlas::cache_path() const {
+    std::error_code ec;
+    std::filesystem::path abs = std::filesystem::absolute(ttf_path_, ec);
+    std::string key = (ec ? ttf_path_ : abs).lexically_normal().string();
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx-%d.atlas",
+                  static_cast<unsigned long long>(fnv1a(key)), base_size_);
+    return cache_dir("fonts") / name;
+}
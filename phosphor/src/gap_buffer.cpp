@@ -1,30 +1,45 @@
 #include "../include/gap_buffer.hpp"
+#include "../include/profiler.hpp"
 
 GapBuffer::GapBuffer(size_t start_capacity)
     // We initialize our buffer with the starting capacity and fill it with null
     // characters
     // We also set the start of the gap and end of the gap
     : buf_(std::max<size_t>(start_capacity, 1), '\0'), gap_begin_(0),
-      gap_end_(buf_.size()) {}
+      gap_end_(buf_.size()) {
+    // An empty buffer still has a single empty line
+    lines_.build({});
+}
 
-GapBuffer::GapBuffer(const std::string &start_string)
+GapBuffer::GapBuffer(std::string_view start_string) {
     /*
-     * We initialize our buffer with the size of the string * 2 and plus 16 more
-     * chars If we pass in "hello" we then get 5 * 2 + 16, so that gives us a 27
-     * char sized buffer with 5 characters on the left and 21 unused chars in
+     * We initialize our buffer with the size of the string plus an eighth of
+     * it again (and at least 64 chars) for the gap
+     * If we pass in "hello" we then get 5 + 64, so that gives us a 69 char
+     * sized buffer with 5 characters on the left and 64 unused chars in
      * our gap with no characters on the right side of the gap
      *          'h' 'e' 'l' 'l''o' -------THIS IS THE GAP----------
+     * We used to double the size here, but on large files that is a whole
+     * extra copy of the document sitting idle, ensure_gap grows it on demand
      */
-    : buf_(std::max<size_t>(start_string.size() * 2 + 16, 1), '\0') {
-    // We place the data at the start of the buffer using memcpy
-    // void* memcpy(void* destination, const void* src, std::size_t num_bytes);
-    std::memcpy(buf_.data(), start_string.data(), start_string.size());
+    size_t cap =
+        start_string.size() + std::max<size_t>(start_string.size() / 8, 64);
+    // We reserve first and copy the text in so only the gap gets zero filled
+    buf_.reserve(cap);
+    buf_.assign(start_string.begin(), start_string.end());
+    buf_.resize(cap, '\0');
     // We then set the start of the gap to the size of the string
     gap_begin_ = start_string.size();
     // The gap size is equal to the entire buffer
     gap_end_ = buf_.size();
+    // We index the starting text once, every edit after this keeps the index
+    // up to date incrementally
+    lines_.build(start_string);
 }
 
+// The gap buffer identifies itself so callers can report which engine is live
+StorageKind GapBuffer::kind() const noexcept { return StorageKind::Gap; }
+
 // Basic helper to get the cursor position at the start of the gap
 size_t GapBuffer::cursor() const noexcept { return gap_begin_; }
 
@@ -38,40 +53,9 @@ void GapBuffer::set_cursor(size_t pos) {
     move_gap_to(pos);
 }
 
-// Method to move the cursor
-void GapBuffer::move_cursor(long long delta) {
-    // We get our cursors position
-    long long pos = static_cast<long long>(cursor());
-    // We get the limit of our buffer
-    long long limit = static_cast<long long>(size());
-    // We clamp the pos + delta and our lower bound is 0 and upper bound is
-    // the size of the buffer this prevent us from going out of bounds
-    long long new_pos = std::clamp(pos + delta, 0LL, limit);
-    set_cursor(static_cast<size_t>(new_pos));
-}
-
 // Method to return the size of the buffer contents
 size_t GapBuffer::size() const noexcept { return buf_.size() - gap_size(); }
 
-// Method to test if the container is empty
-bool GapBuffer::empty() const noexcept { return size() == 0; }
-
-// Method to convert the contents to a string
-std::string GapBuffer::str() const {
-    // We forward declare the out string
-    std::string out;
-    // We reserve enough space given the size of contents
-    out.reserve(size());
-    // We then append the contents, we pass in a pointer to the data
-    // and the beginning of the gap as the size of the substring we want
-    out.append(buf_.data(), gap_begin_);
-    // We then append the rest of the contents, we need to pass in a pointer
-    // to the underlying data and do some pointer arithmetic to get the end of
-    // the gap and substring out the contents after the gap
-    out.append(buf_.data() + gap_end_, buf_.size() - gap_end_);
-    return out;
-}
-
 // Function to return a C-string for compatability with C APIs
 const char *GapBuffer::c_str() const {
     // We need to ensure the previously cached string is valid
@@ -83,26 +67,87 @@ const char *GapBuffer::c_str() const {
     return cached_str_.c_str();
 }
 
+// Method to copy out part of the contents without flattening the whole buffer
+std::string GapBuffer::substr(size_t pos, size_t len) const {
+    return range(pos, len).str();
+}
+
+// Method to return the whole contents as the two pieces around the gap
+TextRange GapBuffer::segments() const noexcept {
+    return {std::string_view(buf_.data(), gap_begin_),
+            std::string_view(buf_.data() + gap_end_, right_len())};
+}
+
+// Method to view part of the contents without copying it
+TextRange GapBuffer::range(size_t pos, size_t len) const noexcept {
+    // We clamp the range to the contents
+    pos = std::min(pos, size());
+    len = std::min(len, size() - pos);
+    TextRange out;
+    // Part of the range can sit before the gap
+    if (pos < gap_begin_) {
+        size_t n = std::min(len, gap_begin_ - pos);
+        out.first = std::string_view(buf_.data() + pos, n);
+        pos += n;
+        len -= n;
+    }
+    // The rest sits after the gap so we skip over it
+    if (len) {
+        out.second = std::string_view(buf_.data() + gap_size() + pos, len);
+    }
+    return out;
+}
+
+// Method to view a single line without its newline
+TextRange GapBuffer::line(size_t n) const {
+    return range(lines_.line_start(n), lines_.line_length(n));
+}
+
+// Method to iterate over the lines in [first, last)
+GapBuffer::LineSpan GapBuffer::line_span(size_t first, size_t last) const {
+    last = std::min(last, lines_.line_count());
+    first = std::min(first, last);
+    return {LineIterator(this, first), LineIterator(this, last)};
+}
+
+// Dereferencing a line iterator simply views its current line
+TextRange GapBuffer::LineIterator::operator*() const {
+    return buf_->line(line_);
+}
+
 // Method to insert a single character
 void GapBuffer::insert(char c) {
     // We need to make sure we have room for at least one char
     ensure_gap(1);
     // We then append the character and increment the start of the gap forward
     buf_[gap_begin_++] = c;
+    ++stats_.bytes_inserted;
+    // We record the character in the line index
+    lines_.insert(&c, 1);
     // Since an edit was made we must rebuild the cached string
     cache_valid_ = false;
 }
 
 // Method to insert entire strings
-void GapBuffer::insert(std::string str) {
-    // This is just a wrapper of the single char method
-    // We loop over each character and insert one by one
-    // Not the most efficient but it'll for for now
-    for (char c : str) {
-        insert(c);
+void GapBuffer::insert(std::string_view str) {
+    if (str.empty()) {
+        return;
     }
+    // We make room for the whole string at once so a large paste grows the
+    // buffer at most one time
+    ensure_gap(str.size());
+    // We can then copy it straight into the gap
+    std::memcpy(buf_.data() + gap_begin_, str.data(), str.size());
+    gap_begin_ += str.size();
+    stats_.bytes_inserted += str.size();
+    // The line index only scans the new bytes, once
+    lines_.insert(str.data(), str.size());
+    cache_valid_ = false;
 }
 
+// Method to make sure the next n inserted bytes fit without growing
+void GapBuffer::reserve(size_t n) { ensure_gap(n); }
+
 void GapBuffer::erase_back(size_t num_chars) {
     // We get the left left and do a small calculation to see
     // how much to delete
@@ -110,9 +155,95 @@ void GapBuffer::erase_back(size_t num_chars) {
     size_t to_del = std::min(num_chars, left);
     // We grow the gap into the left block to delete
     gap_begin_ -= to_del;
+    lines_.erase_back(to_del);
     cache_valid_ = false;
 }
 
+// Method to replace every match in place, in a single pass
+void GapBuffer::replace_matches(const std::vector<size_t> &at, size_t len,
+                                std::string_view with) {
+    sweep(at.size(), [&](size_t i) { return Splice{at[i], len, with}; });
+}
+
+// Method to apply a batch of edits in a single pass
+void GapBuffer::splice(const std::vector<Splice> &edits) {
+    sweep(edits.size(), [&](size_t i) { return edits[i]; });
+}
+
+// Helper method to apply n sorted edits, edit(i) hands out the i-th one
+// We park the gap on the first edit and sweep it to the right, each step
+// moves the kept bytes before the next edit down to the front of the gap,
+// writes the new text there and lets the gap swallow the old bytes
+// The gap only ever moves forwards, so text after the first edit moves at
+// most once however many edits there are, and nothing is reallocated unless
+// the edits grow the text, in which case we grow the gap once up front
+// The line index follows the gap the same way, so it only looks at the lines
+// we sweep over and the new text
+template <typename Edit> void GapBuffer::sweep(size_t n, const Edit &edit) {
+    if (n == 0) {
+        return;
+    }
+    // While the gap is at least the growth still to come, writing new text
+    // never runs into bytes we have not moved yet
+    size_t growth = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Splice e = edit(i);
+        growth += e.text.size() > e.len ? e.text.size() - e.len : 0;
+    }
+    ensure_gap(growth);
+    move_gap_to(edit(0).pos);
+    // read is the buffer index of document offset pos, from before the edits
+    size_t pos = edit(0).pos;
+    size_t read = gap_end_;
+    for (size_t i = 0; i < n; ++i) {
+        Splice e = edit(i);
+        size_t keep = e.pos - pos;
+        std::memmove(buf_.data() + gap_begin_, buf_.data() + read, keep);
+        gap_begin_ += keep;
+        read += keep + e.len;
+        // gap_begin_ is where the edit starts in the document as it is now
+        lines_.move_split(gap_begin_ + e.len);
+        lines_.erase_back(e.len);
+        if (!e.text.empty()) {
+            std::memcpy(buf_.data() + gap_begin_, e.text.data(),
+                        e.text.size());
+            gap_begin_ += e.text.size();
+            lines_.insert(e.text.data(), e.text.size());
+        }
+        pos = e.pos + e.len;
+        stats_.bytes_moved += keep;
+        stats_.bytes_inserted += e.text.size();
+    }
+    gap_end_ = read;
+    cache_valid_ = false;
+}
+
+// Method to hand the pieces of a range to a visitor, there are at most two
+void GapBuffer::for_each_chunk(size_t pos, size_t len,
+                               const ChunkFn &fn) const {
+    TextRange text = range(pos, len);
+    if (!text.first.empty() && !fn(text.first)) {
+        return;
+    }
+    if (!text.second.empty()) {
+        fn(text.second);
+    }
+}
+
+// Method to expose the line index for line aware operations
+const LineIndex &GapBuffer::lines() const noexcept { return lines_; }
+
+// The line queries simply forward to the line index
+size_t GapBuffer::line_count() const noexcept { return lines_.line_count(); }
+
+size_t GapBuffer::line_start(size_t line) const {
+    return lines_.line_start(line);
+}
+
+size_t GapBuffer::line_of(size_t offset) const {
+    return lines_.line_of(offset);
+}
+
 // Method to return the size of the gap in the buffer
 size_t GapBuffer::gap_size() const noexcept { return gap_end_ - gap_begin_; }
 
@@ -167,6 +298,9 @@ void GapBuffer::ensure_gap(size_t want) {
                     right);
     }
 
+    ++stats_.grows;
+    stats_.bytes_grown += left + right;
+
     // We use the swap member method to transfer over contents from the new
     // buffer to the member variable
     buf_.swap(new_buf);
@@ -189,6 +323,7 @@ void GapBuffer::move_gap_to(size_t pos) {
         // Destination starts at gap_end_ - count
         std::memmove(buf_.data() + (gap_end_ - count), buf_.data() + pos,
                      count);
+        stats_.bytes_moved += count;
         gap_begin_ = pos;
         gap_end_ -= count;
     } else {
@@ -196,24 +331,34 @@ void GapBuffer::move_gap_to(size_t pos) {
         // gap_begin_
         size_t count = pos - gap_begin_;
         std::memmove(buf_.data() + gap_begin_, buf_.data() + gap_end_, count);
+        stats_.bytes_moved += count;
         gap_begin_ += count;
         gap_end_ += count;
     }
+    ++stats_.gap_moves;
+    // The line index follows the gap so future edits stay at its split
+    lines_.move_split(pos);
     cache_valid_ = false;
 }
 
+// Method to read the benchmark counters
+const GapBuffer::Stats &GapBuffer::stats() const noexcept { return stats_; }
+
+void GapBuffer::reset_stats() noexcept { stats_ = Stats{}; }
+
+// Method to add up every byte the buffer copied or moved
+std::size_t GapBuffer::Stats::bytes_copied() const noexcept {
+    return bytes_moved + bytes_grown + bytes_inserted + bytes_cached;
+}
+
 // Helper method to cache the buffer contents into a string
+// Nothing on the editing or drawing path uses this anymore, it only exists for
+// C APIs that need a single null terminated string
 void GapBuffer::compute_cache() const {
-    // We empty the contents to start from scratch
-    cached_str_.clear();
-    // We reserve enough size given the size of the buffer
-    cached_str_.reserve(size());
-    // We then append the buffered contents to the left of the gap
-    cached_str_.append(buf_.data(), gap_begin_);
-    // We do the same for the right side of the gap
-    cached_str_.append(buf_.data() + gap_end_, buf_.size() - gap_end_);
-    // We have to null terminate the string
-    cached_str_.push_back('\0');
+    ProfileScope scope("compute_cache");
+    // We copy both segments into the cache, this reuses the old capacity
+    segments().copy_to(cached_str_);
+    stats_.bytes_cached += cached_str_.size();
     // Since our string is reconstructed this string is valid
     cache_valid_ = true;
 }
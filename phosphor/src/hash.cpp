@@ -0,0 +1,10 @@
+#include "../include/hash.hpp"
+
+// We mix in one byte at a time, which is all FNV-1a is
+std::uint64_t fnv1a(std::string_view text, std::uint64_t seed) noexcept {
+    std::uint64_t h = seed;
+    for (unsigned char c : text) {
+        h = (h ^ c) * 0x100000001b3ull;
+    }
+    return h;
+}
@@ -0,0 +1,271 @@
+#include "../include/highlighter.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+
+// Highlighter constructor - the thread starts after every member is ready
+Highlighter::Highlighter() : thread_(&Highlighter::run, this) {}
+
+// Destructor - we tell the worker to stop and wait for it
+Highlighter::~Highlighter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+// Method to pick the language, every line starts over as plain text
+void Highlighter::set_lexer(const Lexer *lexer) {
+    lexer_ = lexer;
+    ++generation_;
+    // The first line always starts in the default state
+    states_.assign(1, 0);
+    valid_ = 1;
+    clean_from_ = 0;
+    rows_.clear();
+}
+
+const Lexer *Highlighter::lexer() const noexcept { return lexer_; }
+
+// Method to report an edit
+// The states of the replaced lines go and the new lines get placeholders,
+// the states after them move along with their lines, they are still right
+// unless the edit changed what the lines before them leave open
+void Highlighter::invalidate(std::size_t first, std::size_t old_lines,
+                             std::size_t new_lines) {
+    if (!lexer_) {
+        return;
+    }
+    // States past valid_ are left from before earlier edits, only the ones
+    // past those edits and past what was lexed since then come from a single
+    // pass over lines that have not changed
+    std::size_t clean =
+        valid_ >= states_.size() ? 0 : std::max(clean_from_, valid_);
+    std::size_t moved =
+        clean > first + old_lines ? clean - old_lines + new_lines : 0;
+    clean_from_ = std::max(moved, first + new_lines + 1);
+    if (first + 1 < states_.size()) {
+        auto at = states_.begin() + static_cast<std::ptrdiff_t>(first + 1);
+        std::size_t gone = std::min(old_lines, states_.size() - first - 1);
+        at = states_.erase(at, at + static_cast<std::ptrdiff_t>(gone));
+        states_.insert(at, new_lines, 0);
+    }
+    valid_ = std::min(valid_, first + 1);
+    touched_ = std::min(touched_, first);
+    // The edited line keeps its old colors until it is lexed again, the
+    // lines after it keep theirs under their new numbers
+    std::unordered_map<std::size_t, Row> rows;
+    rows.reserve(rows_.size());
+    for (auto &[line, row] : rows_) {
+        if (line < first) {
+            rows.emplace(line, std::move(row));
+        } else if (line == first) {
+            row.stale = true;
+            rows.emplace(line, std::move(row));
+        } else if (line > first + old_lines) {
+            rows.emplace(line - old_lines + new_lines, std::move(row));
+        }
+    }
+    rows_.swap(rows);
+}
+
+// Method to report that lines from first on may have changed
+// We cannot tell which lines moved, so there is nothing to stop early on
+// and every line from first on is lexed again when it is shown
+void Highlighter::invalidate_from(std::size_t first) {
+    if (!lexer_) {
+        return;
+    }
+    states_.resize(std::min(states_.size(), first + 1));
+    valid_ = std::min(valid_, states_.size());
+    clean_from_ = states_.size();
+    touched_ = std::min(touched_, first);
+    for (auto &[line, row] : rows_) {
+        if (line >= first) {
+            row.stale = true;
+        }
+    }
+}
+
+// Method to collect what the worker finished and hand it the next batch
+bool Highlighter::pump(const TextStorage &buf, std::size_t top,
+                       std::size_t bottom, std::size_t &first,
+                       std::size_t &last) {
+    ProfileScope scope("highlight");
+    bool changed = false;
+    // A batch for a lexer we no longer use is collected and dropped
+    if (in_flight_) {
+        std::optional<Result> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done.swap(result_);
+        }
+        if (done) {
+            in_flight_ = false;
+            if (done->generation == generation_) {
+                changed = apply(buf, *done, first, last);
+            }
+        }
+    }
+    if (!lexer_) {
+        return false;
+    }
+    bottom = std::min(bottom, buf.line_count());
+    if (!in_flight_) {
+        issue(buf, top, bottom);
+    }
+    // Lines far off screen are lexed again if we ever scroll back to them
+    if (rows_.size() > MAX_ROWS) {
+        for (auto it = rows_.begin(); it != rows_.end();) {
+            it = it->first < top || it->first >= bottom ? rows_.erase(it)
+                                                        : std::next(it);
+        }
+    }
+    return changed;
+}
+
+bool Highlighter::busy() const noexcept { return in_flight_; }
+
+const std::vector<Span> *Highlighter::spans(std::size_t line) const {
+    auto it = rows_.find(line);
+    return it == rows_.end() ? nullptr : &it->second.spans;
+}
+
+std::uint64_t Highlighter::lexed_bytes() const noexcept {
+    return lexed_bytes_;
+}
+
+// Helper method the worker thread runs, it lexes one batch at a time
+void Highlighter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return stop_ || job_; });
+        if (stop_) {
+            return;
+        }
+        Job job = std::move(*job_);
+        job_.reset();
+        lock.unlock();
+        Result done = lex(job);
+        lock.lock();
+        result_ = std::move(done);
+    }
+}
+
+// Helper to lex a batch, this runs on the worker and only sees the copy
+Highlighter::Result Highlighter::lex(const Job &job) {
+    Result done{job.generation, job.first, {},
+                std::max(job.first, job.spans_from), {}};
+    done.states.reserve(job.lines);
+    LexState state = job.state;
+    std::vector<Span> spans;
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i < job.lines; ++i) {
+        std::size_t end = std::min(job.text.find('\n', pos), job.text.size());
+        std::string_view line(job.text.data() + pos,
+                              std::min(end - pos, MAX_LINE));
+        pos = end + 1;
+        spans.clear();
+        state = job.lexer->lex(line, state, spans);
+        done.states.push_back(state);
+        std::size_t at = job.first + i;
+        if (at >= job.spans_from && at < job.spans_to) {
+            done.spans.push_back(spans);
+        }
+    }
+    return done;
+}
+
+// Helper method to take in a finished batch
+// Lines edited while the worker ran may have moved, so we only keep what
+// came before the first of them
+bool Highlighter::apply(const TextStorage &buf, const Result &done,
+                        std::size_t &first, std::size_t &last) {
+    const std::size_t lines = buf.line_count();
+    for (std::size_t i = 0; i < done.states.size(); ++i) {
+        std::size_t line = done.first + i + 1;
+        if (line > touched_ || line >= lines) {
+            break;
+        }
+        LexState state = done.states[i];
+        if (line < states_.size()) {
+            // The line starts the way it did before the edit and nothing
+            // after it changed, so every state after it is right as well
+            if (line >= valid_ && line >= clean_from_ &&
+                states_[line] == state) {
+                valid_ = states_.size();
+                break;
+            }
+            if (states_[line] == state) {
+                valid_ = std::max(valid_, line + 1);
+                continue;
+            }
+            states_[line] = state;
+        } else {
+            states_.push_back(state);
+        }
+        valid_ = std::max(valid_, line + 1);
+        // A line that now starts in another state needs new colors, the
+        // ones on screen get them below and the rest when they are shown
+        if (auto it = rows_.find(line); it != rows_.end()) {
+            it->second.stale = true;
+        }
+    }
+    bool changed = false;
+    for (std::size_t i = 0; i < done.spans.size(); ++i) {
+        std::size_t line = done.spans_from + i;
+        if (line >= touched_ || line >= lines) {
+            break;
+        }
+        Row &row = rows_[line];
+        if (row.stale || row.spans != done.spans[i]) {
+            first = std::min(first, line);
+            last = std::max(last, line);
+            changed = true;
+        }
+        row.spans = done.spans[i];
+        row.stale = false;
+    }
+    return changed;
+}
+
+// Helper method to start lexing what the lines on screen are missing
+// We start at the first line on screen that was edited or never lexed, or
+// further up at the first line whose state is not known, and lex on to the
+// bottom of the screen or until the batch is full
+void Highlighter::issue(const TextStorage &buf, std::size_t top,
+                        std::size_t bottom) {
+    std::size_t need = NONE;
+    for (std::size_t line = top; line < bottom; ++line) {
+        auto it = rows_.find(line);
+        if (line >= valid_ || it == rows_.end() || it->second.stale) {
+            need = line;
+            break;
+        }
+    }
+    if (need == NONE) {
+        return;
+    }
+    // Only lines whose start state we know can be lexed
+    std::size_t first = std::min(need, valid_ - 1);
+    std::size_t from = buf.line_start(first);
+    std::size_t end = std::min(
+        bottom, std::max(buf.line_of(std::min(from + MAX_BATCH, buf.size())),
+                         first + 1));
+    std::size_t to = end < buf.line_count() ? buf.line_start(end) : buf.size();
+    Job job{generation_, lexer_, first, end - first, states_[first],
+            {},          top,    bottom};
+    // A single line longer than a batch is only lexed up to MAX_LINE
+    buf.copy(from, std::min(to - from, end == first + 1 ? MAX_LINE : to - from),
+             job.text);
+    lexed_bytes_ += job.text.size();
+    touched_ = NONE;
+    in_flight_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = std::move(job);
+    }
+    cv_.notify_one();
+}
@@ -0,0 +1,298 @@
+#include "../include/input.hpp"
+
+#include "../vendor/raylib.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+// Every trace starts with this, the last character is the format version
+static constexpr char MAGIC[8] = {'P', 'H', 'O', 'S', 'R', 'E', 'C', '1'};
+
+// What a recorded frame contains, an idle frame is just a zero byte
+enum FrameFlag : std::uint8_t {
+    FRAME_CHARS = 1 << 0,
+    FRAME_KEYS = 1 << 1,
+    FRAME_CLICK = 1 << 2,
+    FRAME_WHEEL = 1 << 3,
+    FRAME_RESIZED = 1 << 4,
+    FRAME_CLIPBOARD = 1 << 5,
+};
+
+// Helper to write an unsigned number in as few bytes as it needs, seven bits
+// at a time with the top bit set on every byte but the last
+static void put_varint(std::ofstream &out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out.put(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.put(static_cast<char>(v));
+}
+
+static void put_float(std::ofstream &out, float f) {
+    char bytes[sizeof(float)];
+    std::memcpy(bytes, &f, sizeof(float));
+    out.write(bytes, sizeof(float));
+}
+
+// Helper to read a varint back, returns false if the trace ends inside it
+static bool get_varint(const std::vector<std::uint8_t> &data, std::size_t &pos,
+                       std::uint64_t &v) {
+    v = 0;
+    for (int shift = 0; pos < data.size() && shift < 64; shift += 7) {
+        std::uint8_t b = data[pos++];
+        v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_float(const std::vector<std::uint8_t> &data, std::size_t &pos,
+                      float &f) {
+    if (data.size() - pos < sizeof(float)) {
+        return false;
+    }
+    std::memcpy(&f, data.data() + pos, sizeof(float));
+    pos += sizeof(float);
+    return true;
+}
+
+// Helper to read a list of code points or keys
+static bool get_list(const std::vector<std::uint8_t> &data, std::size_t &pos,
+                     std::vector<int> &out) {
+    std::uint64_t n = 0;
+    if (!get_varint(data, pos, n) || n > data.size() - pos) {
+        return false;
+    }
+    for (std::uint64_t i = 0; i < n; ++i) {
+        std::uint64_t v = 0;
+        if (!get_varint(data, pos, v)) {
+            return false;
+        }
+        out.push_back(static_cast<int>(v));
+    }
+    return true;
+}
+
+bool InputFrame::empty() const noexcept {
+    return chars.empty() && keys.empty() && !click && wheel_x == 0.0f &&
+           wheel_y == 0.0f && !resized;
+}
+
+// Method to check whether a key was pressed during the frame
+bool InputFrame::pressed(int key) const noexcept {
+    return std::find(keys.begin(), keys.end(), key) != keys.end();
+}
+
+// Method to reset the frame, the lists keep their capacity
+void InputFrame::clear() noexcept {
+    chars.clear();
+    keys.clear();
+    mods = MOD_NONE;
+    click = false;
+    wheel_x = wheel_y = 0.0f;
+    resized = false;
+}
+
+// Method to read everything raylib queued up since the last frame
+bool RaylibInput::poll(InputFrame &frame) {
+    frame.clear();
+    for (int cp; (cp = GetCharPressed()) != 0;) {
+        frame.chars.push_back(cp);
+    }
+    for (int key; (key = GetKeyPressed()) != 0;) {
+        frame.keys.push_back(key);
+    }
+    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+        frame.mods |= MOD_CTRL;
+    }
+    if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+        frame.mods |= MOD_SHIFT;
+    }
+    if (IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT)) {
+        frame.mods |= MOD_ALT;
+    }
+    if (IsKeyDown(KEY_LEFT_SUPER) || IsKeyDown(KEY_RIGHT_SUPER)) {
+        frame.mods |= MOD_SUPER;
+    }
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+        Vector2 pos = GetMousePosition();
+        frame.click = true;
+        frame.mouse_x = pos.x;
+        frame.mouse_y = pos.y;
+    }
+    Vector2 wheel = GetMouseWheelMoveV();
+    frame.wheel_x = wheel.x;
+    frame.wheel_y = wheel.y;
+    frame.resized = IsWindowResized();
+    return true;
+}
+
+// raylib hands back null when the clipboard is empty or not text
+std::string RaylibInput::clipboard() {
+    const char *text = GetClipboardText();
+    return text ? text : "";
+}
+
+// RecordingInput constructor - the trace starts with its magic number
+RecordingInput::RecordingInput(std::unique_ptr<InputSource> inner,
+                               const std::filesystem::path &path)
+    : inner_(std::move(inner)), out_(path, std::ios::binary | std::ios::trunc) {
+    if (!out_) {
+        std::cerr << "Could not record to " << path << std::endl;
+        return;
+    }
+    out_.write(MAGIC, sizeof(MAGIC));
+}
+
+RecordingInput::~RecordingInput() {
+    if (pending_) {
+        write_frame();
+    }
+    out_.flush();
+}
+
+bool RecordingInput::ok() const noexcept { return static_cast<bool>(out_); }
+
+// Method to poll the real source and hold on to the frame until the editor
+// is done with it
+bool RecordingInput::poll(InputFrame &frame) {
+    if (pending_) {
+        write_frame();
+    }
+    bool more = inner_->poll(frame);
+    frame_ = frame;
+    pending_ = more;
+    has_clipboard_ = false;
+    return more;
+}
+
+// A paste reads the real clipboard and remembers it so the replay pastes the
+// same text, whatever is on the clipboard by then
+std::string RecordingInput::clipboard() {
+    clipboard_ = inner_->clipboard();
+    has_clipboard_ = true;
+    return clipboard_;
+}
+
+// Helper method to append the held frame to the trace
+void RecordingInput::write_frame() {
+    pending_ = false;
+    if (!out_) {
+        return;
+    }
+    std::uint8_t flags = 0;
+    flags |= frame_.chars.empty() ? 0 : FRAME_CHARS;
+    flags |= frame_.keys.empty() ? 0 : FRAME_KEYS;
+    flags |= frame_.click ? FRAME_CLICK : 0;
+    flags |= frame_.wheel_x != 0.0f || frame_.wheel_y != 0.0f ? FRAME_WHEEL : 0;
+    flags |= frame_.resized ? FRAME_RESIZED : 0;
+    flags |= has_clipboard_ ? FRAME_CLIPBOARD : 0;
+    out_.put(static_cast<char>(flags));
+    // Modifiers only matter when something happened
+    if (flags == 0) {
+        return;
+    }
+    out_.put(static_cast<char>(frame_.mods));
+    for (const auto *list : {&frame_.chars, &frame_.keys}) {
+        if (list->empty()) {
+            continue;
+        }
+        put_varint(out_, list->size());
+        for (int v : *list) {
+            put_varint(out_, static_cast<std::uint64_t>(v));
+        }
+    }
+    if (frame_.click) {
+        put_float(out_, frame_.mouse_x);
+        put_float(out_, frame_.mouse_y);
+    }
+    if (flags & FRAME_WHEEL) {
+        put_float(out_, frame_.wheel_x);
+        put_float(out_, frame_.wheel_y);
+    }
+    if (has_clipboard_) {
+        put_varint(out_, clipboard_.size());
+        out_.write(clipboard_.data(),
+                   static_cast<std::streamsize>(clipboard_.size()));
+    }
+}
+
+// ReplayInput constructor - we read and check the whole trace
+ReplayInput::ReplayInput(const std::filesystem::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open replay " << path << std::endl;
+        return;
+    }
+    data_.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+    if (data_.size() < sizeof(MAGIC) ||
+        std::memcmp(data_.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        std::cerr << path << " is not a phosphor recording" << std::endl;
+        return;
+    }
+    pos_ = sizeof(MAGIC);
+    ok_ = true;
+}
+
+bool ReplayInput::ok() const noexcept { return ok_; }
+
+// Method to decode the next frame, a damaged trace ends the replay early
+bool ReplayInput::poll(InputFrame &frame) {
+    frame.clear();
+    if (!ok_ || pos_ >= data_.size()) {
+        return false;
+    }
+    std::uint8_t flags = data_[pos_++];
+    bool good = true;
+    if (flags != 0) {
+        good = pos_ < data_.size();
+        if (good) {
+            frame.mods = static_cast<Mod>(data_[pos_++]);
+        }
+    }
+    if (good && (flags & FRAME_CHARS)) {
+        good = get_list(data_, pos_, frame.chars);
+    }
+    if (good && (flags & FRAME_KEYS)) {
+        good = get_list(data_, pos_, frame.keys);
+    }
+    if (good && (flags & FRAME_CLICK)) {
+        frame.click = true;
+        good = get_float(data_, pos_, frame.mouse_x) &&
+               get_float(data_, pos_, frame.mouse_y);
+    }
+    if (good && (flags & FRAME_WHEEL)) {
+        good = get_float(data_, pos_, frame.wheel_x) &&
+               get_float(data_, pos_, frame.wheel_y);
+    }
+    frame.resized = flags & FRAME_RESIZED;
+    clipboard_.clear();
+    if (good && (flags & FRAME_CLIPBOARD)) {
+        std::uint64_t n = 0;
+        good = get_varint(data_, pos_, n) && n <= data_.size() - pos_;
+        if (good) {
+            clipboard_.assign(data_.begin() + pos_, data_.begin() + pos_ + n);
+            pos_ += n;
+        }
+    }
+    if (!good) {
+        std::cerr << "Replay is damaged after " << frames_ << " frames"
+                  << std::endl;
+        ok_ = false;
+        frame.clear();
+        return false;
+    }
+    ++frames_;
+    events_ += frame.chars.size() + frame.keys.size() + frame.click;
+    return true;
+}
+
+std::string ReplayInput::clipboard() { return clipboard_; }
+
+std::size_t ReplayInput::frames() const noexcept { return frames_; }
+
+std::size_t ReplayInput::events() const noexcept { return events_; }
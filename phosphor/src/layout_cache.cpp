@@ -0,0 +1,258 @@
+#include "../include/layout_cache.hpp"
+#include "../include/profiler.hpp"
+#include "../include/utf8.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+// Helper to return how many bytes the character starting with lead claims,
+// decoding may still find fewer of them valid
+static std::size_t char_length(char lead) {
+    auto c = static_cast<unsigned char>(lead);
+    return c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+}
+
+// Method to return the left edge of the character starting at col
+float LineLayout::x_of(std::size_t col) const noexcept {
+    col = std::min(col, bytes);
+    if (cell != 0.0f) {
+        return col * cell;
+    }
+    if (col >= measured) {
+        return x.back() + (col - measured) * tail;
+    }
+    return x[index_of(col)];
+}
+
+// Method to return the character boundary nearest to a horizontal position
+std::size_t LineLayout::col_at(float pos) const noexcept {
+    if (pos <= 0.0f) {
+        return 0;
+    }
+    if (cell != 0.0f) {
+        return std::min(static_cast<std::size_t>(std::lround(pos / cell)),
+                        bytes);
+    }
+    if (pos >= x.back()) {
+        return col_past(pos, true);
+    }
+    // The first edge at or past pos, a character of zero width shares its
+    // edge with the one after it so lower_bound lands on the first of them
+    auto it = std::lower_bound(x.begin(), x.end(), pos);
+    std::size_t right = it - x.begin();
+    if (right == 0) {
+        return 0;
+    }
+    // We compare against the start of the character before it and keep
+    // whichever edge is closer
+    std::size_t left = std::lower_bound(x.begin(), it, x[right - 1]) -
+                       x.begin();
+    return pos - x[left] < x[right] - pos ? col_of(left) : col_of(right);
+}
+
+// Method to return the start of the character covering a horizontal position
+std::size_t LineLayout::col_before(float pos) const noexcept {
+    if (pos <= 0.0f) {
+        return 0;
+    }
+    if (cell != 0.0f) {
+        return std::min(static_cast<std::size_t>(pos / cell), bytes);
+    }
+    if (pos >= x.back()) {
+        return col_past(pos, false);
+    }
+    auto it = std::upper_bound(x.begin(), x.end(), pos);
+    if (it == x.begin()) {
+        return 0;
+    }
+    return col_of(std::lower_bound(x.begin(), it, *(it - 1)) - x.begin());
+}
+
+// Helper method to find the character a measured byte belongs to
+std::size_t LineLayout::index_of(std::size_t col) const noexcept {
+    if (at.empty()) {
+        return col;
+    }
+    return std::upper_bound(at.begin(), at.end(), col) - at.begin() - 1;
+}
+
+// Helper method to find where a character starts, the one past the last
+// measured character starts where the measuring stopped
+std::size_t LineLayout::col_of(std::size_t index) const noexcept {
+    if (at.empty()) {
+        return index;
+    }
+    return index < at.size() ? at[index] : measured;
+}
+
+// Helper method to find a column right of the measured edges, every byte
+// there is a tail wide cell
+std::size_t LineLayout::col_past(float pos, bool nearest) const noexcept {
+    if (measured == bytes || tail <= 0.0f) {
+        return measured;
+    }
+    float cells = (pos - x.back()) / tail;
+    std::size_t n = nearest ? static_cast<std::size_t>(std::lround(cells))
+                            : static_cast<std::size_t>(cells);
+    return std::min(measured + n, bytes);
+}
+
+// Method to pick the font the layouts are measured with
+void LayoutCache::configure(GlyphAtlas &atlas, float size, float spacing) {
+    atlas_ = &atlas;
+    size_ = size;
+    spacing_ = spacing;
+    for (int c = 0; c < 128; ++c) {
+        ascii_[c] = atlas_->advance(c, size_, spacing_);
+    }
+    // If every ASCII character has the same advance the font is monospaced
+    // and an ASCII line needs no per glyph data at all
+    cell_ = ascii_['M'];
+    monospace_ = std::all_of(ascii_.begin(), ascii_.end(), [this](float a) {
+        return std::fabs(a - cell_) < 0.01f;
+    });
+    clear();
+}
+
+// Method to return the layout of a line, measuring it if it is not cached
+const LineLayout &LayoutCache::line(const TextStorage &buf, std::size_t line) {
+    if (lines_.size() >= MAX_LINES && lines_.find(line) == lines_.end()) {
+        clear();
+    }
+    LineLayout &layout = lines_[line];
+    // A fresh entry has neither a cell nor edges, and a length mismatch means
+    // an edit was not reported, either way we measure instead of handing out
+    // a stale layout
+    bool fresh = layout.cell == 0.0f && layout.x.empty();
+    if (fresh || layout.bytes != buf.line_length(line)) {
+        measure(buf, line, layout);
+    }
+    return layout;
+}
+
+// Method to report an edit that replaced old_lines + 1 lines starting at first
+// with new_lines + 1 lines
+void LayoutCache::invalidate(std::size_t first, std::size_t old_lines,
+                             std::size_t new_lines) {
+    // Most edits stay on one line so nothing needs to move
+    if (old_lines == new_lines) {
+        for (std::size_t line = first; line <= first + old_lines; ++line) {
+            lines_.erase(line);
+        }
+        return;
+    }
+    // Otherwise every line after the edit has a new number, we move them
+    // across instead of measuring them again
+    std::unordered_map<std::size_t, LineLayout> moved;
+    moved.reserve(lines_.size());
+    for (auto &[line, layout] : lines_) {
+        if (line < first) {
+            moved.emplace(line, std::move(layout));
+        } else if (line > first + old_lines) {
+            moved.emplace(line - old_lines + new_lines, std::move(layout));
+        }
+    }
+    lines_.swap(moved);
+}
+
+void LayoutCache::clear() noexcept { lines_.clear(); }
+
+bool LayoutCache::monospace() const noexcept { return monospace_; }
+
+float LayoutCache::cell() const noexcept { return cell_; }
+
+// Helper method to return how far the pen moves after a character, this
+// matches what DrawTextEx does
+float LayoutCache::advance(int codepoint) const {
+    if (codepoint >= 0 && codepoint < 128) {
+        return ascii_[codepoint];
+    }
+    return atlas_->advance(codepoint, size_, spacing_);
+}
+
+// Helper method to measure a line
+// We read it in place a chunk at a time and stop at MAX_MEASURE, a character
+// split across two chunks waits in carry until the rest of it arrives
+void LayoutCache::measure(const TextStorage &buf, std::size_t line,
+                          LineLayout &out) {
+    ProfileScope scope("layout measure");
+    std::size_t start = buf.line_start(line);
+    out.bytes = buf.line_length(line);
+    out.measured = std::min(out.bytes, MAX_MEASURE);
+    out.tail = cell_;
+    out.x.clear();
+    out.at.clear();
+    // The fast path, every byte is one cell wide, bytes past the measured
+    // ones are cells either way so only those need to be ASCII
+    bool ascii = monospace_;
+    if (ascii) {
+        buf.for_each_chunk(start, out.measured, [&ascii](std::string_view c) {
+            ascii = utf8::ascii_prefix(c) == c.size();
+            return ascii;
+        });
+    }
+    if (ascii) {
+        out.cell = cell_;
+        out.measured = out.bytes;
+        out.width = out.bytes * cell_;
+        out.x.shrink_to_fit();
+        out.at.shrink_to_fit();
+        return;
+    }
+    out.cell = 0.0f;
+    float pen = 0.0f;
+    std::size_t pos = 0;
+    // We only start filling at once a character is longer than a byte, the
+    // ones before it all started where their index says
+    auto add = [&](int cp, std::size_t n) {
+        if (n > 1 || !out.at.empty()) {
+            for (std::size_t i = out.at.size(); i < out.x.size(); ++i) {
+                out.at.push_back(static_cast<std::uint32_t>(i));
+            }
+            out.at.push_back(static_cast<std::uint32_t>(pos));
+        }
+        out.x.push_back(pen);
+        pen += advance(cp);
+        pos += n;
+    };
+    std::string carry;
+    int cp = 0;
+    buf.for_each_chunk(start, out.measured, [&](std::string_view c) {
+        std::size_t i = 0;
+        // The carry takes what it is missing from the front of this chunk,
+        // it may still be short if the chunk is tiny
+        while (!carry.empty()) {
+            std::size_t need = char_length(carry[0]);
+            while (carry.size() < need && i < c.size()) {
+                carry += c[i++];
+            }
+            if (carry.size() < need) {
+                return true;
+            }
+            std::size_t n = utf8::decode(carry, cp);
+            add(cp, n);
+            carry.erase(0, n);
+        }
+        while (i < c.size()) {
+            std::string_view rest = c.substr(i);
+            if (rest.size() < char_length(rest[0])) {
+                carry.assign(rest);
+                break;
+            }
+            std::size_t n = utf8::decode(rest, cp);
+            add(cp, n);
+            i += n;
+        }
+        return true;
+    });
+    // Whatever still waits was cut off by the end of the measured bytes, we
+    // never let it run past them
+    while (!carry.empty()) {
+        std::size_t n = utf8::decode(carry, cp);
+        add(cp, n);
+        carry.erase(0, n);
+    }
+    out.x.push_back(pen);
+    out.width = pen + (out.bytes - out.measured) * out.tail;
+}
@@ -0,0 +1,134 @@
+#include "../include/line_index.hpp"
+#include "../include/newline_scan.hpp"
+
+// Method to rebuild the index given the text on either side of the split
+// This runs for every file we open, so both sides are scanned with the
+// vectorized scanner, on several threads for big files
+void LineIndex::build(std::string_view left, std::string_view right) {
+    left_.clear();
+    right_.clear();
+    split_ = left.size();
+    size_ = left.size() + right.size();
+    scan_newlines_parallel(left, 0, left_);
+    // The right side is stored as distances from the end with the newline
+    // nearest the split at the back, so we flip the offsets we found
+    scan_newlines_parallel(right, split_, right_);
+    std::reverse(right_.begin(), right_.end());
+    for (std::size_t &off : right_) {
+        off = size_ - off;
+    }
+}
+
+// Method to move the split point, newlines that we walk over are transferred
+// from one side to the other so the cost is the number of lines crossed
+void LineIndex::move_split(std::size_t pos) {
+    if (pos < split_) {
+        // Every newline at or after the new split moves to the right side
+        // We pop the largest offsets first so right_ stays sorted
+        while (!left_.empty() && left_.back() >= pos) {
+            right_.push_back(size_ - left_.back());
+            left_.pop_back();
+        }
+    } else {
+        // Every newline before the new split moves to the left side
+        while (!right_.empty() && size_ - right_.back() < pos) {
+            left_.push_back(size_ - right_.back());
+            right_.pop_back();
+        }
+    }
+    split_ = pos;
+}
+
+// Method to record inserted text, we only scan the new bytes
+void LineIndex::insert(const char *data, std::size_t n) {
+    scan_newlines({data, n}, split_, left_);
+    split_ += n;
+    size_ += n;
+}
+
+// Method to record text erased before the split
+void LineIndex::erase_back(std::size_t n) {
+    n = std::min(n, split_);
+    split_ -= n;
+    size_ -= n;
+    // Any newline that was inside the erased block is dropped
+    while (!left_.empty() && left_.back() >= split_) {
+        left_.pop_back();
+    }
+}
+
+// Method to return the number of bytes the index covers
+std::size_t LineIndex::size() const noexcept { return size_; }
+
+// Method to return the number of lines, an empty text still has one line
+std::size_t LineIndex::line_count() const noexcept {
+    return newline_count() + 1;
+}
+
+// Method to return the offset of the first byte of a line
+std::size_t LineIndex::line_start(std::size_t line) const {
+    if (line >= line_count()) {
+        throw std::out_of_range("line out of range");
+    }
+    return line == 0 ? 0 : newline_at(line - 1) + 1;
+}
+
+// Method to return the offset of the newline that ends a line, or the size of
+// the text for the last line
+std::size_t LineIndex::line_end(std::size_t line) const {
+    if (line >= line_count()) {
+        throw std::out_of_range("line out of range");
+    }
+    return line < newline_count() ? newline_at(line) : size_;
+}
+
+// Method to return the length of a line without its newline
+std::size_t LineIndex::line_length(std::size_t line) const {
+    return line_end(line) - line_start(line);
+}
+
+// Method to find the line an offset belongs to
+std::size_t LineIndex::line_of(std::size_t offset) const {
+    offset = std::min(offset, size_);
+    // The line number is simply the number of newlines before the offset
+    // We count them on the left side first
+    std::size_t count = static_cast<std::size_t>(
+        std::lower_bound(left_.begin(), left_.end(), offset) - left_.begin());
+    // If every left newline is before the offset we also need to count the
+    // ones on the right, an offset o is before us when size_ - o > size_ -
+    // offset
+    if (count == left_.size()) {
+        count += static_cast<std::size_t>(
+            right_.end() -
+            std::upper_bound(right_.begin(), right_.end(), size_ - offset));
+    }
+    return count;
+}
+
+// Method to convert an offset into a line and column pair
+LineCol LineIndex::position(std::size_t offset) const {
+    offset = std::min(offset, size_);
+    std::size_t line = line_of(offset);
+    return {line, offset - line_start(line)};
+}
+
+// Method to convert a line and column into an offset, the column is clamped to
+// the length of the line so vertical motion lands on the last character
+std::size_t LineIndex::offset(std::size_t line, std::size_t col) const {
+    return line_start(line) + std::min(col, line_length(line));
+}
+
+// Helper method for the total number of newlines
+std::size_t LineIndex::newline_count() const noexcept {
+    return left_.size() + right_.size();
+}
+
+// Helper method to return the offset of the k-th newline
+std::size_t LineIndex::newline_at(std::size_t k) const noexcept {
+    if (k < left_.size()) {
+        return left_[k];
+    }
+    // The right side is stored back to front, the newline closest to the
+    // split lives at the back of the vector
+    return size_ - right_[right_.size() - 1 - (k - left_.size())];
+}
@@ -1,23 +1,15 @@
 #include "../include/editor.hpp"
+#include "../include/file_loader.hpp"
+#include "../include/input.hpp"
+#include "../include/profiler.hpp"
 #include "../vendor/cxxopts.hpp"
 #include "../vendor/raylib.h"
+#include <chrono>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <memory>
 #include <ostream>
-
-// Helper function to decide if a file has contents
-static inline std::string slurp_file(const std::filesystem::path &path) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        std::cerr << "File could not be opened." << std::endl;
-        return "";
-    }
-    std::string content((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
-    file.close();
-    return content;
-}
+#include <vector>
 
 int main(int argc, const char **argv) {
     // We create a new options object
@@ -25,13 +17,29 @@ int main(int argc, const char **argv) {
 
     // We add the options we want to parse
     options.add_options()("h,help", "Help message")(
-        "f,file", "Path to file for editing", cxxopts::value<std::string>());
+        "f,file", "Path to file for editing, repeat it to open several",
+        cxxopts::value<std::vector<std::string>>())(
+        "s,storage", "Storage engine: gap, piece or auto (picks by file size)",
+        cxxopts::value<std::string>()->default_value("auto"))(
+        "record", "Record every input frame to a trace file",
+        cxxopts::value<std::string>())(
+        "replay", "Play a recorded trace back as fast as possible and exit",
+        cxxopts::value<std::string>())(
+        "headless", "Replay without drawing anything, needs --replay");
 
     // We need to catch any strange inputs
     options.allow_unrecognised_options();
 
-    // We create an empty instance of a file path object
+    // We create an empty instance of a file path object, the first file is
+    // the one we show and the rest are opened behind it
     std::filesystem::path file{};
+    std::vector<std::filesystem::path> more_files;
+    // We remember which storage engine was asked for
+    std::string storage_name{"auto"};
+    // Traces to record to or replay from, and whether to skip drawing
+    std::filesystem::path record{};
+    std::filesystem::path replay{};
+    bool headless = false;
 
     try {
         // We can now parse the arguments
@@ -43,8 +51,18 @@ int main(int argc, const char **argv) {
             exit(0);
             // We extract the file name if passed in
         } else if (result.count("file")) {
-            file = result["file"].as<std::string>();
+            auto files = result["file"].as<std::vector<std::string>>();
+            file = files.front();
+            more_files.assign(files.begin() + 1, files.end());
+        }
+        storage_name = result["storage"].as<std::string>();
+        if (result.count("record")) {
+            record = result["record"].as<std::string>();
+        }
+        if (result.count("replay")) {
+            replay = result["replay"].as<std::string>();
         }
+        headless = result.count("headless") > 0;
 
         // We retrieve unmatched arguments
         std::vector<std::string> unmatched_args = result.unmatched();
@@ -61,22 +79,152 @@ int main(int argc, const char **argv) {
         return 1;
     }
 
-    std::string initial = file.empty() ? std::string{} : slurp_file(file);
+    if (headless && replay.empty()) {
+        std::cerr << "--headless needs a trace to --replay" << std::endl;
+        return 1;
+    }
+    if (!replay.empty() && !record.empty()) {
+        std::cerr << "Cannot record and replay at the same time" << std::endl;
+        return 1;
+    }
 
+    // We pick where input comes from, the window unless we replay a trace,
+    // and wrap it in a recorder if asked to
+    std::unique_ptr<InputSource> input;
+    ReplayInput *player = nullptr;
+    if (!replay.empty()) {
+        auto source = std::make_unique<ReplayInput>(replay);
+        if (!source->ok()) {
+            return 1;
+        }
+        player = source.get();
+        input = std::move(source);
+    } else if (!record.empty()) {
+        auto source = std::make_unique<RecordingInput>(
+            std::make_unique<RaylibInput>(), record);
+        if (!source->ok()) {
+            return 1;
+        }
+        input = std::move(source);
+    }
+
+    // The window opens first so a huge file never leaves us staring at
+    // nothing, the file streams in once the editor is up
+    // Headless opens no window at all, fonts are rasterized on the CPU and
+    // the layout cache only needs their metrics, so it runs without a display
     SetTraceLogLevel(LOG_ERROR);
     const int WIDTH = 1200;
     const int HEIGHT = 800;
-    InitWindow(WIDTH, HEIGHT, "phosphor");
+    if (!headless) {
+        InitWindow(WIDTH, HEIGHT, "phosphor");
+    }
 
+    Loaded loaded = load_file(file, storage_name, !player);
+    if (!loaded.buffer) {
+        if (!headless) {
+            CloseWindow();
+        }
+        return 1;
+    }
+
+    // We do not redraw at a fixed rate, EndDrawing and PollInputEvents block
+    // until there is an input event so an idle editor sleeps
+    // The target FPS now only caps how fast we redraw while input keeps coming
+    EnableEventWaiting();
     SetTargetFPS(120);
 
-    Editor editor{initial, file};
+    Editor editor{std::move(loaded), file, std::move(input)};
+    // The other files share the editor's fonts and scripts, Ctrl+Tab
+    // switches between them
+    for (const std::filesystem::path &path : more_files) {
+        Loaded other = load_file(path, storage_name, !player);
+        if (other.buffer) {
+            editor.add_buffer(std::move(other), path);
+        }
+    }
+
+    // A replay runs flat out, every frame is polled and drawn with no waiting
+    // and we report how long the edits and the drawing took
+    if (player) {
+        DisableEventWaiting();
+        SetTargetFPS(0);
+        double input_ms = 0.0;
+        double draw_ms = 0.0;
+        std::size_t drawn = 0;
+        auto ms_since = [](std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                .count();
+        };
+        auto start = std::chrono::steady_clock::now();
+        // Without a window WindowShouldClose is always true, so only the
+        // end of the trace stops a headless replay
+        for (bool more = true; more && (headless || !WindowShouldClose());) {
+            profiler().begin_frame();
+            auto t = std::chrono::steady_clock::now();
+            more = editor.poll_input();
+            input_ms += ms_since(t);
+            if (!editor.needs_redraw()) {
+                continue;
+            }
+            t = std::chrono::steady_clock::now();
+            if (headless) {
+                editor.draw_headless();
+            } else {
+                BeginDrawing();
+                editor.draw();
+            }
+            profiler().end_frame();
+            if (!headless) {
+                EndDrawing();
+            }
+            draw_ms += ms_since(t);
+            ++drawn;
+        }
+        double total_ms = ms_since(start);
+        ProfileSummary summary = profiler().summary();
+        std::cout << "Replayed " << player->frames() << " frames, "
+                  << player->events() << " input events in " << total_ms
+                  << " ms" << std::endl
+                  << "  input and edits " << input_ms << " ms, drawing "
+                  << draw_ms << " ms over " << drawn << " frames"
+                  << (headless ? " (headless)" : "") << std::endl
+                  << "  frame p50 " << summary.frame_p50 << " ms, p99 "
+                  << summary.frame_p99 << " ms, max " << summary.frame_max
+                  << " ms (last " << summary.frames << " frames)" << std::endl;
+        if (!headless) {
+            CloseWindow();
+        }
+        return 0;
+    }
 
     while (!WindowShouldClose()) {
+        // A frame starts once we wake up for input and ends when it has been
+        // drawn, waiting for the next event and the buffer swap are not ours
+        profiler().begin_frame();
+        // A background save finishing or a chunk of the file loading is not
+        // an input event, so while either is in flight we poll instead of
+        // waiting
+        if (editor.busy()) {
+            DisableEventWaiting();
+        } else {
+            EnableEventWaiting();
+        }
         editor.poll_input();
-        BeginDrawing();
-        editor.draw();
-        EndDrawing();
+        // If the input changed nothing on screen we skip the frame and just
+        // wait for the next event, the window keeps showing the last frame
+        if (editor.needs_redraw()) {
+            BeginDrawing();
+            editor.draw();
+            profiler().end_frame();
+            EndDrawing();
+        } else {
+            PollInputEvents();
+            // Polling does not wait so we sleep a frame ourselves
+            if (editor.busy()) {
+                WaitTime(1.0 / 120.0);
+            }
+        }
     }
 
     CloseWindow();
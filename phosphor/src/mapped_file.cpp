@@ -0,0 +1,197 @@
+#include "../include/mapped_file.hpp"
+
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#endif
+
+// A mapping a fault may land in, the slot is free while begin is zero
+struct Guarded {
+    std::atomic<std::uintptr_t> begin{0};
+    std::atomic<std::uintptr_t> end{0};
+};
+
+// Fixed so the fault handler never has to take a lock or allocate, mappings
+// past this many are still read, just without the guard
+static constexpr std::size_t GUARDED = 256;
+static Guarded guarded[GUARDED];
+static std::size_t page_size = 4096;
+
+// Helper to swap the page a read faulted on for zeros so the read can go on
+// Anything that is not one of our mappings gets the default action, which
+// happens as soon as we return and the access faults again
+static void on_fault(int sig, siginfo_t *info, void *) {
+    auto at = reinterpret_cast<std::uintptr_t>(info->si_addr);
+    for (const Guarded &g : guarded) {
+        std::uintptr_t begin = g.begin.load();
+        if (begin != 0 && at >= begin && at < g.end.load()) {
+            void *page = reinterpret_cast<void *>(at & ~(page_size - 1));
+            if (mmap(page, page_size, PROT_READ,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+                     0) != MAP_FAILED) {
+                return;
+            }
+        }
+    }
+    signal(sig, SIG_DFL);
+}
+
+// Helper to start catching faults in a mapping
+static void guard(void *data, std::size_t size) {
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = on_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, nullptr);
+    });
+    // Only the fault handler reads the slots without the lock
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto begin = reinterpret_cast<std::uintptr_t>(data);
+    for (Guarded &g : guarded) {
+        if (g.begin.load() == 0) {
+            // The end is in place before the handler can see the slot taken
+            g.end.store(begin + size);
+            g.begin.store(begin);
+            return;
+        }
+    }
+}
+
+// Helper to stop catching faults in a mapping before it goes away
+static void unguard(void *data) {
+    auto begin = reinterpret_cast<std::uintptr_t>(data);
+    for (Guarded &g : guarded) {
+        std::uintptr_t taken = begin;
+        if (g.begin.compare_exchange_strong(taken, 0)) {
+            return;
+        }
+    }
+}
+
+// Helper to put private pages holding copy where the mapping at data is,
+// in one step so a thread reading it never sees anything in between
+static bool replace_pages(void *data, void *copy, std::size_t size) {
+#if defined(__linux__)
+    return mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, data) !=
+           MAP_FAILED;
+#elif defined(__APPLE__)
+    auto target = reinterpret_cast<mach_vm_address_t>(data);
+    vm_prot_t cur;
+    vm_prot_t max;
+    kern_return_t kr = mach_vm_remap(
+        mach_task_self(), &target, size, 0,
+        VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE, mach_task_self(),
+        reinterpret_cast<mach_vm_address_t>(copy), FALSE, &cur, &max,
+        VM_INHERIT_DEFAULT);
+    munmap(copy, size);
+    return kr == KERN_SUCCESS;
+#else
+    // Readers may see zeros until the copy lands, there is nothing better
+    // without a way to move pages
+    if (mmap(data, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        munmap(copy, size);
+        return false;
+    }
+    std::memcpy(data, copy, size);
+    munmap(copy, size);
+    return mprotect(data, size, PROT_READ) == 0;
+#endif
+}
+
+// Destructor - We need to hand the mapping back to the kernel
+MappedFile::~MappedFile() {
+    if (data_) {
+        unguard(data_);
+        munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+// Method to map a file into memory
+bool MappedFile::open(const std::filesystem::path &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // We need the size of the file to know how much to map
+    if (!stamp_fd(fd, stamp_)) {
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<std::size_t>(stamp_.size);
+    // An empty file cannot be mapped but it is still a valid file
+    if (size_ == 0) {
+        ::close(fd);
+        return true;
+    }
+    void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd);
+        size_ = 0;
+        return false;
+    }
+    // We mostly read files front to back so we let the kernel read ahead
+    madvise(addr, size_, MADV_SEQUENTIAL);
+    data_ = addr;
+    fd_ = fd;
+    guard(data_, size_);
+    return true;
+}
+
+// Method to view the mapped bytes
+std::string_view MappedFile::view() const noexcept {
+    return {static_cast<const char *>(data_), size_};
+}
+
+std::size_t MappedFile::size() const noexcept { return size_; }
+
+// Method to check the file we mapped against what it was when we mapped it
+// This is one fstat, cheap enough to do once a frame
+bool MappedFile::changed() const {
+    if (fd_ < 0) {
+        return false;
+    }
+    FileStamp now;
+    return !stamp_fd(fd_, now) || now != stamp_;
+}
+
+// Method to copy the mapping into private memory and let go of the file
+// Copying reads through the guard, so pages a truncation took come out as
+// zeros and not as a crash
+void MappedFile::detach() {
+    if (fd_ < 0) {
+        return;
+    }
+    if (data_) {
+        void *copy = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (copy != MAP_FAILED) {
+            std::memcpy(copy, data_, size_);
+            mprotect(copy, size_, PROT_READ);
+            if (replace_pages(data_, copy, size_)) {
+                unguard(data_);
+            }
+        }
+    }
+    // If the copy failed we keep reading the file through the guard, asking
+    // again every frame would not make it work
+    ::close(fd_);
+    fd_ = -1;
+}
@@ -0,0 +1,118 @@
+#include "../include/newline_scan.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHOSPHOR_X86 1
+#endif
+
+// Slices handed to a thread are never smaller than this, spinning up a
+// thread costs more than scanning a few megabytes
+static constexpr std::size_t MIN_SLICE = 4ull << 20;
+
+#ifdef PHOSPHOR_X86
+// Helper to push the newline offsets a compare mask points at
+static inline void push_hits(unsigned mask, std::size_t at,
+                             std::vector<std::size_t> &out) {
+    while (mask) {
+        out.push_back(at + static_cast<std::size_t>(__builtin_ctz(mask)));
+        mask &= mask - 1;
+    }
+}
+
+// Helper to scan whole 16 byte blocks, returns how many bytes it covered
+static std::size_t scan_sse2(const char *data, std::size_t n,
+                             std::size_t base, std::vector<std::size_t> &out) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        push_hits(static_cast<unsigned>(
+                      _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl))),
+                  base + i, out);
+    }
+    return i;
+}
+
+// Helper to scan whole 32 byte blocks, only called when the CPU has AVX2
+__attribute__((target("avx2"))) static std::size_t
+scan_avx2(const char *data, std::size_t n, std::size_t base,
+          std::vector<std::size_t> &out) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        push_hits(static_cast<unsigned>(
+                      _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl))),
+                  base + i, out);
+    }
+    return i;
+}
+#endif
+
+// Method to append the offset of every newline in text
+void scan_newlines(std::string_view text, std::size_t base,
+                   std::vector<std::size_t> &out) {
+    const char *data = text.data();
+    std::size_t n = text.size();
+    std::size_t i = 0;
+#ifdef PHOSPHOR_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    i = avx2 ? scan_avx2(data, n, base, out) : scan_sse2(data, n, base, out);
+#endif
+    // Whatever the vector loop left over, or everything without one, we hop
+    // through with memchr
+    const char *p = data + i;
+    const char *end = data + n;
+    while (p < end) {
+        const void *hit = std::memchr(p, '\n', static_cast<size_t>(end - p));
+        if (!hit) {
+            break;
+        }
+        const char *at = static_cast<const char *>(hit);
+        out.push_back(base + static_cast<std::size_t>(at - data));
+        p = at + 1;
+    }
+}
+
+// Method to scan a big text on every core
+void scan_newlines_parallel(std::string_view text, std::size_t base,
+                            std::vector<std::size_t> &out) {
+    std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t slices = std::min(cores, text.size() / MIN_SLICE);
+    if (text.size() < PARALLEL_SCAN_THRESHOLD || slices < 2) {
+        scan_newlines(text, base, out);
+        return;
+    }
+    // Every slice fills its own list so the threads share nothing, this
+    // thread takes the first slice while the others run
+    std::size_t step = text.size() / slices;
+    std::vector<std::vector<std::size_t>> found(slices);
+    std::vector<std::thread> workers;
+    workers.reserve(slices - 1);
+    for (std::size_t s = 1; s < slices; ++s) {
+        std::size_t begin = s * step;
+        std::size_t len = s + 1 == slices ? text.size() - begin : step;
+        workers.emplace_back([&found, text, base, s, begin, len] {
+            scan_newlines(text.substr(begin, len), base + begin, found[s]);
+        });
+    }
+    scan_newlines(text.substr(0, step), base, out);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    // The slices are in order so appending them keeps out sorted
+    std::size_t total = out.size();
+    for (const auto &list : found) {
+        total += list.size();
+    }
+    out.reserve(total);
+    for (const auto &list : found) {
+        out.insert(out.end(), list.begin(), list.end());
+    }
+}
@@ -0,0 +1,468 @@
+#include "../include/piece_table.hpp"
+#include "../include/newline_scan.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+// Add buffers are allocated in blocks of this size, bigger inserts get a
+// block of their own
+static constexpr std::size_t ADD_BUFFER_SIZE = 64 * 1024;
+
+// PieceTable constructor - the document starts out as a single piece covering
+// all of the original text
+// When an owner is given (like a file mapping) we keep it alive and read the
+// original straight from it, otherwise we take a private copy
+PieceTable::PieceTable(std::string_view original,
+                       std::shared_ptr<const void> owner, bool stream) {
+    bool own = !owner;
+    if (own) {
+        auto text = std::make_shared<const std::string>(original);
+        original = *text;
+        owner = std::move(text);
+    }
+    // A streamed original starts with nothing revealed, its capacity is what
+    // reveal is allowed to grow into
+    Buffer buf{std::shared_ptr<const char>(owner, original.data()),
+               original.data(), stream ? 0 : original.size(), original.size(),
+               {}, own};
+    scan_newlines_parallel({buf.data, buf.size}, 0, buf.newlines);
+    bufs_.push_back(std::move(buf));
+    if (bufs_[0].size) {
+        root_ = alloc({0, 0, bufs_[0].size, bufs_[0].newlines.size()});
+    }
+}
+
+// The piece table identifies itself so callers can report which engine is live
+StorageKind PieceTable::kind() const noexcept { return StorageKind::Piece; }
+
+// The cursor is just an offset, there is no gap to drag around
+std::size_t PieceTable::cursor() const noexcept { return cursor_; }
+
+// Method to set the cursor position, this never touches the text
+void PieceTable::set_cursor(std::size_t pos) {
+    if (pos > size()) {
+        throw std::out_of_range("cursor out of range");
+    }
+    cursor_ = pos;
+}
+
+// The root caches the length of the whole document
+std::size_t PieceTable::size() const noexcept { return len_of(root_); }
+
+// Method to insert text at the cursor
+void PieceTable::insert(std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    Piece piece = append_to_add(text);
+    // When we are typing, the new text sits right after the piece we just
+    // grew, so we can extend that piece instead of creating a new one
+    if (!extend(root_, cursor_, piece)) {
+        NodeId l, r;
+        split(root_, cursor_, l, r);
+        root_ = merge(merge(l, alloc(piece)), r);
+    }
+    cursor_ += text.size();
+}
+
+// Method to erase characters before the cursor
+void PieceTable::erase_back(std::size_t num_chars) {
+    std::size_t to_del = std::min(num_chars, cursor_);
+    if (to_del == 0) {
+        return;
+    }
+    // We cut the erased block out of the tree and stitch the rest together
+    NodeId l, mid, r;
+    split(root_, cursor_ - to_del, l, r);
+    split(r, to_del, mid, r);
+    release(mid);
+    root_ = merge(l, r);
+    cursor_ -= to_del;
+}
+
+// Method to make sure the next n bytes land in one add buffer, so a batch of
+// inserts keeps extending the same piece
+void PieceTable::reserve(std::size_t n) {
+    if (!add_data_ ||
+        bufs_[add_buf_].size + n > bufs_[add_buf_].capacity) {
+        start_add_buffer(std::max(ADD_BUFFER_SIZE, n));
+    }
+}
+
+// Method to replace every match by writing the new document into one fresh
+// add buffer, the tree collapses to a single piece over it
+// Editing the tree once per match would leave two pieces behind for every
+// match, this costs one copy of the document and leaves none
+// The old buffers are kept, snapshots may still be reading them
+void PieceTable::replace_matches(const std::vector<std::size_t> &at,
+                                 std::size_t len, std::string_view with) {
+    if (at.empty()) {
+        return;
+    }
+    std::size_t n = replaced_size(at.size(), len, with);
+    start_add_buffer(std::max<std::size_t>(n, 1));
+    write_replaced(at, len, with, add_data_);
+    Buffer &buf = bufs_[add_buf_];
+    scan_newlines_parallel({add_data_, n}, 0, buf.newlines);
+    buf.size = n;
+    release(root_);
+    root_ = n ? alloc({add_buf_, 0, n, buf.newlines.size()}) : NIL;
+    cursor_ = std::min(cursor_, n);
+}
+
+// Method to hand every piece overlapping a range to a visitor
+void PieceTable::for_each_chunk(std::size_t pos, std::size_t len,
+                                const ChunkFn &fn) const {
+    pos = std::min(pos, size());
+    len = std::min(len, size() - pos);
+    if (len) {
+        walk(root_, 0, pos, pos + len, fn);
+    }
+}
+
+// An empty document still has a single line
+std::size_t PieceTable::line_count() const noexcept {
+    return lf_of(root_) + 1;
+}
+
+// Method to find the first byte of a line by descending to the piece that
+// holds the newline right before it
+std::size_t PieceTable::line_start(std::size_t line) const {
+    if (line >= line_count()) {
+        throw std::out_of_range("line out of range");
+    }
+    if (line == 0) {
+        return 0;
+    }
+    // We are looking for the k-th newline, counting from one
+    std::size_t k = line;
+    std::size_t base = 0;
+    NodeId t = root_;
+    while (t != NIL) {
+        const Node &n = nodes_[t];
+        if (lf_of(n.left) >= k) {
+            t = n.left;
+            continue;
+        }
+        k -= lf_of(n.left);
+        base += len_of(n.left);
+        if (n.piece.lf >= k) {
+            // The newline is inside this piece, we find it in the buffer's
+            // list of newlines
+            const std::vector<std::size_t> &nl = bufs_[n.piece.buf].newlines;
+            auto first =
+                std::lower_bound(nl.begin(), nl.end(), n.piece.start);
+            return base + (*(first + (k - 1)) - n.piece.start) + 1;
+        }
+        k -= n.piece.lf;
+        base += n.piece.len;
+        t = n.right;
+    }
+    return size();
+}
+
+// Method to find the line an offset belongs to, which is the number of
+// newlines before it
+std::size_t PieceTable::line_of(std::size_t offset) const {
+    offset = std::min(offset, size());
+    std::size_t count = 0;
+    NodeId t = root_;
+    while (t != NIL) {
+        const Node &n = nodes_[t];
+        if (offset < len_of(n.left)) {
+            t = n.left;
+            continue;
+        }
+        count += lf_of(n.left);
+        offset -= len_of(n.left);
+        if (offset <= n.piece.len) {
+            return count + count_lf(n.piece.buf, n.piece.start, offset);
+        }
+        count += n.piece.lf;
+        offset -= n.piece.len;
+        t = n.right;
+    }
+    return count;
+}
+
+// Method to report how fragmented the document is
+std::size_t PieceTable::piece_count() const noexcept {
+    return nodes_.size() - free_.size();
+}
+
+// Small xorshift generator for treap priorities
+std::uint32_t PieceTable::next_prio() noexcept {
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+}
+
+// Method to grab a node from the pool, reusing freed ones first
+PieceTable::NodeId PieceTable::alloc(const Piece &piece) {
+    Node node{piece, next_prio(), NIL, NIL, piece.len, piece.lf};
+    if (!free_.empty()) {
+        NodeId id = free_.back();
+        free_.pop_back();
+        nodes_[id] = node;
+        return id;
+    }
+    nodes_.push_back(node);
+    return static_cast<NodeId>(nodes_.size() - 1);
+}
+
+// Method to hand a whole subtree back to the pool
+void PieceTable::release(NodeId t) {
+    if (t == NIL) {
+        return;
+    }
+    release(nodes_[t].left);
+    release(nodes_[t].right);
+    free_.push_back(t);
+}
+
+// Method to recompute the cached totals of a node from its children
+void PieceTable::pull(NodeId t) noexcept {
+    Node &n = nodes_[t];
+    n.sum_len = len_of(n.left) + n.piece.len + len_of(n.right);
+    n.sum_lf = lf_of(n.left) + n.piece.lf + lf_of(n.right);
+}
+
+std::size_t PieceTable::len_of(NodeId t) const noexcept {
+    return t == NIL ? 0 : nodes_[t].sum_len;
+}
+
+std::size_t PieceTable::lf_of(NodeId t) const noexcept {
+    return t == NIL ? 0 : nodes_[t].sum_lf;
+}
+
+// Method to count the newlines inside a slice of a buffer with two binary
+// searches over its newline list
+std::size_t PieceTable::count_lf(std::uint32_t buf, std::size_t start,
+                                 std::size_t len) const noexcept {
+    const std::vector<std::size_t> &nl = bufs_[buf].newlines;
+    auto first = std::lower_bound(nl.begin(), nl.end(), start);
+    auto last = std::lower_bound(first, nl.end(), start + len);
+    return static_cast<std::size_t>(last - first);
+}
+
+// Method to join two trees where every piece of a comes before b
+PieceTable::NodeId PieceTable::merge(NodeId a, NodeId b) {
+    if (a == NIL) {
+        return b;
+    }
+    if (b == NIL) {
+        return a;
+    }
+    if (nodes_[a].prio > nodes_[b].prio) {
+        NodeId right = merge(nodes_[a].right, b);
+        nodes_[a].right = right;
+        pull(a);
+        return a;
+    }
+    NodeId left = merge(a, nodes_[b].left);
+    nodes_[b].left = left;
+    pull(b);
+    return b;
+}
+
+// Method to split a tree so l holds the first pos bytes and r the rest
+// A piece that straddles pos is cut in two
+// We never hold a reference into nodes_ across alloc since it can reallocate
+void PieceTable::split(NodeId t, std::size_t pos, NodeId &l, NodeId &r) {
+    if (t == NIL) {
+        l = r = NIL;
+        return;
+    }
+    std::size_t left_len = len_of(nodes_[t].left);
+    std::size_t piece_len = nodes_[t].piece.len;
+    if (pos <= left_len) {
+        NodeId a, b;
+        split(nodes_[t].left, pos, a, b);
+        nodes_[t].left = b;
+        pull(t);
+        l = a;
+        r = t;
+    } else if (pos >= left_len + piece_len) {
+        NodeId a, b;
+        split(nodes_[t].right, pos - left_len - piece_len, a, b);
+        nodes_[t].right = a;
+        pull(t);
+        l = t;
+        r = b;
+    } else {
+        // The cut falls inside this piece so we shorten it and move the tail
+        // into a new node
+        std::size_t cut = pos - left_len;
+        Piece head = nodes_[t].piece;
+        Piece tail{head.buf, head.start + cut, head.len - cut, 0};
+        head.len = cut;
+        head.lf = count_lf(head.buf, head.start, head.len);
+        tail.lf = nodes_[t].piece.lf - head.lf;
+        NodeId tail_id = alloc(tail);
+        NodeId right = nodes_[t].right;
+        nodes_[t].piece = head;
+        nodes_[t].right = NIL;
+        pull(t);
+        l = t;
+        r = merge(tail_id, right);
+    }
+}
+
+// Method to grow the piece that ends at pos when the new text directly
+// follows it in the same add buffer, this keeps typing from creating a piece
+// per keystroke
+bool PieceTable::extend(NodeId t, std::size_t pos, const Piece &piece) {
+    if (t == NIL) {
+        return false;
+    }
+    Node &n = nodes_[t];
+    std::size_t left_len = len_of(n.left);
+    bool grown = false;
+    if (pos <= left_len) {
+        grown = extend(n.left, pos, piece);
+    } else if (pos == left_len + n.piece.len) {
+        if (n.piece.buf == piece.buf &&
+            n.piece.start + n.piece.len == piece.start) {
+            n.piece.len += piece.len;
+            n.piece.lf += piece.lf;
+            grown = true;
+        }
+    } else if (pos > left_len + n.piece.len) {
+        grown = extend(n.right, pos - left_len - n.piece.len, piece);
+    }
+    if (grown) {
+        pull(t);
+    }
+    return grown;
+}
+
+// Method to append the next chunk of a streamed original to the document
+// The chunk directly follows what was revealed before, so the last piece
+// normally just grows and the original stays a single piece
+void PieceTable::reveal(std::size_t n,
+                        const std::vector<std::size_t> &newlines) {
+    Buffer &buf = bufs_[0];
+    n = std::min(n, buf.capacity - buf.size);
+    if (n == 0) {
+        return;
+    }
+    std::size_t start = buf.size;
+    for (std::size_t nl : newlines) {
+        buf.newlines.push_back(start + nl);
+    }
+    buf.size += n;
+    Piece piece{0, start, n, newlines.size()};
+    if (!extend(root_, size(), piece)) {
+        root_ = merge(root_, alloc(piece));
+    }
+}
+
+// Method to return how much of the original is part of the document
+std::size_t PieceTable::revealed() const noexcept { return bufs_[0].size; }
+
+// Method to add up the buffers we hold a private copy of
+std::size_t PieceTable::private_bytes() const noexcept {
+    std::size_t total = 0;
+    for (const Buffer &buf : bufs_) {
+        total += buf.own ? buf.size : 0;
+    }
+    return total;
+}
+
+// Method to list the bytes of every buffer we hold a private copy of
+Snapshot PieceTable::private_parts() const {
+    Snapshot snap;
+    for (const Buffer &buf : bufs_) {
+        if (buf.own && buf.size > 0) {
+            snap.parts.emplace_back(buf.data, buf.size);
+            snap.owners.push_back(buf.owner);
+            snap.size += buf.size;
+        }
+    }
+    return snap;
+}
+
+// Method to read the private buffers from a copy instead, in the order
+// private_parts listed them
+// A buffer we were still filling is full from now on, so nothing is ever
+// written into the copy
+void PieceTable::rehome(const char *data, std::shared_ptr<const void> owner) {
+    for (std::uint32_t i = 0; i < bufs_.size(); ++i) {
+        Buffer &buf = bufs_[i];
+        if (!buf.own || buf.size == 0) {
+            continue;
+        }
+        buf.owner = std::shared_ptr<const char>(owner, data);
+        buf.data = data;
+        buf.capacity = buf.size;
+        buf.own = false;
+        data += buf.size;
+        if (i == add_buf_) {
+            add_data_ = nullptr;
+        }
+    }
+}
+
+// Method to freeze the document without copying it
+// Buffers are never written below their size, so views of the pieces stay
+// valid while we keep editing as long as we hold on to the buffers
+Snapshot PieceTable::snapshot() const {
+    Snapshot snap;
+    snap.size = size();
+    snap.parts.reserve(piece_count());
+    for_each_chunk(0, size(), [&snap](std::string_view chunk) {
+        snap.parts.push_back(chunk);
+        return true;
+    });
+    for (const Buffer &buf : bufs_) {
+        snap.owners.push_back(buf.owner);
+    }
+    return snap;
+}
+
+// Method to walk the pieces overlapping [pos, end) in order
+bool PieceTable::walk(NodeId t, std::size_t base, std::size_t pos,
+                      std::size_t end, const ChunkFn &fn) const {
+    if (t == NIL || base >= end || base + nodes_[t].sum_len <= pos) {
+        return true;
+    }
+    const Node &n = nodes_[t];
+    if (!walk(n.left, base, pos, end, fn)) {
+        return false;
+    }
+    std::size_t start = base + len_of(n.left);
+    std::size_t stop = start + n.piece.len;
+    if (start < end && stop > pos) {
+        std::size_t from = std::max(start, pos);
+        std::size_t to = std::min(stop, end);
+        const char *data = bufs_[n.piece.buf].data + n.piece.start;
+        if (!fn(std::string_view(data + (from - start), to - from))) {
+            return false;
+        }
+    }
+    return walk(n.right, stop, pos, end, fn);
+}
+
+// Method to start a fresh add buffer
+// Add buffers never grow in place so views handed out stay valid
+void PieceTable::start_add_buffer(std::size_t capacity) {
+    std::shared_ptr<char[]> mem(new char[capacity]);
+    add_data_ = mem.get();
+    bufs_.push_back({std::shared_ptr<const char>(mem, mem.get()), mem.get(), 0,
+                     capacity, {}, true});
+    add_buf_ = static_cast<std::uint32_t>(bufs_.size() - 1);
+}
+
+// Method to append text to the current add buffer and return the piece that
+// covers it, a new buffer is started when the current one is full
+PieceTable::Piece PieceTable::append_to_add(std::string_view text) {
+    reserve(text.size());
+    Buffer &buf = bufs_[add_buf_];
+    std::size_t start = buf.size;
+    std::memcpy(add_data_ + start, text.data(), text.size());
+    std::size_t before = buf.newlines.size();
+    scan_newlines(text, start, buf.newlines);
+    buf.size += text.size();
+    return {add_buf_, start, text.size(), buf.newlines.size() - before};
+}
@@ -0,0 +1,222 @@
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+
+// Name of the event every drawn frame records, the trace shows the scopes
+// nested under it
+static const char *const FRAME_EVENT = "frame";
+
+// How far back the overlay looks when it adds up scopes
+static constexpr std::uint64_t SUMMARY_WINDOW_NS = 2'000'000'000ull;
+
+// Helper to give every thread a small id for the trace
+static std::uint32_t thread_id() noexcept {
+    static std::atomic<std::uint32_t> next{1};
+    thread_local std::uint32_t id = next.fetch_add(1);
+    return id;
+}
+
+// Helper to pick a percentile out of a list of samples
+static double percentile(std::vector<float> samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::size_t k = static_cast<std::size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+// Helper to copy the most recent samples out of a frame ring, oldest first
+template <std::size_t N>
+static std::vector<float> recent(const std::array<float, N> &ring,
+                                 std::size_t count) {
+    std::vector<float> out;
+    std::size_t n = std::min(count, N);
+    out.reserve(n);
+    for (std::size_t i = count - n; i < count; ++i) {
+        out.push_back(ring[i % N]);
+    }
+    return out;
+}
+
+// Profiler constructor - the ring is allocated once and never grows
+Profiler::Profiler()
+    : events_(new Slot[EVENT_CAPACITY]), epoch_(now_ns()) {}
+
+// Method to read a monotonic clock in nanoseconds
+std::uint64_t Profiler::now_ns() noexcept {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+// Method to record a finished scope
+// We claim a slot, mark it as being written, fill it in and then publish it
+// with its sequence number, readers that see the wrong number skip it
+void Profiler::record(const char *name, std::uint64_t start_ns,
+                      std::uint64_t dur_ns) noexcept {
+    std::uint64_t idx = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = events_[idx % EVENT_CAPACITY];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start_ns, std::memory_order_relaxed);
+    slot.dur.store(dur_ns, std::memory_order_relaxed);
+    slot.tid.store(thread_id(), std::memory_order_relaxed);
+    slot.seq.store(idx + 1, std::memory_order_release);
+}
+
+// Method to keep a copy of a name for as long as the profiler lives
+// Nodes of an unordered_set never move so the pointer stays valid
+const char *Profiler::intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(names_mutex_);
+    return names_.insert(name).first->c_str();
+}
+
+// Method to mark the start of a frame, this is right after we woke up for
+// input so it is as close as we can get to when the input arrived
+void Profiler::begin_frame() noexcept {
+    frame_start_ = now_ns();
+    frame_input_ = false;
+}
+
+// Method to note that this frame handled a key or a click
+void Profiler::mark_input() noexcept { frame_input_ = true; }
+
+// Method to mark the end of a drawn frame
+void Profiler::end_frame() noexcept {
+    std::uint64_t dur = now_ns() - frame_start_;
+    record(FRAME_EVENT, frame_start_, dur);
+    float ms = static_cast<float>(dur / 1e6);
+    frame_ms_[frame_count_++ % FRAME_CAPACITY] = ms;
+    if (frame_input_) {
+        latency_ms_[latency_count_++ % FRAME_CAPACITY] = ms;
+    }
+}
+
+// Method to boil the recent frames and scopes down for the overlay
+ProfileSummary Profiler::summary(std::size_t max_scopes) const {
+    ProfileSummary out;
+    out.recent = recent(frame_ms_, frame_count_);
+    out.frames = out.recent.size();
+    out.frame_p50 = percentile(out.recent, 0.50);
+    out.frame_p95 = percentile(out.recent, 0.95);
+    out.frame_p99 = percentile(out.recent, 0.99);
+    out.frame_max = percentile(out.recent, 1.0);
+    std::vector<float> latency = recent(latency_ms_, latency_count_);
+    out.inputs = latency.size();
+    out.latency_p50 = percentile(latency, 0.50);
+    out.latency_p95 = percentile(latency, 0.95);
+    out.latency_max = percentile(latency, 1.0);
+
+    // We add the scopes up by name, the same literal can have a different
+    // address in every translation unit so we compare the text
+    std::uint64_t now = now_ns();
+    std::uint64_t since = now > SUMMARY_WINDOW_NS ? now - SUMMARY_WINDOW_NS : 0;
+    std::unordered_map<std::string_view, ProfileSummary::Scope> scopes;
+    for (const Event &e : snapshot(since)) {
+        if (e.name == FRAME_EVENT) {
+            continue;
+        }
+        auto [it, fresh] = scopes.try_emplace(e.name, ProfileSummary::Scope{
+                                                          e.name, 0, 0.0, 0.0});
+        double ms = e.dur / 1e6;
+        it->second.calls++;
+        it->second.total_ms += ms;
+        it->second.max_ms = std::max(it->second.max_ms, ms);
+    }
+    for (const auto &[name, scope] : scopes) {
+        out.scopes.push_back(scope);
+    }
+    std::sort(out.scopes.begin(), out.scopes.end(),
+              [](const auto &a, const auto &b) {
+                  return a.total_ms > b.total_ms;
+              });
+    if (out.scopes.size() > max_scopes) {
+        out.scopes.resize(max_scopes);
+    }
+    return out;
+}
+
+// Method to write the ring buffer out as a Chrome trace
+bool Profiler::dump_chrome_trace(const std::filesystem::path &path) const {
+    std::vector<Event> events = snapshot(0);
+    std::sort(events.begin(), events.end(),
+              [](const Event &a, const Event &b) { return a.start < b.start; });
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const Event &e : events) {
+        if (!first) {
+            out << ',';
+        }
+        first = false;
+        out << "{\"name\":\"";
+        // Names are ours or built from key names but we escape them anyway
+        for (const char *c = e.name; *c; ++c) {
+            if (*c == '"' || *c == '\\') {
+                out << '\\';
+            }
+            out << *c;
+        }
+        // Chrome wants microseconds, we keep the nanoseconds as decimals
+        // The very first scope can start before the profiler is created
+        std::uint64_t ts = e.start > epoch_ ? e.start - epoch_ : 0;
+        char times[80];
+        std::snprintf(times, sizeof(times),
+                      "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu",
+                      static_cast<unsigned long long>(ts / 1000),
+                      static_cast<unsigned long long>(ts % 1000),
+                      static_cast<unsigned long long>(e.dur / 1000),
+                      static_cast<unsigned long long>(e.dur % 1000));
+        out << "\",\"cat\":\"phosphor\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << e.tid << ',' << times << '}';
+    }
+    out << "]}\n";
+    return static_cast<bool>(out.flush());
+}
+
+// Helper method to copy out every complete event that ended after since_ns,
+// newest first
+// Events are recorded when their scope ends, so once we find one that ended
+// before the window we can stop looking
+std::vector<Profiler::Event> Profiler::snapshot(std::uint64_t since_ns) const {
+    std::vector<Event> out;
+    std::uint64_t head = head_.load(std::memory_order_acquire);
+    std::uint64_t oldest = head > EVENT_CAPACITY ? head - EVENT_CAPACITY : 0;
+    for (std::uint64_t idx = head; idx-- > oldest;) {
+        const Slot &slot = events_[idx % EVENT_CAPACITY];
+        std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != idx + 1) {
+            continue;
+        }
+        Event e{slot.name.load(std::memory_order_relaxed),
+                slot.start.load(std::memory_order_relaxed),
+                slot.dur.load(std::memory_order_relaxed),
+                slot.tid.load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq || !e.name) {
+            continue;
+        }
+        if (e.start + e.dur < since_ns) {
+            break;
+        }
+        out.push_back(e);
+    }
+    return out;
+}
+
+// The editor's profiler
+Profiler &profiler() {
+    static Profiler instance;
+    return instance;
+}
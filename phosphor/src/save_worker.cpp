@@ -0,0 +1,249 @@
+#include "../include/save_worker.hpp"
+#include "../include/hash.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// How many parts we hand to a single writev call, POSIX only promises 16 but
+// every system we run on takes at least 1024
+static constexpr std::size_t MAX_IOV = 1024;
+
+// Helper to turn errno into a message for the editor
+static std::string errno_message(const char *what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+// Helper to push a file's contents to the disk
+// On macOS fsync only reaches the drive's cache, F_FULLFSYNC goes all the way
+static int sync_fd(int fd) {
+#ifdef F_FULLFSYNC
+    if (fcntl(fd, F_FULLFSYNC) == 0) {
+        return 0;
+    }
+#endif
+    return fsync(fd);
+}
+
+// Helper to write every part of a snapshot, vectored so a piece table with
+// many pieces does not cost a system call per piece
+// writev may stop part way through so we pick up where it left off
+static bool write_parts(int fd, const Snapshot &snap) {
+    std::vector<iovec> iov;
+    iov.reserve(std::min(snap.parts.size(), MAX_IOV));
+    std::size_t part = 0;
+    std::size_t offset = 0;
+    while (part < snap.parts.size()) {
+        iov.clear();
+        for (std::size_t i = part;
+             i < snap.parts.size() && iov.size() < MAX_IOV; ++i) {
+            std::size_t skip = i == part ? offset : 0;
+            iov.push_back({const_cast<char *>(snap.parts[i].data()) + skip,
+                           snap.parts[i].size() - skip});
+        }
+        ssize_t n = ::writev(fd, iov.data(), static_cast<int>(iov.size()));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // We advance past whatever was written
+        std::size_t left = static_cast<std::size_t>(n);
+        while (part < snap.parts.size() &&
+               left >= snap.parts[part].size() - offset) {
+            left -= snap.parts[part].size() - offset;
+            offset = 0;
+            ++part;
+        }
+        offset += left;
+    }
+    return true;
+}
+
+// Helper to find the file a save really replaces
+// A symlink is followed so we write through it, a path that does not name a
+// file yet is saved where it is
+static std::filesystem::path resolve(const std::filesystem::path &path) {
+    char *real = ::realpath(path.c_str(), nullptr);
+    if (!real) {
+        return path;
+    }
+    std::filesystem::path resolved(real);
+    std::free(real);
+    return resolved;
+}
+
+// Helper to read the mode new files get, umask can only be read by setting it
+// so we put it straight back
+static mode_t default_mode() {
+    mode_t mask = ::umask(022);
+    ::umask(mask);
+    return 0666 & ~mask;
+}
+
+// SaveWorker constructor - the thread starts after every member is ready
+SaveWorker::SaveWorker()
+    : new_mode_(default_mode()), thread_(&SaveWorker::run, this) {}
+
+// Destructor - we let the worker drain what is queued and then join it
+SaveWorker::~SaveWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+// Method to queue a save, a save that has not started yet is replaced
+void SaveWorker::submit(std::filesystem::path path, Snapshot snap) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = Job{std::move(path), std::move(snap)};
+    }
+    cv_.notify_one();
+}
+
+// Method to collect a finished save
+std::optional<SaveResult> SaveWorker::poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (results_.empty()) {
+        return std::nullopt;
+    }
+    SaveResult result = std::move(results_.front());
+    results_.pop_front();
+    return result;
+}
+
+bool SaveWorker::busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_ || writing_ || !results_.empty();
+}
+
+// Method to hash the contents of a snapshot with 64 bit FNV-1a
+std::uint64_t SaveWorker::hash(const Snapshot &snap) noexcept {
+    std::uint64_t h = FNV1A_SEED;
+    for (std::string_view part : snap.parts) {
+        h = fnv1a(part, h);
+    }
+    return h;
+}
+
+// The worker's loop, we sleep until there is a job or we are told to stop
+void SaveWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return pending_ || stop_; });
+        if (!pending_) {
+            return;
+        }
+        Job job = std::move(*pending_);
+        pending_.reset();
+        writing_ = true;
+        // We let go of the lock while writing so the editor can keep queuing
+        lock.unlock();
+        SaveResult result = write(job);
+        lock.lock();
+        writing_ = false;
+        results_.push_back(std::move(result));
+    }
+}
+
+// Method doing the actual save, this runs on the worker thread
+SaveResult SaveWorker::write(const Job &job) {
+    ProfileScope scope("save write");
+    auto start = std::chrono::steady_clock::now();
+    SaveResult result;
+    result.path = job.path;
+    result.bytes = job.snap.size;
+
+    // If this is exactly what we wrote last time and nobody touched the file
+    // since there is nothing to do
+    std::uint64_t h = hash(job.snap);
+    FileStamp now;
+    if (has_last_ && last_hash_ == h && last_path_ == job.path &&
+        stamp_path(job.path, now) && now == last_stamp_) {
+        result.ok = true;
+        result.skipped = true;
+        return result;
+    }
+
+    // The temporary file goes next to the real file so the rename stays on
+    // one file system, mkstemp makes its name unique so two editors saving
+    // the same file never write into each other's
+    std::filesystem::path target = resolve(job.path);
+    std::string tmp = target.string() + ".phosphor-XXXXXX";
+    int fd = ::mkstemp(tmp.data());
+    if (fd < 0) {
+        result.error = errno_message("mkstemp");
+        return result;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // We keep the permissions, owner and group of the file we are replacing
+    // Only root may give a file away, so a different owner is best effort
+    // and the group is kept on its own when that fails
+    struct stat st;
+    if (::stat(target.c_str(), &st) == 0) {
+        if (fchown(fd, st.st_uid, st.st_gid) != 0) {
+            (void)fchown(fd, static_cast<uid_t>(-1), st.st_gid);
+        }
+        fchmod(fd, st.st_mode & 07777);
+    } else {
+        fchmod(fd, new_mode_);
+    }
+    bool ok = write_parts(fd, job.snap);
+    if (!ok) {
+        result.error = errno_message("write");
+    } else if (sync_fd(fd) != 0) {
+        ok = false;
+        result.error = errno_message("fsync");
+    }
+    // Renaming keeps the device, inode, size and mtime, so this is what the
+    // target looks like afterwards unless someone else writes to it
+    FileStamp written;
+    bool stamped = ok && stamp_fd(fd, written);
+    if (::close(fd) != 0 && ok) {
+        ok = false;
+        result.error = errno_message("close");
+    }
+    // The temporary file is complete and on disk, renaming it over the
+    // target is atomic so readers see either the old file or the new one
+    if (ok && std::rename(tmp.c_str(), target.c_str()) != 0) {
+        ok = false;
+        result.error = errno_message("rename");
+    }
+    if (!ok) {
+        ::unlink(tmp.c_str());
+        return result;
+    }
+
+    // The rename itself lives in the directory, so we sync that too
+    // Not every file system supports this so a failure here is not an error
+    std::filesystem::path dir = target.parent_path();
+    int dfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        ::close(dfd);
+    }
+
+    last_path_ = job.path;
+    last_hash_ = h;
+    last_stamp_ = written;
+    has_last_ = stamped;
+    result.ok = true;
+    result.ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    return result;
+}
@@ -1,8 +1,67 @@
 #include "../include/scripting.hpp"
+#include "../include/bytecode_cache.hpp"
 #include "../include/editor.hpp"
 
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
 #define PUT(KEYSYM) #KEYSYM, KEYSYM
 
+// Helper to name a Lua command after its key chord, ctrl+H for example, so it
+// can be told apart from the others in the profiler
+static std::string chord_name(int key, Mod m) {
+    std::string name = "lua ";
+    const std::pair<Mod, const char *> MODS[] = {{MOD_CTRL, "ctrl+"},
+                                                 {MOD_SHIFT, "shift+"},
+                                                 {MOD_ALT, "alt+"},
+                                                 {MOD_SUPER, "super+"}};
+    for (const auto &[mod, prefix] : MODS) {
+        if (m & mod) {
+            name += prefix;
+        }
+    }
+    if ((key >= KEY_A && key <= KEY_Z) ||
+        (key >= KEY_ZERO && key <= KEY_NINE)) {
+        name += static_cast<char>(key);
+    } else if (key >= KEY_F1 && key <= KEY_F12) {
+        name += "F" + std::to_string(key - KEY_F1 + 1);
+    } else {
+        name += "key " + std::to_string(key);
+    }
+    return name;
+}
+
+// Longest chunk the chunk iterator hands to Lua, a gap buffer segment can be
+// the whole document and Lua copies every string it is given
+static constexpr std::size_t LUA_CHUNK_MAX = 64 * 1024;
+
+// Names of the hooks as scripts register them and as the profiler shows them
+static const char *const HOOK_NAMES[] = {"on_insert", "on_delete",
+                                         "on_save",   "on_cursor_move",
+                                         "on_idle",   "on_change"};
+static const char *const HOOK_SCOPES[] = {
+    "lua on_insert",      "lua on_delete", "lua on_save",
+    "lua on_cursor_move", "lua on_idle",   "lua on_change"};
+
+// How many Lua instructions run between two checks of the clock
+static constexpr int BUDGET_CHECK_EVERY = 1000;
+
+// When the running handler has to stop, and whether it was stopped
+// There is a single VM and hooks only run on the render thread, so plain
+// statics are enough for the debug hook to find them
+static std::uint64_t hook_deadline_ns = 0;
+static bool hook_stopped = false;
+
+// Lua debug hook that stops a handler once it runs past its deadline, raising
+// an error unwinds it back to the protected call
+static void budget_hook(lua_State *L, lua_Debug *) {
+    if (Profiler::now_ns() > hook_deadline_ns) {
+        hook_stopped = true;
+        luaL_error(L, "hook went over its time budget");
+    }
+}
+
 // ScriptingVM constructor - we pass in a ptr to the editor instance
 ScriptingVM::ScriptingVM(Editor *owner) : owner_(owner) {
     // We load a lean library set since we only need a couple features
@@ -12,14 +71,64 @@ ScriptingVM::ScriptingVM(Editor *owner) : owner_(owner) {
 }
 
 // Method to load files and run the undrelying Lua script
+// Compiling is the slow part of starting up a big config, so the compiled
+// chunk is cached on disk and reused until the script changes
 void ScriptingVM::load_init(const std::filesystem::path &path) {
-    // We use a safe method to catch errors and not crash the editor
-    auto result = lua_.safe_script_file(path, &sol::script_pass_on_error);
-    // We error check and report any issues
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Lua error: cannot open " << path.string() << '\n';
+        return;
+    }
+    std::string source(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>{});
+    // The @ tells Lua the chunk is a file so errors name it like before
+    std::string chunkname = "@" + path.string();
+
+    // We try the cache first, Lua refuses bytecode from another version so
+    // a bad entry just falls through to the source
+    BytecodeCache cache(BytecodeCache::default_dir());
+    sol::protected_function chunk;
+    bool cached = false;
+    if (std::optional<std::string> code = cache.load(path, source)) {
+        sol::load_result loaded =
+            lua_.load(*code, chunkname, sol::load_mode::binary);
+        if (loaded.valid()) {
+            chunk = loaded;
+            cached = true;
+        }
+    }
+    if (!cached) {
+        sol::load_result loaded =
+            lua_.load(source, chunkname, sol::load_mode::text);
+        // We error check and report any issues
+        if (!loaded.valid()) {
+            sol::error err = loaded;
+            std::cerr << "Lua error: " << err.what() << '\n';
+            return;
+        }
+        chunk = loaded;
+        sol::bytecode code = chunk.dump();
+        cache.store(path, source, code.as_string_view());
+    }
+    double compile_ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+    // We run the chunk protected to catch errors and not crash the editor
+    auto result = chunk();
     if (!result.valid()) {
         sol::error err = result;
         std::cerr << "Lua error: " << err.what() << '\n';
     }
+    // We report both steps so the cache's win is easy to see
+    double total_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    std::cout << "Loaded " << path.string() << " ("
+              << (cached ? "cached bytecode" : "compiled from source")
+              << ") in " << total_ms << " ms, " << compile_ms
+              << " ms before running" << std::endl;
 }
 
 // Method containing the main logic to push our API
@@ -63,7 +172,121 @@ void ScriptingVM::push_api(sol::state &L) {
         "Editor", "insert_text", &Editor::insert_text, "pick_palette",
         &Editor::pick_palette, "toggle_palette", &Editor::toggle_palette,
         "backspace", &Editor::backspace, "new_line", &Editor::enter, "tab",
-        &Editor::tab, "paste_text", &Editor::paste);
+        &Editor::tab, "paste_text", &Editor::paste,
+        // Transactions let scripts batch many edits, the optional argument is
+        // how many bytes the script expects to insert
+        "begin_edit",
+        [](Editor &ed, sol::optional<std::size_t> reserve) {
+            ed.begin_edit(reserve.value_or(0));
+        },
+        "commit_edit", &Editor::commit_edit,
+        // ed:edit(fn) runs fn inside a transaction and always commits, even
+        // if the script errors part way through
+        "edit",
+        [](Editor &ed, sol::protected_function fn) {
+            ed.begin_edit();
+            auto result = fn(std::ref(ed));
+            ed.commit_edit();
+            if (!result.valid()) {
+                sol::error err = result;
+                std::cerr << "[Lua error] " << err.what() << '\n';
+            }
+        },
+        "undo", &Editor::undo, "redo", &Editor::redo, "reload",
+        &Editor::reload, "toggle_profiler", &Editor::toggle_profiler,
+        // Several files can be open at once, buffers are numbered from 1
+        // in the order they were opened
+        "open",
+        [](Editor &ed, const std::string &path) { return ed.open(path); },
+        "next_buffer", &Editor::next_buffer, "prev_buffer",
+        &Editor::prev_buffer,
+        "switch_buffer",
+        [](Editor &ed, std::size_t n) {
+            if (n > 0) {
+                ed.switch_buffer(n - 1);
+            }
+        },
+        "buffer_count", &Editor::buffer_count, "current_buffer",
+        [](const Editor &ed) { return ed.current_buffer() + 1; },
+        // ed:replace_all(query, text) returns how many were replaced
+        "replace_all",
+        [](Editor &ed, const std::string &query, const std::string &with) {
+            return ed.replace_all(query, with);
+        },
+        // Several cursors, ed:add_cursor(at) takes a 1-based offset and
+        // typing or backspacing afterwards edits at every cursor
+        "add_cursor",
+        [](Editor &ed, std::size_t at) {
+            ed.add_cursor(std::max<std::size_t>(at, 1) - 1);
+        },
+        "select_next", &Editor::select_next, "select_all",
+        &Editor::select_all, "clear_cursors", &Editor::clear_cursors,
+        "cursor_count", &Editor::cursor_count,
+        // Reading the document, lines and offsets are 1-based like strings
+        // are in Lua, and none of these flatten the document
+        "line_count",
+        [](const Editor &ed) { return ed.buffer_->line_count(); },
+        // ed:line(n) is line n without its newline, or nil past the end
+        "line",
+        [](const Editor &ed, std::size_t n) -> sol::optional<std::string> {
+            if (n == 0 || n > ed.buffer_->line_count()) {
+                return sol::nullopt;
+            }
+            std::string out;
+            ed.buffer_->copy(ed.buffer_->line_start(n - 1),
+                             ed.buffer_->line_length(n - 1), out);
+            return out;
+        },
+        // ed:range(a, b) is bytes a to b inclusive, like string.sub
+        "range",
+        [](const Editor &ed, std::size_t a, std::size_t b) {
+            std::size_t first = std::max<std::size_t>(a, 1) - 1;
+            std::size_t last = std::min(b, ed.buffer_->size());
+            std::string out;
+            if (first < last) {
+                ed.buffer_->copy(first, last - first, out);
+            }
+            return out;
+        },
+        // ed:cursor() returns the offset, line and column of the cursor
+        "cursor",
+        [](const Editor &ed) {
+            std::size_t pos = ed.buffer_->cursor();
+            LineCol at = ed.buffer_->position(pos);
+            return std::make_tuple(pos + 1, at.line + 1, at.col + 1);
+        },
+        // for chunk in ed:chunks(a, b) walks bytes a to b (the whole
+        // document by default) a storage segment at a time
+        // Each step looks up the next segment where the last one ended, so
+        // the loop is safe even if the handler edits the document
+        "chunks",
+        [](const Editor &ed, sol::optional<std::size_t> a,
+           sol::optional<std::size_t> b) {
+            struct Walk {
+                std::size_t pos;
+                std::size_t end;
+            };
+            auto walk = std::make_shared<Walk>(
+                Walk{std::max<std::size_t>(a.value_or(1), 1) - 1,
+                     b.value_or(SIZE_MAX)});
+            const Editor *editor = &ed;
+            auto next = [editor, walk]() -> sol::optional<std::string_view> {
+                std::size_t end = std::min(walk->end, editor->buffer_->size());
+                if (walk->pos >= end) {
+                    return sol::nullopt;
+                }
+                std::string_view chunk = editor->buffer_->chunk_at(
+                    walk->pos, std::min(end - walk->pos, LUA_CHUNK_MAX));
+                if (chunk.empty()) {
+                    return sol::nullopt;
+                }
+                walk->pos += chunk.size();
+                return chunk;
+            };
+            // as_function makes sol push the lambda as a plain function, the
+            // generic for calls it until it returns nil
+            return sol::as_function(std::move(next));
+        });
 
     // We can pick a palette at run time or create key binds, both options are
     // nice
@@ -73,6 +296,33 @@ void ScriptingVM::push_api(sol::state &L) {
         owner_->pick_palette(palette);
     };
 
+    // We can cap how much memory the undo history keeps, in bytes
+    L["set_undo_budget"] = [this](std::size_t bytes) {
+        owner_->set_undo_budget(bytes);
+    };
+
+    // We can cap how much text files we are not looking at keep in memory,
+    // past it the least recently used are written out to disk
+    L["set_buffer_budget"] = [this](std::size_t bytes) {
+        owner_->set_buffer_budget(bytes);
+    };
+
+    // We can hook into editor events, every on_* function adds a handler and
+    // a hook can have as many as we like
+    // Edits are delivered once a frame as a list, see init.lua for the
+    // arguments every hook gets
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Hook::Count); ++i) {
+        L[HOOK_NAMES[i]] = [this, i](sol::protected_function fn) {
+            hooks_[i].push_back(std::move(fn));
+        };
+    }
+
+    // We can change how long a hook handler may run, in milliseconds
+    L["set_hook_budget"] = [this](double ms) { hook_budget_ms_ = ms; };
+
+    // We can write what the profiler recorded to a Chrome trace file
+    L["dump_trace"] = [this](std::string path) { owner_->dump_trace(path); };
+
     // We can create a method to register commands to the editors keymap
     L["register_command"] = [this](int key, Mod m, sol::function f) {
         // We create a keychord object so we can store it in the method map
@@ -84,6 +334,9 @@ void ScriptingVM::push_api(sol::state &L) {
         // We then capture a view into the state to keep sol from complaining
         sol::state_view sv(lua_);
 
+        // Every run of the command is timed under the name of its chord
+        const char *name = profiler().intern(chord_name(key, m));
+
         /*
          * We need to cast the sol command into a void(Editor&) so we can store
          * it in the editor's method map
@@ -94,7 +347,8 @@ void ScriptingVM::push_api(sol::state &L) {
         // We capture that protected function and state view by value
         // we need to make the lambda mutable so we can modify the internal
         // copies, we're moving the pf so that the command has ownership of it
-        Command cmd = [pf = std::move(pf), sv](Editor &ed) mutable {
+        Command cmd = [pf = std::move(pf), sv, name](Editor &ed) mutable {
+            ProfileScope scope(name);
             // We pass in a reference to the editor using a reference wrapper
             // so that we can reassign it safely and view the editor in memory
             // This way we modify the existing Editor and not a copy made in Lua
@@ -113,3 +367,159 @@ void ScriptingVM::push_api(sol::state &L) {
         owner_->chordmap_[chord] = std::move(cmd);
     };
 }
+
+// Method to check whether any script listens for an event
+bool ScriptingVM::has_hooks(Hook hook) const noexcept {
+    return !hooks_[static_cast<std::size_t>(hook)].empty();
+}
+
+bool ScriptingVM::has_edit_hooks() const noexcept {
+    return has_hooks(Hook::Change) || has_hooks(Hook::Insert) ||
+           has_hooks(Hook::Delete);
+}
+
+// Helper method to call every handler of a hook under the time budget
+// A handler that errors or runs out of time is reported and the others
+// still run
+template <typename... Args>
+void ScriptingVM::run_hooks(Hook hook, const Args &...args) {
+    std::size_t h = static_cast<std::size_t>(hook);
+    lua_State *L = lua_.lua_state();
+    for (std::size_t i = 0; i < hooks_[h].size(); ++i) {
+        ProfileScope scope(HOOK_SCOPES[h]);
+        hook_stopped = false;
+        hook_deadline_ns =
+            Profiler::now_ns() +
+            static_cast<std::uint64_t>(hook_budget_ms_ * 1e6);
+        lua_sethook(L, budget_hook, LUA_MASKCOUNT, BUDGET_CHECK_EVERY);
+        auto result = hooks_[h][i](std::ref(*owner_), args...);
+        lua_sethook(L, nullptr, 0, 0);
+        if (result.valid()) {
+            continue;
+        }
+        if (hook_stopped) {
+            std::cerr << "[Lua] " << HOOK_NAMES[h] << " handler " << i + 1
+                      << " went over its " << hook_budget_ms_
+                      << " ms budget and was stopped" << '\n';
+        } else {
+            sol::error err = result;
+            std::cerr << "[Lua error] " << HOOK_NAMES[h] << " handler "
+                      << i + 1 << ": " << err.what() << '\n';
+        }
+    }
+}
+
+// Methods to queue an insert or an erase, both are edits
+void ScriptingVM::note_insert(std::size_t at, std::string_view text) {
+    note_edit(at, 0, text);
+}
+
+void ScriptingVM::note_erase(std::size_t at, std::size_t length) {
+    note_edit(at, length, {});
+}
+
+// Method to queue an edit, typing extends the last edit instead of adding
+// one per key and backspacing over text grows the last erase backwards
+void ScriptingVM::note_edit(std::size_t at, std::size_t length,
+                            std::string_view text) {
+    if (dispatching_ || (length == 0 && text.empty()) || !has_edit_hooks()) {
+        return;
+    }
+    if (!edits_.empty()) {
+        Edit &last = edits_.back();
+        if (length == 0 && last.at + last.text.size() == at) {
+            last.text.append(text);
+            return;
+        }
+        if (text.empty() && last.text.empty() && last.at == at + length) {
+            last.at = at;
+            last.length += length;
+            return;
+        }
+    }
+    edits_.push_back({at, length, std::string(text)});
+}
+
+// Method to queue a finished save
+void ScriptingVM::note_save(const std::filesystem::path &path, bool ok) {
+    if (has_hooks(Hook::Save)) {
+        saves_.emplace_back(path.string(), ok);
+    }
+}
+
+// Method to deliver the frame's events, each hook is called once with
+// everything that happened to it, offsets are 1-based like the read API
+void ScriptingVM::flush_hooks(bool cursor_moved) {
+    cursor_moved = cursor_moved && has_hooks(Hook::CursorMove);
+    if (edits_.empty() && saves_.empty() && !cursor_moved) {
+        return;
+    }
+    dispatching_ = true;
+    flush_edits();
+    for (const auto &[path, ok] : saves_) {
+        run_hooks(Hook::Save, path, ok);
+    }
+    saves_.clear();
+    if (cursor_moved) {
+        const TextStorage &buf = *owner_->buffer_;
+        LineCol at = buf.position(buf.cursor());
+        run_hooks(Hook::CursorMove, buf.cursor() + 1, at.line + 1, at.col + 1);
+    }
+    dispatching_ = false;
+}
+
+// Helper method to deliver the frame's edits
+// on_change gets them in order, each one is applied to the document as the
+// edits before it left it, so walking the list replays the frame
+// on_insert and on_delete get the same edits split in two, every entry says
+// which change it belongs to since the halves cannot be applied on their own
+void ScriptingVM::flush_edits() {
+    if (edits_.empty()) {
+        return;
+    }
+    if (has_hooks(Hook::Change)) {
+        sol::table batch = lua_.create_table(edits_.size(), 0);
+        for (std::size_t i = 0; i < edits_.size(); ++i) {
+            batch[i + 1] = lua_.create_table_with(
+                "at", edits_[i].at + 1, "length", edits_[i].length, "text",
+                edits_[i].text);
+        }
+        run_hooks(Hook::Change, batch);
+    }
+    if (has_hooks(Hook::Delete)) {
+        sol::table batch = lua_.create_table();
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < edits_.size(); ++i) {
+            if (edits_[i].length) {
+                batch[++n] = lua_.create_table_with(
+                    "at", edits_[i].at + 1, "length", edits_[i].length,
+                    "change", i + 1);
+            }
+        }
+        if (n > 0) {
+            run_hooks(Hook::Delete, batch);
+        }
+    }
+    if (has_hooks(Hook::Insert)) {
+        sol::table batch = lua_.create_table();
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < edits_.size(); ++i) {
+            if (!edits_[i].text.empty()) {
+                batch[++n] = lua_.create_table_with(
+                    "at", edits_[i].at + 1, "text", edits_[i].text, "change",
+                    i + 1);
+            }
+        }
+        if (n > 0) {
+            run_hooks(Hook::Insert, batch);
+        }
+    }
+    edits_.clear();
+}
+
+// Method to tell scripts that input has stopped for a while
+void ScriptingVM::run_idle_hooks() {
+    dispatching_ = true;
+    run_hooks(Hook::Idle);
+    dispatching_ = false;
+}
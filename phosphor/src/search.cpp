@@ -0,0 +1,200 @@
+#include "../include/search.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Helper to append base plus the start of every match of needle in hay,
+// returns false once out holds limit matches
+static bool find_all(std::string_view hay, std::string_view needle,
+                     std::size_t base, std::vector<std::size_t> &out,
+                     std::size_t limit) {
+    const std::size_t m = needle.size();
+    if (m == 0 || hay.size() < m) {
+        return true;
+    }
+    const char *data = hay.data();
+    const std::size_t last = hay.size() - m;
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // We load the 16 bytes a match could start at and the 16 bytes it would
+    // end at, a candidate has to have both the first and the last byte
+    const __m128i first = _mm_set1_epi8(needle.front());
+    const __m128i tail = _mm_set1_epi8(needle.back());
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i b = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(data + i + m - 1));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, tail))));
+        while (mask) {
+            std::size_t at = i + static_cast<std::size_t>(__builtin_ctz(mask));
+            mask &= mask - 1;
+            if (m <= 2 || std::memcmp(data + at + 1, needle.data() + 1,
+                                      m - 2) == 0) {
+                out.push_back(base + at);
+                if (out.size() >= limit) {
+                    return false;
+                }
+            }
+        }
+    }
+#endif
+    // The rest, or everything without SSE2, hops between first bytes with
+    // memchr
+    while (i <= last) {
+        const void *hit = std::memchr(data + i, needle.front(), last + 1 - i);
+        if (!hit) {
+            break;
+        }
+        std::size_t at = static_cast<const char *>(hit) - data;
+        if (std::memcmp(data + at, needle.data(), m) == 0) {
+            out.push_back(base + at);
+            if (out.size() >= limit) {
+                return false;
+            }
+        }
+        i = at + 1;
+    }
+    return true;
+}
+
+// Method to collect every match in the document
+bool find_matches(const TextStorage &buf, std::string_view query,
+                  std::vector<std::size_t> &out, std::size_t limit) {
+    const std::size_t m = query.size();
+    if (m == 0) {
+        return true;
+    }
+    // tail holds the last m - 1 bytes we have seen, a match that starts in
+    // it and runs into the chunk is found by searching the seam
+    // Matches that end inside the tail were already found, and ones that
+    // run past a short chunk are found at the next seam
+    std::string tail;
+    std::string seam;
+    std::vector<std::size_t> seam_hits;
+    std::size_t base = 0;
+    bool complete = true;
+    buf.for_each_chunk(0, buf.size(), [&](std::string_view chunk) {
+        if (!tail.empty()) {
+            seam = tail;
+            seam.append(chunk.substr(0, m - 1));
+            seam_hits.clear();
+            find_all(seam, query, base - tail.size(), seam_hits, limit);
+            for (std::size_t at : seam_hits) {
+                if (at < base && at + m > base && out.size() < limit) {
+                    out.push_back(at);
+                }
+            }
+        }
+        if (out.size() >= limit || !find_all(chunk, query, base, out, limit)) {
+            complete = false;
+            return false;
+        }
+        // Small chunks (pieces of a piece table) can be shorter than the
+        // query, so the tail can span several of them
+        if (chunk.size() >= m - 1) {
+            tail.assign(chunk.substr(chunk.size() - (m - 1)));
+        } else {
+            tail.append(chunk);
+            tail.erase(0, tail.size() > m - 1 ? tail.size() - (m - 1) : 0);
+        }
+        base += chunk.size();
+        return true;
+    });
+    return complete;
+}
+
+// Method to search for a query
+void Search::update(const TextStorage &buf, std::string_view query) {
+    ProfileScope scope("search");
+    bool grew = valid_ && !truncated_ && !query_.empty() &&
+                query.size() > query_.size() &&
+                query.compare(0, query_.size(), query_) == 0;
+    bool same = valid_ && query == query_;
+    query_ = query;
+    if (same) {
+        return;
+    }
+    if (grew) {
+        refine(buf);
+    } else {
+        scan(buf);
+    }
+    valid_ = true;
+}
+
+void Search::invalidate() noexcept { valid_ = false; }
+
+void Search::clear() noexcept {
+    query_.clear();
+    matches_.clear();
+    valid_ = false;
+    truncated_ = false;
+}
+
+const std::string &Search::query() const noexcept { return query_; }
+
+const std::vector<std::size_t> &Search::matches() const noexcept {
+    return matches_;
+}
+
+bool Search::truncated() const noexcept { return truncated_; }
+
+std::size_t Search::next(std::size_t pos) const noexcept {
+    if (matches_.empty()) {
+        return NONE;
+    }
+    auto it = std::lower_bound(matches_.begin(), matches_.end(), pos);
+    return it == matches_.end() ? 0 : it - matches_.begin();
+}
+
+std::size_t Search::prev(std::size_t pos) const noexcept {
+    if (matches_.empty()) {
+        return NONE;
+    }
+    auto it = std::lower_bound(matches_.begin(), matches_.end(), pos);
+    return it == matches_.begin() ? matches_.size() - 1
+                                  : (it - matches_.begin()) - 1;
+}
+
+// Helper method to scan the whole document for the query
+void Search::scan(const TextStorage &buf) {
+    matches_.clear();
+    truncated_ = !find_matches(buf, query_, matches_, MAX_MATCHES);
+}
+
+// Helper method to keep the old matches that still match the longer query
+// We walk the chunks once in step with the sorted matches, so checking a
+// match is a memcmp unless it runs off the end of its chunk
+void Search::refine(const TextStorage &buf) {
+    const std::size_t m = query_.size();
+    std::size_t kept = 0;
+    std::size_t k = 0;
+    std::size_t base = 0;
+    buf.for_each_chunk(0, buf.size(), [&](std::string_view chunk) {
+        std::size_t end = base + chunk.size();
+        for (; k < matches_.size() && matches_[k] < end; ++k) {
+            std::size_t at = matches_[k];
+            bool hit = false;
+            if (at - base + m <= chunk.size()) {
+                hit = std::memcmp(chunk.data() + (at - base), query_.data(),
+                                  m) == 0;
+            } else if (at + m <= buf.size()) {
+                buf.copy(at, m, scratch_);
+                hit = scratch_ == query_;
+            }
+            if (hit) {
+                matches_[kept++] = at;
+            }
+        }
+        base = end;
+        return k < matches_.size();
+    });
+    matches_.resize(kept);
+}
@@ -0,0 +1,170 @@
+#include "../include/spill_writer.hpp"
+#include "../include/cache_dir.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// We write this much at a time and look for a cancel in between
+static constexpr std::size_t SLICE = 8ull << 20;
+
+// Helper to write all of a slice, write may stop part way through
+static bool write_all(int fd, const char *data, std::size_t n) {
+    while (n > 0) {
+        ssize_t done = ::write(fd, data, n);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += done;
+        n -= static_cast<std::size_t>(done);
+    }
+    return true;
+}
+
+// SpillWriter constructor - the thread starts after every member is ready
+SpillWriter::SpillWriter() : thread_(&SpillWriter::run, this) {}
+
+// Destructor - spill files only mean something to this process
+SpillWriter::~SpillWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        queue_.clear();
+        cancel_ = writing_;
+    }
+    cv_.notify_all();
+    thread_.join();
+    std::error_code ec;
+    for (const SpillDone &done : done_) {
+        std::filesystem::remove(done.path, ec);
+    }
+}
+
+// Method to queue a document's parts
+void SpillWriter::submit(std::size_t doc, Snapshot parts) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({doc, std::move(parts)});
+    }
+    cv_.notify_all();
+}
+
+// Method to collect a finished spill
+std::optional<SpillDone> SpillWriter::poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (done_.empty()) {
+        return std::nullopt;
+    }
+    SpillDone done = std::move(done_.front());
+    done_.pop_front();
+    return done;
+}
+
+// Method to drop a document's spill wherever it is
+// A queued one is forgotten, one being written stops at the next slice and a
+// finished one has its file removed
+void SpillWriter::cancel(std::size_t doc) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_.erase(std::remove_if(queue_.begin(), queue_.end(),
+                                [doc](const Job &job) {
+                                    return job.doc == doc;
+                                }),
+                 queue_.end());
+    if (writing_ == doc) {
+        cancel_ = doc;
+        cv_.wait(lock, [this, doc] { return writing_ != doc; });
+        cancel_ = NONE;
+    }
+    std::error_code ec;
+    for (auto it = done_.begin(); it != done_.end();) {
+        if (it->doc == doc) {
+            std::filesystem::remove(it->path, ec);
+            it = done_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// The worker's loop, we sleep until there is a job or we are told to stop
+void SpillWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return !queue_.empty() || stop_; });
+        if (queue_.empty()) {
+            return;
+        }
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        writing_ = job.doc;
+        // We let go of the lock while writing so the workspace can keep
+        // queuing and cancelling
+        lock.unlock();
+        std::filesystem::path target;
+        bool ok = write(job, target);
+        lock.lock();
+        writing_ = NONE;
+        // A failed write already removed its file
+        if (cancel_ != job.doc) {
+            done_.push_back({job.doc, target, ok});
+        } else if (ok) {
+            std::error_code ec;
+            std::filesystem::remove(target, ec);
+        }
+        cv_.notify_all();
+    }
+}
+
+// Method doing the actual spill, this runs on the worker thread
+// The file may hold a copy of a file only its owner can read, so it is made
+// 0600 in a 0700 directory, O_EXCL and O_NOFOLLOW make sure it is a new file
+// of ours and not something planted under the name
+// On failure the file is removed so a failed spill leaves nothing behind
+bool SpillWriter::write(const Job &job, std::filesystem::path &target) {
+    ProfileScope scope("spill");
+    std::filesystem::path dir = cache_dir("spill");
+    if (!private_dir(dir)) {
+        std::cerr << "Could not create a private " << dir << std::endl;
+        return false;
+    }
+    int fd = -1;
+    // Names only clash with a file a crashed editor with our pid left behind
+    while (fd < 0) {
+        target = dir / (std::to_string(::getpid()) + "-" +
+                        std::to_string(next_++) + ".txt");
+        fd = ::open(target.c_str(),
+                    O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                    0600);
+        if (fd < 0 && errno != EEXIST) {
+            std::cerr << "Could not create " << target << ": "
+                      << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    bool ok = true;
+    for (std::string_view part : job.parts.parts) {
+        for (std::size_t at = 0; ok && at < part.size(); at += SLICE) {
+            std::size_t n = std::min(SLICE, part.size() - at);
+            ok = write_all(fd, part.data() + at, n) && cancel_ != job.doc;
+        }
+    }
+    ok = ::close(fd) == 0 && ok;
+    if (!ok) {
+        if (cancel_ != job.doc) {
+            std::cerr << "Could not write " << target << std::endl;
+        }
+        std::error_code ec;
+        std::filesystem::remove(target, ec);
+    }
+    return ok;
+}
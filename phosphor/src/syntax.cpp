@@ -0,0 +1,348 @@
+#include "../include/syntax.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <string>
+
+// C states, what an unfinished line leaves open
+static constexpr LexState C_NORMAL = 0;
+static constexpr LexState C_COMMENT = 1;
+static constexpr LexState C_STRING = 2;
+
+// Lua states, the low byte says what is open and the bits above it hold the
+// level of a long bracket or the quote of a string continued with a backslash
+static constexpr LexState LUA_NORMAL = 0;
+static constexpr LexState LUA_COMMENT = 1;
+static constexpr LexState LUA_LONG_STRING = 2;
+static constexpr LexState LUA_STRING = 3;
+
+// Word lists, each sorted so a lookup is a binary search
+static constexpr std::array<std::string_view, 73> C_KEYWORDS = {
+    "_Alignas", "_Atomic", "_Bool", "_Generic", "_Noreturn", "_Static_assert",
+    "_Thread_local", "alignas", "alignof", "asm", "break", "case", "catch",
+    "class", "co_await", "co_return", "co_yield", "concept", "const",
+    "const_cast", "consteval", "constexpr", "constinit", "continue",
+    "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum",
+    "explicit", "export", "extern", "final", "for", "friend", "goto", "if",
+    "inline", "mutable", "namespace", "new", "noexcept", "operator",
+    "override", "private", "protected", "public", "register",
+    "reinterpret_cast", "requires", "restrict", "return", "sizeof", "static",
+    "static_assert", "static_cast", "struct", "switch", "template", "this",
+    "thread_local", "throw", "try", "typedef", "typeid", "typename", "union",
+    "using", "virtual", "volatile", "while"};
+
+static constexpr std::array<std::string_view, 28> C_TYPES = {
+    "auto", "bool", "char", "char16_t", "char32_t", "char8_t", "double",
+    "float", "int", "int16_t", "int32_t", "int64_t", "int8_t", "intptr_t",
+    "long", "ptrdiff_t", "short", "signed", "size_t", "ssize_t", "uint16_t",
+    "uint32_t", "uint64_t", "uint8_t", "uintptr_t", "unsigned", "void",
+    "wchar_t"};
+
+static constexpr std::array<std::string_view, 4> C_CONSTANTS = {
+    "NULL", "false", "nullptr", "true"};
+
+static constexpr std::array<std::string_view, 19> LUA_KEYWORDS = {
+    "and", "break", "do", "else", "elseif", "end", "for", "function", "goto",
+    "if", "in", "local", "not", "or", "repeat", "return", "then", "until",
+    "while"};
+
+static constexpr std::array<std::string_view, 3> LUA_CONSTANTS = {
+    "false", "nil", "true"};
+
+// Helper to look a word up in one of the sorted lists
+template <std::size_t N>
+static bool listed(const std::array<std::string_view, N> &words,
+                   std::string_view word) {
+    return std::binary_search(words.begin(), words.end(), word);
+}
+
+// Identifiers may hold anything past ASCII so UTF-8 names stay one word
+static bool ident_start(char c) {
+    auto u = static_cast<unsigned char>(c);
+    return std::isalpha(u) || c == '_' || u >= 0x80;
+}
+
+static bool ident(char c) {
+    auto u = static_cast<unsigned char>(c);
+    return std::isalnum(u) || c == '_' || u >= 0x80;
+}
+
+static bool digit(char c) {
+    return std::isdigit(static_cast<unsigned char>(c)) != 0;
+}
+
+// Helper to add a span, a run that carries straight on from the last span of
+// the same kind extends it instead
+static void push(std::vector<Span> &out, std::size_t start, std::size_t end,
+                 Token kind) {
+    if (end <= start) {
+        return;
+    }
+    if (!out.empty() && out.back().kind == kind &&
+        out.back().start + out.back().len == start) {
+        out.back().len += static_cast<std::uint32_t>(end - start);
+        return;
+    }
+    out.push_back({static_cast<std::uint32_t>(start),
+                   static_cast<std::uint32_t>(end - start), kind});
+}
+
+// Helper to find the end of a quoted string that starts at i, just past the
+// opening quote, closed tells if the closing quote was on this line
+static std::size_t quoted(std::string_view line, std::size_t i, char quote,
+                          bool &closed) {
+    closed = false;
+    while (i < line.size()) {
+        if (line[i] == '\\') {
+            i += 2;
+        } else if (line[i++] == quote) {
+            closed = true;
+            return i;
+        }
+    }
+    return line.size();
+}
+
+// Helper to find the end of a number, digits, letters for hex digits and
+// suffixes, dots, C++ digit separators and the sign of an exponent
+static std::size_t number(std::string_view line, std::size_t i) {
+    while (i < line.size()) {
+        char c = line[i];
+        char prev = line[i - 1];
+        bool exponent = (c == '+' || c == '-') &&
+                        (prev == 'e' || prev == 'E' || prev == 'p' ||
+                         prev == 'P');
+        if (!ident(c) && c != '.' && c != '\'' && !exponent) {
+            break;
+        }
+        ++i;
+    }
+    return i;
+}
+
+static std::size_t word_end(std::string_view line, std::size_t i) {
+    while (i < line.size() && ident(line[i])) {
+        ++i;
+    }
+    return i;
+}
+
+const char *CLexer::name() const noexcept { return "C/C++"; }
+
+// Method to lex a line of C or C++
+LexState CLexer::lex(std::string_view line, LexState state,
+                     std::vector<Span> &out) const {
+    const std::size_t n = line.size();
+    std::size_t i = 0;
+    // We first finish whatever the line before left open
+    if (state == C_COMMENT) {
+        std::size_t end = line.find("*/");
+        if (end == std::string_view::npos) {
+            push(out, 0, n, Token::Comment);
+            return C_COMMENT;
+        }
+        i = end + 2;
+        push(out, 0, i, Token::Comment);
+    } else if (state == C_STRING) {
+        bool closed;
+        i = quoted(line, 0, '"', closed);
+        push(out, 0, i, Token::String);
+        if (!closed && n > 0 && line.back() == '\\') {
+            return C_STRING;
+        }
+    }
+    // A directive is a # first thing on the line, an include's path is
+    // colored like a string
+    std::size_t hash = line.find_first_not_of(" \t", i);
+    if (state == C_NORMAL && hash != std::string_view::npos &&
+        line[hash] == '#') {
+        std::size_t start = line.find_first_not_of(" \t", hash + 1);
+        std::size_t end = start == std::string_view::npos
+                              ? n
+                              : word_end(line, start);
+        push(out, hash, end, Token::Preprocessor);
+        i = end;
+        std::size_t path = line.find_first_not_of(" \t", i);
+        if (line.substr(hash, end - hash).find("include") !=
+                std::string_view::npos &&
+            path != std::string_view::npos && line[path] == '<') {
+            std::size_t close = line.find('>', path);
+            i = close == std::string_view::npos ? n : close + 1;
+            push(out, path, i, Token::String);
+        }
+    }
+    while (i < n) {
+        char c = line[i];
+        char next = i + 1 < n ? line[i + 1] : '\0';
+        if (c == '/' && next == '/') {
+            push(out, i, n, Token::Comment);
+            return C_NORMAL;
+        }
+        if (c == '/' && next == '*') {
+            std::size_t end = line.find("*/", i + 2);
+            if (end == std::string_view::npos) {
+                push(out, i, n, Token::Comment);
+                return C_COMMENT;
+            }
+            push(out, i, end + 2, Token::Comment);
+            i = end + 2;
+        } else if (c == '"' || c == '\'') {
+            bool closed;
+            std::size_t end = quoted(line, i + 1, c, closed);
+            push(out, i, end, Token::String);
+            // Only a string literal may run on to the next line
+            if (!closed && c == '"' && line.back() == '\\') {
+                return C_STRING;
+            }
+            i = end;
+        } else if (digit(c) || (c == '.' && digit(next))) {
+            std::size_t end = number(line, i + 1);
+            push(out, i, end, Token::Number);
+            i = end;
+        } else if (ident_start(c)) {
+            std::size_t end = word_end(line, i);
+            std::string_view word = line.substr(i, end - i);
+            if (listed(C_KEYWORDS, word)) {
+                push(out, i, end, Token::Keyword);
+            } else if (listed(C_TYPES, word)) {
+                push(out, i, end, Token::Type);
+            } else if (listed(C_CONSTANTS, word)) {
+                push(out, i, end, Token::Number);
+            }
+            i = end;
+        } else {
+            ++i;
+        }
+    }
+    return C_NORMAL;
+}
+
+// Helper to read a Lua long bracket opening at i, [[ or [= ... =[, returns
+// its level or -1 if there is none
+static int long_bracket(std::string_view line, std::size_t i) {
+    if (i >= line.size() || line[i] != '[') {
+        return -1;
+    }
+    std::size_t j = i + 1;
+    while (j < line.size() && line[j] == '=') {
+        ++j;
+    }
+    if (j >= line.size() || line[j] != '[') {
+        return -1;
+    }
+    return static_cast<int>(j - i - 1);
+}
+
+// Helper to find the end of the closing bracket of the given level
+static std::size_t long_close(std::string_view line, std::size_t i,
+                              LexState level) {
+    std::string close = "]" + std::string(level, '=') + "]";
+    std::size_t at = line.find(close, i);
+    return at == std::string_view::npos ? at : at + close.size();
+}
+
+const char *LuaLexer::name() const noexcept { return "Lua"; }
+
+// Method to lex a line of Lua
+LexState LuaLexer::lex(std::string_view line, LexState state,
+                       std::vector<Span> &out) const {
+    const std::size_t n = line.size();
+    std::size_t i = 0;
+    LexState mode = state & 0xff;
+    LexState extra = state >> 8;
+    // We first finish whatever the line before left open
+    if (mode == LUA_COMMENT || mode == LUA_LONG_STRING) {
+        Token kind = mode == LUA_COMMENT ? Token::Comment : Token::String;
+        std::size_t end = long_close(line, 0, extra);
+        if (end == std::string_view::npos) {
+            push(out, 0, n, kind);
+            return state;
+        }
+        push(out, 0, end, kind);
+        i = end;
+    } else if (mode == LUA_STRING) {
+        bool closed;
+        i = quoted(line, 0, static_cast<char>(extra), closed);
+        push(out, 0, i, Token::String);
+        if (!closed && n > 0 && line.back() == '\\') {
+            return state;
+        }
+    }
+    while (i < n) {
+        char c = line[i];
+        char next = i + 1 < n ? line[i + 1] : '\0';
+        if (c == '-' && next == '-') {
+            // A comment is a long comment if a long bracket follows it
+            int level = long_bracket(line, i + 2);
+            if (level < 0) {
+                push(out, i, n, Token::Comment);
+                return LUA_NORMAL;
+            }
+            auto lvl = static_cast<LexState>(level);
+            std::size_t end = long_close(line, i + 4 + lvl, lvl);
+            if (end == std::string_view::npos) {
+                push(out, i, n, Token::Comment);
+                return LUA_COMMENT | (lvl << 8);
+            }
+            push(out, i, end, Token::Comment);
+            i = end;
+        } else if (int level = long_bracket(line, i); level >= 0) {
+            auto lvl = static_cast<LexState>(level);
+            std::size_t end = long_close(line, i + 2 + lvl, lvl);
+            if (end == std::string_view::npos) {
+                push(out, i, n, Token::String);
+                return LUA_LONG_STRING | (lvl << 8);
+            }
+            push(out, i, end, Token::String);
+            i = end;
+        } else if (c == '"' || c == '\'') {
+            bool closed;
+            std::size_t end = quoted(line, i + 1, c, closed);
+            push(out, i, end, Token::String);
+            if (!closed && line.back() == '\\') {
+                return LUA_STRING |
+                       (static_cast<LexState>(static_cast<unsigned char>(c))
+                        << 8);
+            }
+            i = end;
+        } else if (digit(c) || (c == '.' && digit(next))) {
+            std::size_t end = number(line, i + 1);
+            push(out, i, end, Token::Number);
+            i = end;
+        } else if (ident_start(c)) {
+            std::size_t end = word_end(line, i);
+            std::string_view word = line.substr(i, end - i);
+            if (listed(LUA_KEYWORDS, word)) {
+                push(out, i, end, Token::Keyword);
+            } else if (listed(LUA_CONSTANTS, word)) {
+                push(out, i, end, Token::Number);
+            }
+            i = end;
+        } else {
+            ++i;
+        }
+    }
+    return LUA_NORMAL;
+}
+
+// Helper to pick a lexer from the extension, the lexers are stateless so
+// every file of a language shares one
+const Lexer *lexer_for(const std::filesystem::path &file) {
+    static const CLexer C;
+    static const LuaLexer LUA;
+    std::string ext = file.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    static constexpr std::array<std::string_view, 9> C_EXTENSIONS = {
+        ".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx", ".inl"};
+    if (std::find(C_EXTENSIONS.begin(), C_EXTENSIONS.end(), ext) !=
+        C_EXTENSIONS.end()) {
+        return &C;
+    }
+    if (ext == ".lua") {
+        return &LUA;
+    }
+    return nullptr;
+}
@@ -0,0 +1,324 @@
+#include "../include/text_storage.hpp"
+#include "../include/gap_buffer.hpp"
+#include "../include/piece_table.hpp"
+#include "../include/utf8.hpp"
+
+#include <array>
+#include <cstring>
+
+// By default there is nothing to prepare
+void TextStorage::reserve(std::size_t) {}
+
+// By default we write the new document out once and swap it in as a single
+// erase and insert, which is still one pass however many matches there are
+void TextStorage::replace_matches(const std::vector<std::size_t> &at,
+                                  std::size_t len, std::string_view with) {
+    if (at.empty()) {
+        return;
+    }
+    std::string fresh(replaced_size(at.size(), len, with), '\0');
+    write_replaced(at, len, with, fresh.data());
+    set_cursor(size());
+    erase_back(size());
+    reserve(fresh.size());
+    insert(fresh);
+}
+
+// Method to insert a single character
+void TextStorage::insert(char c) { insert(std::string_view(&c, 1)); }
+
+// Method to move the cursor
+void TextStorage::move_cursor(long long delta) {
+    // We get our cursors position
+    long long pos = static_cast<long long>(cursor());
+    // We get the limit of our buffer
+    long long limit = static_cast<long long>(size());
+    // We clamp the pos + delta and our lower bound is 0 and upper bound is
+    // the size of the buffer this prevent us from going out of bounds
+    long long new_pos = std::clamp(pos + delta, 0LL, limit);
+    set_cursor(static_cast<size_t>(new_pos));
+}
+
+// Helper to decode the character starting at pos, the bytes may straddle two
+// chunks so we gather the few we need first
+static int codepoint_at(const TextStorage &buf, std::size_t pos) {
+    std::array<char, 4> bytes{};
+    std::size_t n = 0;
+    buf.for_each_chunk(pos, std::min<std::size_t>(4, buf.size() - pos),
+                       [&](std::string_view chunk) {
+                           for (char c : chunk) {
+                               bytes[n++] = c;
+                           }
+                           return true;
+                       });
+    int cp = 0;
+    utf8::decode(std::string_view(bytes.data(), n), cp);
+    return cp;
+}
+
+// Method to return the start of the character after the one at pos
+std::size_t TextStorage::next_char(std::size_t pos) const {
+    if (pos >= size()) {
+        return size();
+    }
+    // The next character starts at the first byte past pos that is not a
+    // continuation byte
+    std::size_t out = size();
+    std::size_t base = pos + 1;
+    for_each_chunk(base, size() - base, [&](std::string_view chunk) {
+        std::size_t n = 0;
+        std::size_t at = utf8::nth(chunk, n);
+        if (at < chunk.size()) {
+            out = base + at;
+            return false;
+        }
+        base += chunk.size();
+        return true;
+    });
+    return out;
+}
+
+// Method to return the start of the character before pos
+std::size_t TextStorage::prev_char(std::size_t pos) const {
+    pos = std::min(pos, size());
+    // Chunks only walk forwards, so we read small windows backwards until
+    // one of them holds a byte that starts a character
+    std::array<char, 16> window{};
+    while (pos > 0) {
+        std::size_t start = pos > window.size() ? pos - window.size() : 0;
+        std::size_t n = 0;
+        for_each_chunk(start, pos - start, [&](std::string_view chunk) {
+            std::copy(chunk.begin(), chunk.end(), window.begin() + n);
+            n += chunk.size();
+            return true;
+        });
+        for (std::size_t i = n; i-- > 0;) {
+            if (!utf8::continuation(window[i])) {
+                return start + i;
+            }
+        }
+        pos = start;
+    }
+    return 0;
+}
+
+// Method to return the start of the grapheme after the one at pos
+// Combining marks and anything glued on with a zero width joiner move with
+// the character they belong to, as does the '\n' of a "\r\n"
+std::size_t TextStorage::next_grapheme(std::size_t pos) const {
+    if (pos >= size()) {
+        return size();
+    }
+    int prev = codepoint_at(*this, pos);
+    pos = next_char(pos);
+    while (pos < size()) {
+        int cp = codepoint_at(*this, pos);
+        if (!utf8::extends_grapheme(cp) && prev != 0x200D &&
+            !(prev == '\r' && cp == '\n')) {
+            break;
+        }
+        prev = cp;
+        pos = next_char(pos);
+    }
+    return pos;
+}
+
+// Method to return the start of the grapheme before pos
+std::size_t TextStorage::prev_grapheme(std::size_t pos) const {
+    pos = prev_char(pos);
+    while (pos > 0) {
+        int cp = codepoint_at(*this, pos);
+        std::size_t before = prev_char(pos);
+        int prev = codepoint_at(*this, before);
+        if (!utf8::extends_grapheme(cp) && prev != 0x200D &&
+            !(prev == '\r' && cp == '\n')) {
+            break;
+        }
+        pos = before;
+    }
+    return pos;
+}
+
+// Method to test if the container is empty
+bool TextStorage::empty() const noexcept { return size() == 0; }
+
+// Method to return the offset of the newline that ends a line, or the size of
+// the text for the last line
+std::size_t TextStorage::line_end(std::size_t line) const {
+    return line + 1 < line_count() ? line_start(line + 1) - 1 : size();
+}
+
+// Method to return the length of a line without its newline
+std::size_t TextStorage::line_length(std::size_t line) const {
+    return line_end(line) - line_start(line);
+}
+
+// Method to convert an offset into a line and column pair
+LineCol TextStorage::position(std::size_t offset) const {
+    offset = std::min(offset, size());
+    std::size_t line = line_of(offset);
+    return {line, offset - line_start(line)};
+}
+
+// Method to convert a line and column into an offset, the column is clamped
+// to the length of the line
+std::size_t TextStorage::offset(std::size_t line, std::size_t col) const {
+    return line_start(line) + std::min(col, line_length(line));
+}
+
+// Method to return how many characters come before offset on its line
+std::size_t TextStorage::column(std::size_t offset) const {
+    offset = std::min(offset, size());
+    std::size_t start = line_start(line_of(offset));
+    std::size_t col = 0;
+    for_each_chunk(start, offset - start, [&col](std::string_view chunk) {
+        col += utf8::count(chunk);
+        return true;
+    });
+    return col;
+}
+
+// Method to convert a line and a column in characters into an offset, the
+// column is clamped to the length of the line
+// Long lines are skipped a block at a time by counting character starts
+std::size_t TextStorage::offset_at_column(std::size_t line,
+                                          std::size_t col) const {
+    std::size_t base = line_start(line);
+    std::size_t out = base + line_length(line);
+    for_each_chunk(base, line_length(line), [&](std::string_view chunk) {
+        std::size_t at = utf8::nth(chunk, col);
+        if (at < chunk.size()) {
+            out = base + at;
+            return false;
+        }
+        base += chunk.size();
+        return true;
+    });
+    return out;
+}
+
+// Method to copy part of the contents into a string, the string's capacity is
+// reused so callers can keep a scratch string around
+void TextStorage::copy(std::size_t pos, std::size_t len,
+                       std::string &out) const {
+    out.clear();
+    for_each_chunk(pos, len, [&out](std::string_view chunk) {
+        out.append(chunk);
+        return true;
+    });
+}
+
+// Method to view the contiguous bytes that start at pos, at most max of them
+// Nothing is copied, the view is valid until the next edit, and walking a
+// range with it visits the same pieces for_each_chunk does
+std::string_view TextStorage::chunk_at(std::size_t pos,
+                                       std::size_t max) const {
+    std::string_view out;
+    if (pos >= size()) {
+        return out;
+    }
+    for_each_chunk(pos, std::min(max, size() - pos),
+                   [&out](std::string_view chunk) {
+                       out = chunk;
+                       return false;
+                   });
+    return out;
+}
+
+// By default we apply the edits back to front, so the offsets of the ones
+// still to come are not moved by the ones already done
+// This suits the piece table where an edit anywhere is O(log n)
+void TextStorage::splice(const std::vector<Splice> &edits) {
+    for (auto it = edits.rbegin(); it != edits.rend(); ++it) {
+        set_cursor(it->pos + it->len);
+        erase_back(it->len);
+        insert(it->text);
+    }
+}
+
+// Method to write the document with every match replaced
+// We walk the chunks once in step with the sorted matches, so the whole thing
+// is one sequential read and one sequential write
+void TextStorage::write_replaced(const std::vector<std::size_t> &at,
+                                 std::size_t len, std::string_view with,
+                                 char *out) const {
+    std::size_t k = 0;
+    // Bytes of a match still to be skipped, a match can span chunks
+    std::size_t skip = 0;
+    std::size_t base = 0;
+    for_each_chunk(0, size(), [&](std::string_view chunk) {
+        std::size_t p = base;
+        std::size_t end = base + chunk.size();
+        while (p < end) {
+            if (skip) {
+                std::size_t n = std::min(skip, end - p);
+                p += n;
+                skip -= n;
+                continue;
+            }
+            std::size_t stop = k < at.size() ? std::min(at[k], end) : end;
+            std::memcpy(out, chunk.data() + (p - base), stop - p);
+            out += stop - p;
+            p = stop;
+            if (k < at.size() && at[k] == p) {
+                std::memcpy(out, with.data(), with.size());
+                out += with.size();
+                skip = len;
+                ++k;
+            }
+        }
+        base = end;
+        return true;
+    });
+    // Empty matches (undoing a replace with nothing) can sit at the very end
+    // where no chunk reaches them
+    for (; k < at.size(); ++k) {
+        std::memcpy(out, with.data(), with.size());
+        out += with.size();
+    }
+}
+
+// Method to return how big the document is once every match is replaced
+std::size_t TextStorage::replaced_size(std::size_t matches, std::size_t len,
+                                       std::string_view with) const noexcept {
+    return size() - matches * len + matches * with.size();
+}
+
+// Method to convert the contents to a string
+// This flattens the whole document so prefer for_each_chunk for reading
+std::string TextStorage::str() const {
+    std::string out;
+    out.reserve(size());
+    copy(0, size(), out);
+    return out;
+}
+
+// Method to freeze the document by copying it into one shared string
+Snapshot TextStorage::snapshot() const {
+    auto text = std::make_shared<std::string>(str());
+    Snapshot snap;
+    snap.parts.push_back(*text);
+    snap.size = text->size();
+    snap.owners.push_back(std::move(text));
+    return snap;
+}
+
+// Factory for the storage engines
+std::unique_ptr<TextStorage> make_storage(StorageKind kind,
+                                          std::string_view text,
+                                          std::shared_ptr<const void> owner) {
+    switch (kind) {
+    case StorageKind::Piece:
+        return std::make_unique<PieceTable>(text, std::move(owner));
+    case StorageKind::Gap:
+    default:
+        return std::make_unique<GapBuffer>(text);
+    }
+}
+
+// Small files are cheap to memmove around so the gap buffer wins there, very
+// large files go to the piece table so jumps and growth never copy the file
+StorageKind pick_storage(std::size_t file_size) noexcept {
+    return file_size >= PIECE_TABLE_THRESHOLD ? StorageKind::Piece
+                                              : StorageKind::Gap;
+}
@@ -1,18 +1,96 @@
 #include "../include/ui.hpp"
+#include "../include/profiler.hpp"
+
+#include <chrono>
 
 // UI Constructor
 UI::UI() {
-    // We need to load in our font
-    title_font_ = LoadFont(
-        "JetBrainsMono-2.304/fonts/ttf/JetBrainsMono-ExtraBoldItalic.ttf");
-    text_font_ =
-        LoadFont("JetBrainsMono-2.304/fonts/ttf/JetBrainsMono-Medium.ttf");
+    // We need to load in our font, the atlases come from the cache when the
+    // fonts have not changed since the last run
+    auto start = std::chrono::steady_clock::now();
+    title_font_.load(
+        "JetBrainsMono-2.304/fonts/ttf/JetBrainsMono-ExtraBoldItalic.ttf",
+        FONT_BASE_SIZE);
+    text_font_.load("JetBrainsMono-2.304/fonts/ttf/JetBrainsMono-Medium.ttf",
+                    FONT_BASE_SIZE);
+    std::chrono::duration<double, std::milli> took =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "Loaded fonts ("
+              << (title_font_.from_cache() && text_font_.from_cache()
+                      ? "cached atlas"
+                      : "rasterized")
+              << ") in " << took.count() << " ms" << std::endl;
+    // Every line is measured with the text font, the cache notices that the
+    // bundled font is monospaced and skips per glyph data for ASCII lines
+    layout_.configure(text_font_, text_size_, text_spacing_);
+    // A headless replay has no window and never paints
+    if (IsWindowReady()) {
+        canvas_ = LoadRenderTexture(GetScreenWidth(), GetScreenHeight());
+    }
+    tint_tokens();
 }
 
-// Destructor - We need to offload the font resources
+// Destructor - The atlases free their own textures
 UI::~UI() {
-    UnloadFont(title_font_);
-    UnloadFont(text_font_);
+    if (canvas_.id != 0) {
+        UnloadRenderTexture(canvas_);
+    }
+}
+
+// Method to mark a range of document lines as changed
+void Damage::lines(std::size_t from, std::size_t to) noexcept {
+    if (first > last) {
+        first = from;
+        last = to;
+    } else {
+        first = std::min(first, from);
+        last = std::max(last, to);
+    }
+}
+
+// Method to mark a single document line as changed
+void Damage::line(std::size_t n) noexcept { lines(n, n); }
+
+bool Damage::any() const noexcept {
+    return full || header || overlay || first <= last;
+}
+
+void Damage::reset() noexcept {
+    full = false;
+    header = false;
+    overlay = false;
+    first = 1;
+    last = 0;
+}
+
+// Method to start painting into the canvas
+void UI::begin_paint() const { BeginTextureMode(canvas_); }
+
+// Method to finish painting into the canvas
+// Repainted lines can cover the rounded corners of the frame, so we draw its
+// outline again on top, it is opaque so drawing it twice changes nothing
+void UI::end_paint() const {
+    DrawRectangleRoundedLinesEx(frame_, 0.05f, 20, 2, ui_color_);
+    EndTextureMode();
+}
+
+// Method to copy the canvas onto the screen
+// Render textures are stored upside down so we flip the source rectangle
+void UI::present() const {
+    Rectangle src{0.0f, 0.0f, static_cast<float>(canvas_.texture.width),
+                  -static_cast<float>(canvas_.texture.height)};
+    DrawTextureRec(canvas_.texture, src, {0.0f, 0.0f}, WHITE);
+}
+
+// Method to clear the text in the header so the file name can be repainted
+// We stay clear of the line under the header, the header is then drawn again
+// on top, its frame and line are opaque so redrawing them changes nothing
+void UI::clear_header() const {
+    float top = frame_.y + 3.0f;
+    DrawRectangleRec({frame_.x + 10.0f, top, frame_.width - 20.0f,
+                      header_ln_strt_.y - 2.0f - top},
+                     bg_color_);
+    draw_header();
 }
 
 // Wrapper method to draw UI components
@@ -28,32 +106,257 @@ void UI::draw_bg() const { ClearBackground(bg_color_); }
 void UI::draw_header() const {
     DrawRectangleRoundedLinesEx(frame_, 0.05f, 20, 2, ui_color_);
     DrawLineEx(header_ln_strt_, header_ln_end_, 3.0f, ui_color_);
-    DrawTextEx(title_font_, title_, title_pos_, header_size_, text_spacing_,
-               title_color_);
+    title_font_.draw_text(title_, title_pos_, header_size_, text_spacing_,
+                          title_color_);
+    // While a file streams in we show how far along it is
+    if (load_progress_ < 1.0f) {
+        float width = header_ln_end_.x - header_ln_strt_.x - 20.0f;
+        DrawRectangleRec({header_ln_strt_.x + 10.0f, header_ln_strt_.y - 6.0f,
+                          width * load_progress_, 2.0f},
+                         ColorAlpha(ui_color_, 0.7f));
+    }
+}
+
+// Method to return how many lines fit between the header and the frame
+std::size_t UI::visible_lines() const {
+    float height = frame_.y + frame_.height - buffer_pos_.y;
+    return static_cast<std::size_t>(height / line_height_);
 }
 
-// Method to draw the buffer contents onto the screen
-void UI::draw_buffer(const char *str) const {
-    DrawTextEx(text_font_, str, buffer_pos_, text_size_, text_spacing_,
-               text_color_);
+// Method to return how wide the text area is
+float UI::text_width() const { return frame_.x + frame_.width - buffer_pos_.x; }
+
+// Method to draw the visible part of the buffer onto the screen
+// We only walk the lines inside the frame so the cost is bounded by the
+// window size and not by the size of the document
+// Only the rows for document lines first to last are painted, each row is
+// cleared first so this also repaints lines that were already drawn
+void UI::draw_buffer(const TextStorage &buf, std::size_t top_line,
+                     float scroll_x, std::size_t first, std::size_t last,
+                     const Highlights &marks) const {
+    ProfileScope scope("draw_buffer");
+    // Rows past the end of the document still need clearing when the
+    // document got shorter, so we clamp to the viewport and not the document
+    std::size_t bottom = top_line + visible_lines();
+    first = std::max(first, top_line);
+    last = last < bottom ? last + 1 : bottom;
+    if (first >= last) {
+        return;
+    }
+    float width = text_width();
+    // We clip to the text area so nothing bleeds over the frame
+    BeginScissorMode(static_cast<int>(frame_.x),
+                     static_cast<int>(buffer_pos_.y),
+                     static_cast<int>(frame_.width),
+                     static_cast<int>(frame_.y + frame_.height -
+                                      buffer_pos_.y));
+    for (std::size_t line = first; line < last; ++line) {
+        float y = buffer_pos_.y + (line - top_line) * line_height_;
+        DrawRectangleRec({frame_.x + 2.0f, y, frame_.width - 4.0f,
+                          line_height_},
+                         bg_color_);
+        if (line >= buf.line_count()) {
+            continue;
+        }
+        // We draw the line number in the gutter
+        text_font_.draw_text(TextFormat("%zu", line + 1),
+                             {line_idx_xpos_, y + (text_size_ - gutter_size_)},
+                             gutter_size_, text_spacing_,
+                             ColorAlpha(ui_color_, 0.5f));
+        // The cache tells us which bytes of the line are inside the text
+        // area, so we only copy and draw those
+        const LineLayout &layout = layout_.line(buf, line);
+        std::size_t col_first = layout.col_before(scroll_x);
+        std::size_t end = layout.col_at(scroll_x + width);
+        if (end < layout.bytes) {
+            ++end;
+        }
+        if (col_first >= end) {
+            continue;
+        }
+        if (marks.starts && marks.len) {
+            draw_matches(buf, line, layout, y, scroll_x, marks);
+        }
+        if (marks.selections) {
+            draw_selections(buf, line, layout, y, scroll_x, *marks.selections);
+        }
+        buf.copy(buf.line_start(line) + col_first, end - col_first,
+                 line_scratch_);
+        // Spans are sorted, so we walk them along with the glyphs
+        const std::vector<Span> *spans =
+            marks.syntax ? marks.syntax->spans(line) : nullptr;
+        std::size_t span = 0;
+        // We place every glyph where the cache says it goes instead of having
+        // raylib measure the line again
+        for (std::size_t i = 0; i < line_scratch_.size();) {
+            int size = 1;
+            int cp = GetCodepointNext(line_scratch_.c_str() + i, &size);
+            float x = buffer_pos_.x + layout.x_of(col_first + i) - scroll_x;
+            Color color = text_color_;
+            if (spans) {
+                std::size_t at = col_first + i;
+                while (span < spans->size() &&
+                       (*spans)[span].start + (*spans)[span].len <= at) {
+                    ++span;
+                }
+                if (span < spans->size() && (*spans)[span].start <= at) {
+                    color = token_colors_[static_cast<std::size_t>(
+                        (*spans)[span].kind)];
+                }
+            }
+            // A glyph cut by the left edge would spill into the gutter
+            if (cp != ' ' && cp != '\t' && x >= buffer_pos_.x) {
+                text_font_.draw_codepoint(cp, {x, y}, text_size_, color);
+            }
+            i += std::max(size, 1);
+        }
+    }
+    EndScissorMode();
+}
+
+// Helper method to draw the search matches on a line behind its text
+// A match can start on an earlier line only if the query holds a newline,
+// so we look back far enough to catch those too
+void UI::draw_matches(const TextStorage &buf, std::size_t line,
+                      const LineLayout &layout, float y, float scroll_x,
+                      const Highlights &marks) const {
+    std::size_t start = buf.line_start(line);
+    std::size_t end = start + layout.bytes;
+    const std::vector<std::size_t> &starts = *marks.starts;
+    std::size_t from = start >= marks.len ? start - marks.len + 1 : 0;
+    for (auto it = std::lower_bound(starts.begin(), starts.end(), from);
+         it != starts.end() && *it < end; ++it) {
+        std::size_t a = std::max(*it, start) - start;
+        std::size_t b = std::min(*it + marks.len, end) - start;
+        float x = buffer_pos_.x + layout.x_of(a) - scroll_x;
+        Color color = *it == marks.current ? ColorAlpha(title_color_, 0.45f)
+                                           : ColorAlpha(ui_color_, 0.25f);
+        DrawRectangleRec({x, y, layout.x_of(b) - layout.x_of(a), text_size_},
+                         color);
+    }
+}
+
+// Helper method to draw the selections that cross a line behind its text
+// Selections are sorted and do not overlap, so the ones on this line are a
+// run we find with a binary search on where they end
+void UI::draw_selections(const TextStorage &buf, std::size_t line,
+                         const LineLayout &layout, float y, float scroll_x,
+                         const std::vector<Caret> &selections) const {
+    std::size_t start = buf.line_start(line);
+    std::size_t end = start + layout.bytes;
+    auto it = std::lower_bound(
+        selections.begin(), selections.end(), start,
+        [](const Caret &c, std::size_t pos) { return c.end() <= pos; });
+    for (; it != selections.end() && it->start() < end; ++it) {
+        std::size_t a = std::max(it->start(), start) - start;
+        std::size_t b = std::min(it->end(), end) - start;
+        float x = buffer_pos_.x + layout.x_of(a) - scroll_x;
+        DrawRectangleRec({x, y, layout.x_of(b) - layout.x_of(a), text_size_},
+                         ColorAlpha(title_color_, 0.35f));
+    }
 }
 
 // Method to draw the filename to the screen
 void UI::draw_fn(const char *fn) const {
-    DrawTextEx(title_font_, fn, fn_pos_, header_size_, text_spacing_,
-               title_color_);
+    title_font_.draw_text(fn, fn_pos_, header_size_, text_spacing_,
+                          title_color_);
+}
+
+// Method to draw the status line, how the last save went for example
+void UI::draw_status(const char *status) const {
+    text_font_.draw_text(status, status_pos_, text_size_, text_spacing_,
+                         ColorAlpha(ui_color_, 0.7f));
 }
 
 // Method to draw the rename state to screen
 void UI::draw_rename_fn(const char *fn) const {
-    DrawTextEx(text_font_, "Renaming: ", rename_pos_, header_size_,
-               text_spacing_, title_color_);
-    DrawTextEx(text_font_, fn, fn_pos_, header_size_, text_spacing_,
-               title_color_);
+    text_font_.draw_text("Renaming: ", rename_pos_, header_size_,
+                         text_spacing_, title_color_);
+    text_font_.draw_text(fn, fn_pos_, header_size_, text_spacing_,
+                         title_color_);
+}
+
+// Method to draw the search query in the header
+void UI::draw_search(const char *query) const {
+    text_font_.draw_text("Find: ", rename_pos_, header_size_, text_spacing_,
+                         title_color_);
+    text_font_.draw_text(query, fn_pos_, header_size_, text_spacing_,
+                         title_color_);
+}
+
+// Method to draw the cursor as a bar in front of the character it sits on
+void UI::draw_cursor(const TextStorage &buf, std::size_t top_line,
+                     float scroll_x) const {
+    draw_caret(buf, buf.cursor(), top_line, scroll_x);
 }
 
-void UI::draw_cursor() const {
-    // DrawRectangle();
+// Method to draw a cursor bar at any offset, one per cursor when there are
+// several
+void UI::draw_caret(const TextStorage &buf, std::size_t pos,
+                    std::size_t top_line, float scroll_x) const {
+    LineCol at = buf.position(pos);
+    if (at.line < top_line || at.line >= top_line + visible_lines()) {
+        return;
+    }
+    float x = layout_.line(buf, at.line).x_of(at.col) - scroll_x;
+    if (x < 0.0f || x > text_width()) {
+        return;
+    }
+    float y = buffer_pos_.y + (at.line - top_line) * line_height_;
+    DrawRectangleV({buffer_pos_.x + x - 1.0f, y}, {2.0f, text_size_},
+                   title_color_);
+}
+
+// Method to draw the profiler overlay in the top right of the text area
+// This is drawn straight to the screen after the canvas so it never damages
+// the text underneath it
+void UI::draw_profiler(const ProfileSummary &summary) const {
+    const float size = 16.0f;
+    const float row = size + 4.0f;
+    const float graph = 48.0f;
+    const float width = 440.0f;
+    float height = row * (3 + summary.scopes.size()) + graph + 16.0f;
+    Vector2 pos{frame_.x + frame_.width - width - 16.0f, buffer_pos_.y + 8.0f};
+    DrawRectangleRec({pos.x, pos.y, width, height},
+                     ColorAlpha(bg_color_, 0.9f));
+    DrawRectangleLinesEx({pos.x, pos.y, width, height}, 1.0f, ui_color_);
+
+    // The bundled font is monospaced so padding lines up the columns
+    Vector2 at{pos.x + 8.0f, pos.y + 6.0f};
+    auto line = [&](const char *text, Color color) {
+        text_font_.draw_text(text, at, size, 1.0f, color);
+        at.y += row;
+    };
+    line(TextFormat("frame ms  p50 %5.2f  p95 %5.2f  p99 %5.2f  max %5.2f",
+                    summary.frame_p50, summary.frame_p95, summary.frame_p99,
+                    summary.frame_max),
+         title_color_);
+    line(TextFormat("input ms  p50 %5.2f  p95 %5.2f  max %5.2f  (%zu)",
+                    summary.latency_p50, summary.latency_p95,
+                    summary.latency_max, summary.inputs),
+         title_color_);
+    line("scope (last 2 s)     total ms  calls   max ms",
+         ColorAlpha(ui_color_, 0.7f));
+    for (const ProfileSummary::Scope &s : summary.scopes) {
+        line(TextFormat("%-20.20s %9.2f %6zu %8.2f", s.name, s.total_ms,
+                        s.calls, s.max_ms),
+             text_color_);
+    }
+
+    // Every recent frame is a bar, the line marks a 60 Hz frame and anything
+    // taller than two of those is cut off
+    const float budget = 1000.0f / 60.0f;
+    float base = at.y + graph + 4.0f;
+    float bar = (width - 16.0f) / 240.0f;
+    for (std::size_t i = 0; i < summary.recent.size(); ++i) {
+        float h = std::min(summary.recent[i] / (2.0f * budget), 1.0f) * graph;
+        DrawRectangleRec({at.x + i * bar, base - h, std::max(bar, 1.0f), h},
+                         summary.recent[i] > budget ? title_color_
+                                                    : text_color_);
+    }
+    DrawLineEx({at.x, base - graph / 2.0f}, {pos.x + width - 8.0f,
+                                             base - graph / 2.0f},
+               1.0f, ColorAlpha(ui_color_, 0.5f));
 }
 
 // We chose the color palette given the palette type
@@ -68,6 +371,23 @@ void UI::dispatch_palette() {
                  &UI::phosphor_white};
     // We dispatch to the relevant function
     (this->*TABLE[static_cast<std::size_t>(palette_)])();
+    tint_tokens();
+}
+
+// Helper to derive the token colors from the palette
+// Every palette only has a few shades, so keywords get the bright one the
+// title uses and the rest are told apart by the softer ones
+void UI::tint_tokens() noexcept {
+    auto set = [this](Token kind, Color color) {
+        token_colors_[static_cast<std::size_t>(kind)] = color;
+    };
+    set(Token::Text, text_color_);
+    set(Token::Keyword, title_color_);
+    set(Token::Type, ColorAlpha(title_color_, 0.8f));
+    set(Token::String, ui_color_);
+    set(Token::Number, ui_color_);
+    set(Token::Comment, ColorAlpha(ui_color_, 0.5f));
+    set(Token::Preprocessor, title_color_);
 }
 
 // Helper to choose green color palette
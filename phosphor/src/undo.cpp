@@ -0,0 +1,435 @@
+#include "../include/undo.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+// UndoHistory constructor - we only need to know how much memory we may use
+UndoHistory::UndoHistory(std::size_t budget) : budget_(budget) {}
+
+// Method to record text that is about to be inserted at pos
+// Nothing is copied, the bytes are still in the document if we ever need them
+void UndoHistory::record_insert(std::size_t pos, std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    drop_redo();
+    // If we are continuing the run of typing right where it left off we just
+    // grow the last record
+    if (!records_.empty() && (!sealed_ || run_)) {
+        Record &top = records_.back();
+        if (top.op == Op::Insert && top.data == NO_DATA &&
+            top.pos + top.len == pos) {
+            top.len += text.size();
+            sealed_ = false;
+            run_ = text.find('\n') == std::string_view::npos;
+            return;
+        }
+    }
+    push(Op::Insert, pos, text.size(), NO_DATA);
+    // A new line ends the run so every line typed is its own undo step
+    run_ = text.find('\n') == std::string_view::npos;
+    enforce_budget();
+}
+
+// Method to record text that is about to be erased, we have to copy it since
+// the document is about to forget it
+void UndoHistory::record_erase(const TextStorage &buf, std::size_t pos,
+                               std::size_t len) {
+    if (len == 0) {
+        return;
+    }
+    drop_redo();
+    std::size_t data = store(buf, pos, len);
+    push(Op::Erase, pos, len, data);
+    run_ = true;
+    enforce_budget();
+}
+
+// Method to record a replace all as a single record
+// Its data is a header with the match count and both lengths, the two strings
+// and then the offsets, len is the size of all of that so the budget and
+// compaction treat it like any other stored bytes
+void UndoHistory::record_replace(const std::vector<std::size_t> &at,
+                                 std::string_view from, std::string_view to) {
+    if (at.empty()) {
+        return;
+    }
+    drop_redo();
+    const std::uint64_t header[3] = {at.size(), from.size(), to.size()};
+    std::size_t data = arena_.size();
+    arena_.append(reinterpret_cast<const char *>(header), sizeof(header));
+    arena_.append(from);
+    arena_.append(to);
+    for (std::size_t pos : at) {
+        auto off = static_cast<std::uint64_t>(pos);
+        arena_.append(reinterpret_cast<const char *>(&off), sizeof(off));
+    }
+    std::size_t len = arena_.size() - data;
+    live_bytes_ += len;
+    push(Op::Replace, at.front(), len, data);
+    run_ = false;
+    enforce_budget();
+}
+
+// Method to record a batch of edits as a single record
+// Its data is the edit count, then the position and the old and new length of
+// every edit, then all the removed bytes and then all the inserted ones
+// Typing at many cursors continues a run like typing at one does
+void UndoHistory::record_splice(const TextStorage &buf,
+                                const std::vector<Splice> &edits) {
+    if (edits.empty()) {
+        return;
+    }
+    drop_redo();
+    std::size_t data = arena_.size();
+    auto put = [this](std::uint64_t v) {
+        arena_.append(reinterpret_cast<const char *>(&v), sizeof(v));
+    };
+    put(edits.size());
+    bool newline = false;
+    for (const Splice &e : edits) {
+        put(e.pos);
+        put(e.len);
+        put(e.text.size());
+        newline = newline || e.text.find('\n') != std::string_view::npos;
+    }
+    for (const Splice &e : edits) {
+        buf.for_each_chunk(e.pos, e.len, [this](std::string_view chunk) {
+            arena_.append(chunk);
+            return true;
+        });
+    }
+    for (const Splice &e : edits) {
+        arena_.append(e.text);
+    }
+    std::size_t len = arena_.size() - data;
+    live_bytes_ += len;
+    push(Op::Splice, edits.front().pos, len, data);
+    run_ = !newline;
+    enforce_budget();
+}
+
+void UndoHistory::seal() noexcept { sealed_ = true; }
+
+void UndoHistory::break_run() noexcept {
+    sealed_ = true;
+    run_ = false;
+}
+
+// Method to undo the most recent group, we walk its records backwards
+// applying the inverse of each one
+bool UndoHistory::undo(TextStorage &buf, const AppliedFn &applied) {
+    if (!can_undo()) {
+        return false;
+    }
+    std::uint64_t group = records_[current_ - 1].group;
+    touched_ = static_cast<std::size_t>(-1);
+    while (current_ > 0 && records_[current_ - 1].group == group) {
+        Record &r = records_[current_ - 1];
+        touched_ = std::min(touched_, r.pos);
+        if (r.op == Op::Insert) {
+            // This is the only moment we copy an insert, redo needs it back
+            if (r.data == NO_DATA) {
+                r.data = store(buf, r.pos, r.len);
+            }
+            buf.set_cursor(r.pos + r.len);
+            buf.erase_back(r.len);
+            if (applied) {
+                applied({r.pos, r.len, {}});
+            }
+        } else if (r.op == Op::Erase) {
+            std::string_view text =
+                std::string_view(arena_).substr(r.data, r.len);
+            buf.set_cursor(r.pos);
+            buf.reserve(r.len);
+            buf.insert(text);
+            if (applied) {
+                applied({r.pos, 0, text});
+            }
+        } else if (r.op == Op::Replace) {
+            replay(r, false, buf, applied);
+        } else {
+            replay_splice(r, false, buf, applied);
+        }
+        --current_;
+    }
+    break_run();
+    enforce_budget();
+    return true;
+}
+
+// Method to redo the next group by replaying its records forwards
+bool UndoHistory::redo(TextStorage &buf, const AppliedFn &applied) {
+    if (!can_redo()) {
+        return false;
+    }
+    std::uint64_t group = records_[current_].group;
+    touched_ = static_cast<std::size_t>(-1);
+    while (current_ < records_.size() && records_[current_].group == group) {
+        const Record &r = records_[current_];
+        touched_ = std::min(touched_, r.pos);
+        if (r.op == Op::Insert) {
+            std::string_view text =
+                std::string_view(arena_).substr(r.data, r.len);
+            buf.set_cursor(r.pos);
+            buf.reserve(r.len);
+            buf.insert(text);
+            if (applied) {
+                applied({r.pos, 0, text});
+            }
+        } else if (r.op == Op::Erase) {
+            buf.set_cursor(r.pos + r.len);
+            buf.erase_back(r.len);
+            if (applied) {
+                applied({r.pos, r.len, {}});
+            }
+        } else if (r.op == Op::Replace) {
+            replay(r, true, buf, applied);
+        } else {
+            replay_splice(r, true, buf, applied);
+        }
+        ++current_;
+    }
+    break_run();
+    return true;
+}
+
+bool UndoHistory::can_undo() const noexcept { return current_ > 0; }
+
+bool UndoHistory::can_redo() const noexcept {
+    return current_ < records_.size();
+}
+
+// Every record in a group starts at or after its pos, so the lowest pos
+// bounds what the group changed no matter which way it was replayed
+std::size_t UndoHistory::touched() const noexcept { return touched_; }
+
+// Method to forget the whole history
+void UndoHistory::clear() {
+    records_.clear();
+    arena_.clear();
+    arena_.shrink_to_fit();
+    current_ = 0;
+    live_bytes_ = 0;
+    break_run();
+}
+
+// Method to change the memory budget, shrinking it drops old history now
+void UndoHistory::set_budget(std::size_t bytes) {
+    budget_ = bytes;
+    enforce_budget();
+}
+
+std::size_t UndoHistory::budget() const noexcept { return budget_; }
+
+// Method to report how much memory the history holds on to
+std::size_t UndoHistory::memory() const noexcept {
+    return arena_.size() + records_.size() * sizeof(Record);
+}
+
+// Method to view the stored bytes, without the holes compaction removes
+std::string_view UndoHistory::stored() {
+    compact();
+    return arena_;
+}
+
+// Method to free the stored bytes once a spill holds them
+void UndoHistory::forget() {
+    arena_.clear();
+    arena_.shrink_to_fit();
+}
+
+// Method to take the stored bytes back after a spill
+void UndoHistory::restore(std::string_view bytes) { arena_.assign(bytes); }
+
+// Helper method to append a record, it joins the current group when we are
+// inside a transaction or continuing a run of the same kind of edit
+void UndoHistory::push(Op op, std::size_t pos, std::size_t len,
+                       std::size_t data) {
+    bool join = false;
+    if (!records_.empty()) {
+        const Record &top = records_.back();
+        // Backspacing continues a run when it erases right before the last
+        // erase, typing continues one when it lands right after it
+        // A batch of edits has no single place, any batch continues one
+        bool adjacent = op == Op::Insert  ? top.pos + top.len == pos
+                        : op == Op::Erase ? pos + len == top.pos
+                                          : true;
+        join = !sealed_ || (run_ && top.op == op && adjacent);
+    }
+    std::uint64_t group = join ? records_.back().group : next_group_++;
+    records_.push_back({op, pos, len, data, group});
+    ++current_;
+    sealed_ = false;
+}
+
+// Helper method to forget everything that could have been redone
+void UndoHistory::drop_redo() {
+    while (records_.size() > current_) {
+        drop_bytes(records_.back());
+        records_.pop_back();
+    }
+}
+
+// Helper method to account for a record's bytes becoming garbage
+void UndoHistory::drop_bytes(const Record &r) noexcept {
+    if (r.data != NO_DATA) {
+        live_bytes_ -= r.len;
+    }
+}
+
+// Helper method to copy a range of the document into the arena
+std::size_t UndoHistory::store(const TextStorage &buf, std::size_t pos,
+                               std::size_t len) {
+    std::size_t offset = arena_.size();
+    buf.for_each_chunk(pos, len, [this](std::string_view chunk) {
+        arena_.append(chunk);
+        return true;
+    });
+    live_bytes_ += len;
+    return offset;
+}
+
+// Helper method to apply a replace record, forwards replaces the old matches
+// of from with to, backwards finds the copies of to where they ended up and
+// puts from back
+// Reported one match at a time, every match before one moved it by how much
+// the replacement grew or shrank
+void UndoHistory::replay(const Record &r, bool forward, TextStorage &buf,
+                         const AppliedFn &applied) const {
+    const char *data = arena_.data() + r.data;
+    std::uint64_t header[3];
+    std::memcpy(header, data, sizeof(header));
+    std::string_view from(data + sizeof(header), header[1]);
+    std::string_view to(from.data() + from.size(), header[2]);
+    const char *offsets = to.data() + to.size();
+    std::vector<std::size_t> at(header[0]);
+    std::size_t last = 0;
+    for (std::size_t i = 0; i < at.size(); ++i) {
+        std::uint64_t pos;
+        std::memcpy(&pos, offsets + i * sizeof(pos), sizeof(pos));
+        // Every match before this one changed length by the same amount
+        std::size_t moved = pos - i * from.size() + i * to.size();
+        at[i] = forward ? pos : moved;
+        last = forward ? moved : pos;
+    }
+    if (!forward) {
+        std::swap(from, to);
+    }
+    buf.replace_matches(at, from.size(), to);
+    // The cursor ends up after the last replacement
+    buf.set_cursor(last + to.size());
+    if (!applied) {
+        return;
+    }
+    for (std::size_t i = 0; i < at.size(); ++i) {
+        applied({at[i] - i * from.size() + i * to.size(), from.size(), to});
+    }
+}
+
+// Helper method to apply a batch record, forwards replays the edits as they
+// were made, backwards puts the removed bytes back where the inserted ones
+// ended up
+// The batch's offsets are all from before it, they are reported with the
+// shift of the edits before each one added
+void UndoHistory::replay_splice(const Record &r, bool forward,
+                                TextStorage &buf,
+                                const AppliedFn &applied) const {
+    const char *data = arena_.data() + r.data;
+    auto get = [&data]() {
+        std::uint64_t v;
+        std::memcpy(&v, data, sizeof(v));
+        data += sizeof(v);
+        return static_cast<std::size_t>(v);
+    };
+    std::vector<Splice> edits(get());
+    std::vector<std::size_t> old_len(edits.size());
+    for (std::size_t i = 0; i < edits.size(); ++i) {
+        edits[i].pos = get();
+        old_len[i] = get();
+        edits[i].len = get();
+    }
+    const char *removed = data;
+    const char *inserted = data;
+    for (std::size_t n : old_len) {
+        inserted += n;
+    }
+    // Every edit before this one moved it by how much it grew or shrank
+    std::size_t shift = 0;
+    std::size_t last = 0;
+    for (std::size_t i = 0; i < edits.size(); ++i) {
+        Splice &e = edits[i];
+        std::size_t new_len = e.len;
+        std::string_view before(removed, old_len[i]);
+        std::string_view after(inserted, new_len);
+        removed += old_len[i];
+        inserted += new_len;
+        if (forward) {
+            last = e.pos + shift + new_len;
+            e = {e.pos, old_len[i], after};
+        } else {
+            last = e.pos + old_len[i];
+            e = {e.pos + shift, new_len, before};
+        }
+        shift += new_len - old_len[i];
+    }
+    buf.splice(edits);
+    // The cursor ends up after the last edit
+    buf.set_cursor(last);
+    if (!applied) {
+        return;
+    }
+    shift = 0;
+    for (const Splice &e : edits) {
+        applied({e.pos + shift, e.len, e.text});
+        shift += e.text.size() - e.len;
+    }
+}
+
+// Helper method to drop the oldest groups until we fit in the budget
+void UndoHistory::enforce_budget() {
+    while (live_bytes_ + records_.size() * sizeof(Record) > budget_ &&
+           !records_.empty()) {
+        std::uint64_t group = records_.front().group;
+        // We always keep the newest group so the last edit can be undone
+        if (group == records_.back().group) {
+            break;
+        }
+        // If the oldest group was already undone every group after it is
+        // redo history that depends on it, so all of it has to go
+        if (current_ == 0) {
+            drop_redo();
+            break;
+        }
+        while (!records_.empty() && records_.front().group == group) {
+            drop_bytes(records_.front());
+            records_.pop_front();
+            if (current_ > 0) {
+                --current_;
+            }
+        }
+    }
+    // Dropped records leave holes in the arena, once the holes outweigh the
+    // live bytes we squeeze them out
+    std::size_t garbage = arena_.size() - live_bytes_;
+    if (garbage > live_bytes_ && garbage > (1u << 20)) {
+        compact();
+    }
+}
+
+// Helper method to rebuild the arena with only the live bytes
+// This is linear in the live history and only runs once garbage exceeds it,
+// so the cost is amortized over the edits that created the garbage
+void UndoHistory::compact() {
+    std::string fresh;
+    fresh.reserve(live_bytes_);
+    for (Record &r : records_) {
+        if (r.data != NO_DATA) {
+            std::size_t offset = fresh.size();
+            fresh.append(arena_, r.data, r.len);
+            r.data = offset;
+        }
+    }
+    arena_.swap(fresh);
+}
@@ -0,0 +1,204 @@
+#include "../include/utf8.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PHOSPHOR_UTF8_SIMD 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PHOSPHOR_UTF8_SIMD 1
+#endif
+
+namespace utf8 {
+
+#ifdef PHOSPHOR_UTF8_SIMD
+// Bytes we look at per step
+static constexpr std::size_t LANES = 16;
+#endif
+
+#if defined(__SSE2__)
+
+// Helper to return a bit per byte that starts a character
+// Continuation bytes are 0x80 to 0xBF, which as signed bytes are -128 to -65,
+// so a single signed compare against -65 finds every other byte
+static inline unsigned starts(const char *p) noexcept {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    return static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))));
+}
+
+// Helper to return a bit per byte that has its top bit set
+static inline unsigned high(const char *p) noexcept {
+    return static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))));
+}
+#elif defined(PHOSPHOR_UTF8_SIMD)
+// Helper to pack a compare result into a bit per byte like movemask does
+// NEON has no movemask, so every lane keeps the one bit for its position and
+// the two halves are summed into a byte each
+static inline unsigned movemask(uint8x16_t lanes) noexcept {
+    static const uint8_t BITS[LANES] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                        1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(lanes, vld1q_u8(BITS));
+    return static_cast<unsigned>(vaddv_u8(vget_low_u8(bits))) |
+           (static_cast<unsigned>(vaddv_u8(vget_high_u8(bits))) << 8);
+}
+
+// Helper to return a bit per byte that starts a character, same signed
+// compare against -65 as the SSE2 version
+static inline unsigned starts(const char *p) noexcept {
+    int8x16_t v = vld1q_s8(reinterpret_cast<const int8_t *>(p));
+    return movemask(vcgtq_s8(v, vdupq_n_s8(-65)));
+}
+
+// Helper to return a bit per byte that has its top bit set
+static inline unsigned high(const char *p) noexcept {
+    int8x16_t v = vld1q_s8(reinterpret_cast<const int8_t *>(p));
+    return movemask(vcltzq_s8(v));
+}
+#endif
+
+// Method to append the encoding of a code point
+void encode(int codepoint, std::string &out) {
+    auto cp = static_cast<unsigned>(codepoint);
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        cp = REPLACEMENT;
+    }
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Method to decode the character at the start of text
+// Overlong encodings, surrogates and truncated sequences all come back as a
+// single byte of REPLACEMENT so the caller always makes progress
+std::size_t decode(std::string_view text, int &codepoint) noexcept {
+    codepoint = REPLACEMENT;
+    if (text.empty()) {
+        return 0;
+    }
+    auto lead = static_cast<unsigned char>(text[0]);
+    if (lead < 0x80) {
+        codepoint = lead;
+        return 1;
+    }
+    std::size_t len = lead >= 0xF0   ? 4
+                      : lead >= 0xE0 ? 3
+                      : lead >= 0xC0 ? 2
+                                     : 0;
+    if (len == 0 || lead > 0xF4 || text.size() < len) {
+        return 1;
+    }
+    unsigned cp = lead & (0x7F >> len);
+    for (std::size_t i = 1; i < len; ++i) {
+        if (!continuation(text[i])) {
+            return 1;
+        }
+        cp = (cp << 6) | (static_cast<unsigned char>(text[i]) & 0x3F);
+    }
+    static constexpr unsigned MIN[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if (cp < MIN[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        return 1;
+    }
+    codepoint = static_cast<int>(cp);
+    return len;
+}
+
+// Method to return how many leading bytes are plain ASCII
+std::size_t ascii_prefix(std::string_view text) noexcept {
+    std::size_t i = 0;
+#ifdef PHOSPHOR_UTF8_SIMD
+    // A byte is ASCII when its top bit is clear
+    for (; i + LANES <= text.size(); i += LANES) {
+        if (unsigned mask = high(text.data() + i)) {
+            return i + static_cast<std::size_t>(__builtin_ctz(mask));
+        }
+    }
+#endif
+    while (i < text.size() && static_cast<unsigned char>(text[i]) < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+// Method to count the characters that start in text
+std::size_t count(std::string_view text) noexcept {
+    std::size_t n = 0;
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + LANES <= text.size(); i += LANES) {
+        unsigned mask = starts(text.data() + i);
+        n += static_cast<std::size_t>(__builtin_popcount(mask));
+    }
+#elif defined(PHOSPHOR_UTF8_SIMD)
+    // Counting needs no mask, a start byte compares to all ones and vcntq_u8
+    // turns that into 8, so the lanes sum to 8 per character
+    for (; i + LANES <= text.size(); i += LANES) {
+        auto lanes = reinterpret_cast<const int8_t *>(text.data() + i);
+        int8x16_t v = vld1q_s8(lanes);
+        uint8x16_t bits = vcntq_u8(vcgtq_s8(v, vdupq_n_s8(-65)));
+        n += static_cast<std::size_t>(vaddlvq_u8(bits)) / 8;
+    }
+#endif
+    for (; i < text.size(); ++i) {
+        n += !continuation(text[i]);
+    }
+    return n;
+}
+
+// Method to find where the nth character starts in text
+std::size_t nth(std::string_view text, std::size_t &n) noexcept {
+    std::size_t i = 0;
+#ifdef PHOSPHOR_UTF8_SIMD
+    // Whole blocks that end before the character are skipped with a popcount,
+    // inside the block that holds it we drop the n starts before it
+    for (; i + LANES <= text.size(); i += LANES) {
+        unsigned mask = starts(text.data() + i);
+        auto found = static_cast<std::size_t>(__builtin_popcount(mask));
+        if (found <= n) {
+            n -= found;
+            continue;
+        }
+        for (; n > 0; --n) {
+            mask &= mask - 1;
+        }
+        return i + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+#endif
+    for (; i < text.size(); ++i) {
+        if (continuation(text[i])) {
+            continue;
+        }
+        if (n == 0) {
+            return i;
+        }
+        --n;
+    }
+    return text.size();
+}
+
+// Method to test if a code point continues the grapheme before it
+bool extends_grapheme(int cp) noexcept {
+    return (cp >= 0x0300 && cp <= 0x036F) ||   // Combining diacritics
+           (cp >= 0x1AB0 && cp <= 0x1AFF) ||   // Combining diacritics ext
+           (cp >= 0x1DC0 && cp <= 0x1DFF) ||   // Combining diacritics supp
+           (cp >= 0x20D0 && cp <= 0x20FF) ||   // Combining marks for symbols
+           (cp >= 0xFE20 && cp <= 0xFE2F) ||   // Combining half marks
+           (cp >= 0xFE00 && cp <= 0xFE0F) ||   // Variation selectors
+           (cp >= 0x1F3FB && cp <= 0x1F3FF) || // Emoji skin tones
+           (cp >= 0xE0020 && cp <= 0xE007F) || // Emoji tag sequences
+           cp == 0x200D;                       // Zero width joiner
+}
+
+} // namespace utf8
@@ -0,0 +1,195 @@
+#include "../include/workspace.hpp"
+#include "../include/mapped_file.hpp"
+#include "../include/piece_table.hpp"
+#include "../include/profiler.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <system_error>
+
+// We compare absolute paths so "a.txt" and "./a.txt" are the same file
+bool same_file(const std::filesystem::path &a,
+               const std::filesystem::path &b) {
+    if (a.empty() || b.empty()) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::path abs_a = std::filesystem::absolute(a, ec);
+    std::filesystem::path abs_b = std::filesystem::absolute(b, ec);
+    return abs_a.lexically_normal() == abs_b.lexically_normal();
+}
+
+// Helper to add up the text a document keeps in memory
+// A buffer reading its file in place only holds what was typed into it
+static std::size_t text_held(const Document &doc) noexcept {
+    if (!doc.buffer) {
+        return 0;
+    }
+    if (doc.source) {
+        return static_cast<const PieceTable &>(*doc.buffer).private_bytes();
+    }
+    return doc.buffer->size();
+}
+
+// Helper to add up what a document keeps in memory, one that is being
+// spilled already counts as gone
+static std::size_t held(const Document &doc) noexcept {
+    return doc.spilling ? 0 : text_held(doc) + doc.history.memory();
+}
+
+// Workspace constructor - we only need to know how much text we may keep
+Workspace::Workspace(std::size_t budget) : budget_(budget) {}
+
+// Method to add a document, the first one added is the active one
+std::size_t Workspace::add(Document doc) {
+    doc.used = ++clock_;
+    docs_.push_back(std::move(doc));
+    return docs_.size() - 1;
+}
+
+std::size_t Workspace::size() const noexcept { return docs_.size(); }
+
+std::size_t Workspace::active() const noexcept { return active_; }
+
+Document &Workspace::at(std::size_t i) { return docs_.at(i); }
+
+// Method to find the document open on a file
+std::size_t Workspace::find(const std::filesystem::path &file) const {
+    for (std::size_t i = 0; i < docs_.size(); ++i) {
+        if (same_file(docs_[i].file, file)) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+// Method to make a document the active one
+// A spill still being written is called off, the document never left memory
+void Workspace::activate(std::size_t i) {
+    collect_spills();
+    Document &doc = docs_.at(i);
+    if (doc.spilling) {
+        spiller_.cancel(i);
+        doc.spilling = false;
+    }
+    if (doc.spill) {
+        page_in(doc);
+    }
+    active_ = i;
+    doc.used = ++clock_;
+}
+
+// The editor keeps polling while either is going on, so a finished spill is
+// picked up even if nobody touches a key
+bool Workspace::loading() const noexcept {
+    return std::any_of(docs_.begin(), docs_.end(), [](const Document &doc) {
+        return doc.loader != nullptr || doc.spilling;
+    });
+}
+
+// Method to spill inactive documents until the rest fit the budget
+// A document that is still loading is left alone, its loader reads into it,
+// and so is one that was spilled already since it has not changed since
+void Workspace::enforce_budget() {
+    collect_spills();
+    std::size_t have = resident();
+    while (have > budget_) {
+        std::size_t oldest = NONE;
+        for (std::size_t i = 0; i < docs_.size(); ++i) {
+            const Document &doc = docs_[i];
+            if (i == active_ || !doc.buffer || doc.loader || doc.spilling ||
+                doc.spill || held(doc) == 0) {
+                continue;
+            }
+            if (oldest == NONE || doc.used < docs_[oldest].used) {
+                oldest = i;
+            }
+        }
+        if (oldest == NONE) {
+            return;
+        }
+        have -= held(docs_[oldest]);
+        spill(oldest);
+    }
+}
+
+// Method to change the budget, shrinking it spills documents now
+void Workspace::set_budget(std::size_t bytes) {
+    budget_ = bytes;
+    enforce_budget();
+}
+
+std::size_t Workspace::budget() const noexcept { return budget_; }
+
+// Method to add up the text and history inactive documents keep in memory
+std::size_t Workspace::resident() const noexcept {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < docs_.size(); ++i) {
+        if (i != active_) {
+            total += held(docs_[i]);
+        }
+    }
+    return total;
+}
+
+// Method to swap the documents the writer finished for their spill files
+// The file is mapped and unlinked, the mapping keeps it alive for as long
+// as the document needs it
+void Workspace::collect_spills() {
+    while (std::optional<SpillDone> done = spiller_.poll()) {
+        Document &doc = docs_.at(done->doc);
+        doc.spilling = false;
+        if (!done->ok) {
+            continue;
+        }
+        auto mapping = std::make_shared<MappedFile>();
+        bool mapped = mapping->open(done->path);
+        std::error_code ec;
+        std::filesystem::remove(done->path, ec);
+        if (!mapped) {
+            std::cerr << "Could not read " << done->path << std::endl;
+            continue;
+        }
+        std::string_view bytes = mapping->view();
+        if (doc.source) {
+            static_cast<PieceTable &>(*doc.buffer)
+                .rehome(bytes.data(), mapping);
+        } else {
+            doc.kind = doc.buffer->kind();
+            doc.buffer.reset();
+        }
+        doc.history.forget();
+        doc.spill = std::move(mapping);
+    }
+}
+
+// Helper method to hand a document's text and history to the spill writer
+// A buffer reading its file in place only hands over its private bytes,
+// anything else is written out a chunk at a time so it is never flattened
+// in memory to spill it
+void Workspace::spill(std::size_t i) {
+    Document &doc = docs_[i];
+    Snapshot parts = doc.source
+                         ? static_cast<const PieceTable &>(*doc.buffer)
+                               .private_parts()
+                         : doc.buffer->snapshot();
+    doc.spill_text = parts.size;
+    parts.parts.push_back(doc.history.stored());
+    doc.spilling = true;
+    spiller_.submit(i, std::move(parts));
+}
+
+// Helper method to bring a spilled document back from its spill file
+// The gap buffer copies the mapping once, the piece table reads from it in
+// place, the history's bytes are copied back out since it appends to them
+void Workspace::page_in(Document &doc) {
+    ProfileScope scope("page_in");
+    std::string_view bytes = doc.spill->view();
+    doc.history.restore(bytes.substr(doc.spill_text));
+    if (!doc.buffer) {
+        doc.buffer =
+            make_storage(doc.kind, bytes.substr(0, doc.spill_text), doc.spill);
+        doc.cursor = std::min(doc.cursor, doc.buffer->size());
+    }
+    doc.spill.reset();
+}